@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+using namespace std;
+
+
+// Sprite sheet paths are given relative to this folder, the same way the game requests them.
+#define IMAGE_ROOT "res/img/"
+
+// The settings for packing sprite sheets into atlases.
+struct Settings
+{
+	// The path of the atlases to write, relative to the image folder, without an extension.
+	string out = "atlas";
+
+	// The largest width and height of an atlas page.
+	int size = 2048;
+
+	// The number of empty pixels kept around every sprite so that filtering does not bleed between them.
+	int padding = 1;
+
+	// The sprite sheets to pack, relative to the image folder.
+	vector<string> sheets;
+};
+
+// An image with 8-bit red, green, blue and alpha channels.
+struct Image
+{
+	int width = 0;
+	int height = 0;
+	vector<uint8_t> pixels;
+};
+
+// A sprite read from a sprite sheet's .meta file.
+struct SpriteRect
+{
+	// The name of the sprite.
+	string name;
+
+	// The other values on the sprite's line, in the order they were read.
+	vector<pair<string, string>> values;
+
+	// The index of the sheet the sprite comes from.
+	int sheet;
+
+	// The position and size of the sprite on its sheet.
+	int x, y, width, height;
+
+	// The atlas page and position the sprite was packed to.
+	int page = -1;
+	int px = 0, py = 0;
+};
+
+
+// ---------- PNG ----------
+
+/// <summary>Reads a PNG of any format and converts it to 8-bit RGBA.</summary>
+/// <param name="path">The path to the image.</param>
+/// <param name="image">The image to fill in.</param>
+/// <returns>False if the file could not be read or is not a valid PNG.</returns>
+bool load_png(const string& path, Image& image)
+{
+	png_image png;
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&png, path.c_str()))
+		return false;
+
+	png.format = PNG_FORMAT_RGBA;
+	image.width = (int)png.width;
+	image.height = (int)png.height;
+	image.pixels.resize(PNG_IMAGE_SIZE(png));
+	if (!png_image_finish_read(&png, nullptr, image.pixels.data(), 0, nullptr))
+	{
+		png_image_free(&png);
+		return false;
+	}
+
+	return true;
+}
+
+/// <summary>Writes an RGBA image as a PNG.</summary>
+/// <returns>False if the file could not be written.</returns>
+bool save_png(const string& path, const Image& image)
+{
+	png_image png;
+	memset(&png, 0, sizeof(png));
+	png.version = PNG_IMAGE_VERSION;
+	png.width = image.width;
+	png.height = image.height;
+	png.format = PNG_FORMAT_RGBA;
+	return png_image_write_to_file(&png, path.c_str(), 0, image.pixels.data(), 0, nullptr) != 0;
+}
+
+
+// ---------- META FILES ----------
+
+/// <summary>Splits a line into its ID and key = value pairs, by the same rules as the game's LoadFile.</summary>
+/// <param name="line">The line to split.</param>
+/// <param name="values">The list to add the pairs to, in the order they appear.</param>
+/// <returns>The ID, which is everything before the first key. Empty if the line has no pairs.</returns>
+string split_line(const string& line, vector<pair<string, string>>& values)
+{
+	const char* space = " \t";
+
+	// The first key is the word just before the first equals sign
+	size_t eq = line.find('=');
+	if (eq == string::npos || eq == 0)
+		return string();
+	size_t key_end = line.find_last_not_of(space, eq - 1);
+	if (key_end == string::npos)
+		return string();
+	size_t key_start = line.find_last_of(space, key_end);
+	key_start = key_start == string::npos ? 0 : key_start + 1;
+
+	size_t id_end = key_start > 0 ? line.find_last_not_of(space, key_start - 1) : string::npos;
+	string id = id_end == string::npos ? string() : line.substr(0, id_end + 1);
+
+	size_t pos = key_start;
+	while (pos < line.size())
+	{
+		eq = line.find('=', pos);
+		if (eq == string::npos)
+			break;
+
+		size_t first = line.find_first_not_of(space, pos);
+		size_t last = line.find_last_not_of(space, eq - 1);
+		string key = first < eq && last != string::npos && last >= first ? line.substr(first, last - first + 1) : string();
+
+		// Values may be quoted to hold spaces, and spaces are allowed around the equals sign
+		size_t start = line.find_first_not_of(space, eq + 1);
+		if (start == string::npos)
+			break;
+		string value;
+		if (line[start] == '"')
+		{
+			size_t close = line.find('"', start + 1);
+			if (close == string::npos)
+				close = line.size();
+			value = line.substr(start + 1, close - start - 1);
+			pos = close + 1;
+		}
+		else
+		{
+			size_t stop = line.find_first_of(space, start);
+			if (stop == string::npos)
+				stop = line.size();
+			value = line.substr(start, stop - start);
+			pos = stop;
+		}
+
+		values.emplace_back(key, value);
+	}
+
+	return id;
+}
+
+/// <summary>Reads the sprites listed in a sprite sheet's .meta file.</summary>
+/// <param name="path">The path to the .meta file.</param>
+/// <param name="sheet">The index of the sheet, stored with each sprite.</param>
+/// <param name="sprites">The list to add the sprites to.</param>
+/// <returns>False if the file could not be read or a sprite has no position or size.</returns>
+bool load_meta(const string& path, int sheet, vector<SpriteRect>& sprites)
+{
+	ifstream file(path);
+	if (!file)
+		return false;
+
+	string line;
+	while (getline(file, line))
+	{
+		vector<pair<string, string>> values;
+		string name = split_line(line, values);
+		if (name.empty())
+			continue;
+
+		SpriteRect sprite;
+		sprite.sheet = sheet;
+		sprite.name = name;
+		sprite.x = sprite.y = sprite.width = sprite.height = -1;
+
+		for (const pair<string, string>& v : values)
+		{
+			if (v.first == "left")			sprite.x = atoi(v.second.c_str());
+			else if (v.first == "top")		sprite.y = atoi(v.second.c_str());
+			else if (v.first == "width")	sprite.width = atoi(v.second.c_str());
+			else if (v.first == "height")	sprite.height = atoi(v.second.c_str());
+			else							sprite.values.push_back(v);
+		}
+
+		if (sprite.x < 0 || sprite.y < 0 || sprite.width <= 0 || sprite.height <= 0)
+		{
+			cerr << "Sprite " << sprite.name << " in " << path << " has no position or size" << endl;
+			return false;
+		}
+		sprites.push_back(sprite);
+	}
+
+	return true;
+}
+
+/// <summary>Swaps the .png extension of a path for .meta.</summary>
+string meta_path(const string& path)
+{
+	size_t dot = path.find_last_of('.');
+	return (dot == string::npos ? path : path.substr(0, dot)) + ".meta";
+}
+
+
+// ---------- PACKING ----------
+
+/// <summary>Rounds a size up to a power of two.</summary>
+int next_power_of_two(int n)
+{
+	int p = 1;
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+// The shelves filled so far on an atlas page.
+struct Page
+{
+	int shelf_x = 0;
+	int shelf_y = 0;
+	int shelf_height = 0;
+	int used_width = 0;
+};
+
+/// <summary>Places sprites on a page's shelves, tallest sprites first.</summary>
+/// <param name="page">The page to place the sprites on. It is left unchanged if they do not all fit.</param>
+/// <param name="sprites">The sprites to place, sorted by height.</param>
+/// <returns>True if every sprite fit.</returns>
+bool place(Page& page, const vector<SpriteRect*>& sprites, int size, int padding)
+{
+	Page next = page;
+	vector<pair<int, int>> positions;
+	for (SpriteRect* s : sprites)
+	{
+		int w = s->width + 2 * padding;
+		int h = s->height + 2 * padding;
+
+		// Start a new shelf when the current one is full
+		if (next.shelf_x + w > size)
+		{
+			next.shelf_y += next.shelf_height;
+			next.shelf_x = 0;
+			next.shelf_height = 0;
+		}
+		if (w > size || next.shelf_y + h > size)
+			return false;
+
+		positions.emplace_back(next.shelf_x + padding, next.shelf_y + padding);
+		next.shelf_x += w;
+		next.shelf_height = max(next.shelf_height, h);
+		next.used_width = max(next.used_width, next.shelf_x);
+	}
+
+	for (size_t k = 0; k < sprites.size(); ++k)
+	{
+		sprites[k]->px = positions[k].first;
+		sprites[k]->py = positions[k].second;
+	}
+	page = next;
+	return true;
+}
+
+/// <summary>Packs sprites into pages, keeping every sheet's sprites together on one page.</summary>
+/// <param name="sprites">The sprites to pack. Each is given a page and a position.</param>
+/// <param name="sheets">The number of sheets the sprites come from.</param>
+/// <param name="size">The largest width and height of a page.</param>
+/// <param name="padding">The space kept around each sprite.</param>
+/// <returns>The size of each page, or an empty list if a sheet is too big to fit on one page.</returns>
+vector<pair<int, int>> pack(vector<SpriteRect>& sprites, int sheets, int size, int padding)
+{
+	vector<vector<SpriteRect*>> groups(sheets);
+	vector<long long> areas(sheets, 0);
+	for (SpriteRect& s : sprites)
+	{
+		groups[s.sheet].push_back(&s);
+		areas[s.sheet] += (long long)s.width * s.height;
+	}
+
+	// The biggest sheets are placed first, while the pages are still empty
+	vector<int> order;
+	for (int k = 0; k < sheets; ++k)
+		order.push_back(k);
+	stable_sort(order.begin(), order.end(), [&](int a, int b) { return areas[a] > areas[b]; });
+
+	vector<Page> pages;
+	for (int sheet : order)
+	{
+		vector<SpriteRect*>& group = groups[sheet];
+		if (group.empty())
+			continue;
+		stable_sort(group.begin(), group.end(), [](const SpriteRect* a, const SpriteRect* b)
+		{
+			return a->height != b->height ? a->height > b->height : a->width > b->width;
+		});
+
+		size_t p = 0;
+		while (p < pages.size() && !place(pages[p], group, size, padding))
+			++p;
+		if (p == pages.size())
+		{
+			pages.emplace_back();
+			if (!place(pages[p], group, size, padding))
+				return {};
+		}
+
+		for (SpriteRect* s : group)
+			s->page = (int)p;
+	}
+
+	vector<pair<int, int>> result;
+	for (const Page& page : pages)
+		result.emplace_back(next_power_of_two(page.used_width), next_power_of_two(page.shelf_y + page.shelf_height));
+	return result;
+}
+
+
+int main(int argc, char** argv)
+{
+	Settings settings;
+	for (int k = 1; k < argc; ++k)
+	{
+		string flag = argv[k];
+		if (flag == "--out" && k + 1 < argc)			settings.out = argv[++k];
+		else if (flag == "--size" && k + 1 < argc)		settings.size = atoi(argv[++k]);
+		else if (flag == "--padding" && k + 1 < argc)	settings.padding = atoi(argv[++k]);
+		else if (flag.rfind("--", 0) == 0)
+		{
+			cerr << "Unknown option " << flag << endl;
+			return 1;
+		}
+		else
+			settings.sheets.push_back(flag);
+	}
+
+	if (settings.sheets.empty() || settings.size <= 0 || settings.padding < 0)
+	{
+		cerr << "Usage: atlas [--out atlas] [--size 2048] [--padding 1] sheet.png..." << endl;
+		return 1;
+	}
+
+	vector<Image> images(settings.sheets.size());
+	vector<SpriteRect> sprites;
+	for (size_t k = 0; k < settings.sheets.size(); ++k)
+	{
+		string path = IMAGE_ROOT + settings.sheets[k];
+		if (!load_png(path, images[k]))
+		{
+			cerr << "Could not read image " << path << endl;
+			return 1;
+		}
+		if (!load_meta(meta_path(path), (int)k, sprites))
+		{
+			cerr << "Could not read sprites from " << meta_path(path) << endl;
+			return 1;
+		}
+	}
+
+	// Sprites are looked up by name alone, so a name may only be used once across every sheet
+	vector<const SpriteRect*> names;
+	for (const SpriteRect& s : sprites)
+	{
+		names.push_back(&s);
+		const Image& image = images[s.sheet];
+		if (s.x + s.width > image.width || s.y + s.height > image.height)
+		{
+			cerr << "Sprite " << s.name << " lies outside " << settings.sheets[s.sheet] << endl;
+			return 1;
+		}
+	}
+	sort(names.begin(), names.end(), [](const SpriteRect* a, const SpriteRect* b) { return a->name < b->name; });
+	for (size_t k = 1; k < names.size(); ++k)
+	{
+		if (names[k]->name == names[k - 1]->name)
+		{
+			cerr << "Sprite " << names[k]->name << " is in both " << settings.sheets[names[k - 1]->sheet] << " and " << settings.sheets[names[k]->sheet] << endl;
+			return 1;
+		}
+	}
+
+	vector<pair<int, int>> pages = pack(sprites, (int)settings.sheets.size(), settings.size, settings.padding);
+	if (pages.empty())
+	{
+		cerr << "A sheet does not fit on a " << settings.size << "x" << settings.size << " atlas" << endl;
+		return 1;
+	}
+
+	// Copy each sprite onto its page and list it in the page's .meta file
+	vector<Image> atlases(pages.size());
+	vector<ostringstream> metas(pages.size());
+	for (size_t p = 0; p < pages.size(); ++p)
+	{
+		atlases[p].width = pages[p].first;
+		atlases[p].height = pages[p].second;
+		atlases[p].pixels.assign((size_t)atlases[p].width * atlases[p].height * 4, 0);
+	}
+
+	for (const SpriteRect& s : sprites)
+	{
+		const Image& src = images[s.sheet];
+		Image& dst = atlases[s.page];
+		for (int y = 0; y < s.height; ++y)
+			memcpy(&dst.pixels[((size_t)(s.py + y) * dst.width + s.px) * 4], &src.pixels[((size_t)(s.y + y) * src.width + s.x) * 4], (size_t)s.width * 4);
+
+		ostringstream& meta = metas[s.page];
+		meta << s.name << "\tleft=" << s.px << " top=" << s.py << " width=" << s.width << " height=" << s.height;
+		for (const pair<string, string>& v : s.values)
+		{
+			// Values with spaces are quoted, so they read back as one value
+			if (v.second.find_first_of(" \t") == string::npos)	meta << " " << v.first << "=" << v.second;
+			else												meta << " " << v.first << "=\"" << v.second << "\"";
+		}
+		meta << "\n";
+	}
+
+	// The index tells the game which page each original sheet was packed onto
+	ostringstream index;
+	for (size_t p = 0; p < pages.size(); ++p)
+	{
+		string page = settings.out + to_string(p) + ".png";
+		if (!save_png(IMAGE_ROOT + page, atlases[p]))
+		{
+			cerr << "Could not write " << IMAGE_ROOT << page << endl;
+			return 1;
+		}
+		ofstream meta(IMAGE_ROOT + meta_path(page));
+		meta << metas[p].str();
+
+		cout << page << ": " << atlases[p].width << "x" << atlases[p].height << endl;
+	}
+
+	for (size_t k = 0; k < settings.sheets.size(); ++k)
+	{
+		// Sheets with no sprites are left out so the game keeps loading them directly
+		auto iter = find_if(sprites.begin(), sprites.end(), [k](const SpriteRect& s) { return s.sheet == (int)k; });
+		if (iter != sprites.end())
+			index << settings.sheets[k] << "\tatlas=\"" << settings.out << iter->page << ".png\"\n";
+	}
+
+	ofstream index_file(IMAGE_ROOT + settings.out + ".txt");
+	index_file << index.str();
+	if (!index_file)
+	{
+		cerr << "Could not write " << IMAGE_ROOT << settings.out << ".txt" << endl;
+		return 1;
+	}
+
+	return 0;
+}
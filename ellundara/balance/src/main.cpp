@@ -0,0 +1,124 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include "../../ellundara/include/sim.h"
+
+using namespace std;
+
+
+// The settings for a balancing sweep.
+struct Sweep
+{
+	// The path to the map file.
+	string map = "res/maps/debug.txt";
+
+	// The number of battles to play.
+	int battles = 10000;
+
+	// The number of threads to play battles on.
+	int threads = 0;
+
+	// The number of units on each side.
+	int units = 4;
+
+	// The maximum number of phases to play before calling a battle a draw.
+	int max_turns = 200;
+
+	// The seed for the first battle. Each battle uses the next seed.
+	unsigned int seed = 1;
+};
+
+/// <summary>Lines up each faction's units on opposite sides of the map.</summary>
+/// <param name="sim">The simulation to add units to.</param>
+/// <param name="map">The map being fought on.</param>
+/// <param name="count">The number of units on each side.</param>
+void deploy(Sim::Simulation& sim, const Sim::Map& map, int count)
+{
+	for (int faction = 0; faction < 2; ++faction)
+	{
+		int placed = 0;
+		for (int k = 0; k < map.width * map.height && placed < count; ++k)
+		{
+			int x = k / map.height;
+			int y = k % map.height;
+			if (faction == 1)
+				x = map.width - 1 - x;
+
+			Sim::Unit unit = { x, y, faction, 20, 6, 2, 3, 1, 85, 0 };
+			if (sim.add_unit(unit) >= 0)
+				++placed;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Sweep sweep;
+	for (int k = 1; k + 1 < argc; k += 2)
+	{
+		string flag = argv[k];
+		if (flag == "--map")			sweep.map = argv[k + 1];
+		else if (flag == "--battles")	sweep.battles = atoi(argv[k + 1]);
+		else if (flag == "--threads")	sweep.threads = atoi(argv[k + 1]);
+		else if (flag == "--units")		sweep.units = atoi(argv[k + 1]);
+		else if (flag == "--turns")		sweep.max_turns = atoi(argv[k + 1]);
+		else if (flag == "--seed")		sweep.seed = (unsigned int)strtoul(argv[k + 1], nullptr, 10);
+		else
+		{
+			cerr << "Unknown option " << flag << endl;
+			return 1;
+		}
+	}
+
+	if (sweep.threads <= 0)
+		sweep.threads = max(1u, thread::hardware_concurrency());
+
+	// The map is only read from, so every thread can share it
+	Sim::Map map;
+	if (!map.load(sweep.map))
+	{
+		cerr << "Could not load map " << sweep.map << endl;
+		return 1;
+	}
+
+	atomic<int> next(0);
+	atomic<int> wins[2] = { 0, 0 };
+	atomic<int> draws(0);
+
+	auto start = chrono::steady_clock::now();
+
+	vector<thread> workers;
+	for (int t = 0; t < sweep.threads; ++t)
+	{
+		workers.emplace_back([&]()
+		{
+			int k;
+			while ((k = next++) < sweep.battles)
+			{
+				Sim::Simulation sim(map, sweep.seed + k);
+				deploy(sim, map, sweep.units);
+
+				int winner = sim.run(sweep.max_turns);
+				if (winner == 0 || winner == 1)
+					++wins[winner];
+				else
+					++draws;
+			}
+		});
+	}
+
+	for (thread& w : workers)
+		w.join();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << sweep.battles << " battles on " << sweep.threads << " threads in " << seconds << "s" << endl;
+	cout << (sweep.battles / seconds) << " battles per second" << endl;
+	cout << "Faction 0 wins: " << wins[0] << endl;
+	cout << "Faction 1 wins: " << wins[1] << endl;
+	cout << "Draws: " << draws << endl;
+
+	return 0;
+}
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+
+/*
+	Times the visible tile traversal that Visibility::build_chunk runs for each chunk, on the CPU only.
+
+	The traversal with the draw direction as template parameters is compared against the older version that read it
+	at runtime. Neither needs Onion, so the tiles and visible tiles below have the same layout as Battle::Tile and
+	Visibility::VisibleTile, with plain numbers in place of Onion's vectors.
+*/
+
+
+// The same sizes as battle.h.
+#define GRID_TILE_SIZE 128
+#define GRID_TILE_HEIGHT (GRID_TILE_SIZE * 9 / 32)
+#define GRID_CHUNK_SIZE 16
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+
+// The settings for a benchmark run.
+struct Bench
+{
+	// The width and height of the grid.
+	int size = 512;
+
+	// The number of times every chunk is rebuilt in each direction.
+	int rounds = 20;
+
+	// The chance out of 100 that a tile has an object on it.
+	int objects = 5;
+
+	// The seed for the heights and objects.
+	unsigned int seed = 1;
+};
+
+// A tile, laid out like Battle::Tile.
+struct Tile
+{
+	const void* type;
+	int height;
+	const void* obj;
+	const void* terrain;
+	unsigned int unit[2];
+};
+
+// A visible tile, laid out like Visibility::VisibleTile.
+struct VisibleTile
+{
+	const Tile* tile;
+	float pos[3];
+	int sides[2];
+	int coords[2];
+};
+
+// The visible tiles of one chunk, laid out like Visibility::Chunk.
+struct Chunk
+{
+	int min_height = 0, max_height = 0;
+	vector<VisibleTile> tiles;
+	vector<int> objects, terrain;
+};
+
+// A grid of tiles, stored one tile per cell like an expanded Battle::Grid.
+struct Grid
+{
+	int width = 0, height = 0;
+	vector<Tile> tiles;
+
+	const Tile* get_tile(int x, int y) const
+	{
+		if (x >= 0 && x < width && y >= 0 && y < height)
+			return tiles.data() + GRID_COORDINATE(x, y, width);
+		return nullptr;
+	}
+};
+
+
+/// <summary>Lists a chunk's tiles back to front, reading the draw direction at runtime. This is the traversal as it was before it was templated.</summary>
+/// <param name="grid">The grid.</param>
+/// <param name="chunk">The chunk to fill.</param>
+/// <param name="cx">The column of the chunk.</param>
+/// <param name="cy">The row of the chunk.</param>
+/// <param name="dx">The direction to draw columns of tiles in.</param>
+/// <param name="dy">The direction to draw rows of tiles in.</param>
+static void build_chunk_runtime(const Grid& grid, Chunk& chunk, int cx, int cy, int dx, int dy)
+{
+	chunk.tiles.clear();
+	chunk.objects.clear();
+	chunk.terrain.clear();
+	chunk.min_height = 0;
+	chunk.max_height = 0;
+
+	int x0 = cx * GRID_CHUNK_SIZE;
+	int y0 = cy * GRID_CHUNK_SIZE;
+	int x1 = min(x0 + GRID_CHUNK_SIZE, grid.width);
+	int y1 = min(y0 + GRID_CHUNK_SIZE, grid.height);
+
+	int istart = dx < 0 ? x1 - 1 : x0;
+	int iend = dx < 0 ? x0 - 1 : x1;
+	int jstart = dy < 0 ? y1 - 1 : y0;
+	int jend = dy < 0 ? y0 - 1 : y1;
+
+	for (int i = istart; i != iend; i += dx)
+	{
+		for (int j = jstart; j != jend; j += dy)
+		{
+			const Tile* tile = grid.get_tile(i, j);
+			if (!tile || !tile->type)
+				continue;
+
+			if (tile->height < chunk.min_height)		chunk.min_height = tile->height;
+			else if (tile->height > chunk.max_height)	chunk.max_height = tile->height;
+
+			const Tile* tx = grid.get_tile(i + dx, j);
+			const Tile* ty = grid.get_tile(i, j + dy);
+
+			if (tile->obj)		chunk.objects.push_back((int)chunk.tiles.size());
+			if (tile->terrain)	chunk.terrain.push_back((int)chunk.tiles.size());
+
+			chunk.tiles.push_back({
+				tile,
+				{ (float)(GRID_TILE_SIZE * i), (float)(GRID_TILE_SIZE * j), (float)(GRID_TILE_HEIGHT * tile->height) },
+				{ tile->height - (tx ? tx->height : 0), tile->height - (ty ? ty->height : 0) },
+				{ i, j }
+			});
+		}
+	}
+}
+
+/// <summary>Lists a chunk's tiles back to front, with the draw direction fixed at compile time, as Visibility::build_chunk does when zoomed in.</summary>
+/// <typeparam name="DX">The direction to draw columns of tiles in.</typeparam>
+/// <typeparam name="DY">The direction to draw rows of tiles in.</typeparam>
+/// <param name="grid">The grid.</param>
+/// <param name="chunk">The chunk to fill.</param>
+/// <param name="cx">The column of the chunk.</param>
+/// <param name="cy">The row of the chunk.</param>
+template <int DX, int DY>
+static void build_chunk(const Grid& grid, Chunk& chunk, int cx, int cy)
+{
+	chunk.tiles.clear();
+	chunk.objects.clear();
+	chunk.terrain.clear();
+	chunk.min_height = 0;
+	chunk.max_height = 0;
+
+	int x0 = cx * GRID_CHUNK_SIZE;
+	int y0 = cy * GRID_CHUNK_SIZE;
+	int x1 = min(x0 + GRID_CHUNK_SIZE, grid.width);
+	int y1 = min(y0 + GRID_CHUNK_SIZE, grid.height);
+
+	constexpr bool flip_x = DX < 0;
+	constexpr bool flip_y = DY < 0;
+
+	int istart = flip_x ? x1 - 1 : x0;
+	int iend = flip_x ? x0 - 1 : x1;
+	int jstart = flip_y ? y1 - 1 : y0;
+	int jend = flip_y ? y0 - 1 : y1;
+
+	for (int i = istart; i != iend; i += DX)
+	{
+		for (int j = jstart; j != jend; j += DY)
+		{
+			const Tile* tile = grid.get_tile(i, j);
+			if (!tile || !tile->type)
+				continue;
+
+			if (tile->height < chunk.min_height)		chunk.min_height = tile->height;
+			else if (tile->height > chunk.max_height)	chunk.max_height = tile->height;
+
+			const Tile* tx = grid.get_tile(i + DX, j);
+			const Tile* ty = grid.get_tile(i, j + DY);
+
+			if (tile->obj)		chunk.objects.push_back((int)chunk.tiles.size());
+			if (tile->terrain)	chunk.terrain.push_back((int)chunk.tiles.size());
+
+			chunk.tiles.push_back({
+				tile,
+				{ (float)(GRID_TILE_SIZE * i), (float)(GRID_TILE_SIZE * j), (float)(GRID_TILE_HEIGHT * tile->height) },
+				{ tile->height - (tx ? tx->height : 0), tile->height - (ty ? ty->height : 0) },
+				{ i, j }
+			});
+		}
+	}
+}
+
+/// <summary>Rebuilds every chunk for one draw direction with the templated traversal.</summary>
+/// <param name="grid">The grid.</param>
+/// <param name="chunks">The chunks, one per GRID_CHUNK_SIZE square.</param>
+/// <param name="columns">The number of columns of chunks.</param>
+/// <param name="direction">The draw direction, numbered the same as Visibility's.</param>
+static void build_templated(const Grid& grid, vector<Chunk>& chunks, int columns, int direction)
+{
+	for (int c = 0; c < (int)chunks.size(); ++c)
+	{
+		switch (direction)
+		{
+		case 0:	build_chunk<1, 1>(grid, chunks[c], c % columns, c / columns);	break;
+		case 1:	build_chunk<1, -1>(grid, chunks[c], c % columns, c / columns);	break;
+		case 2:	build_chunk<-1, 1>(grid, chunks[c], c % columns, c / columns);	break;
+		case 3:	build_chunk<-1, -1>(grid, chunks[c], c % columns, c / columns);	break;
+		}
+	}
+}
+
+/// <summary>Rebuilds every chunk for one draw direction with the runtime traversal.</summary>
+/// <param name="grid">The grid.</param>
+/// <param name="chunks">The chunks, one per GRID_CHUNK_SIZE square.</param>
+/// <param name="columns">The number of columns of chunks.</param>
+/// <param name="direction">The draw direction, numbered the same as Visibility's.</param>
+static void build_runtime(const Grid& grid, vector<Chunk>& chunks, int columns, int direction)
+{
+	int dx = direction >= 2 ? -1 : 1;
+	int dy = direction % 2 ? -1 : 1;
+	for (int c = 0; c < (int)chunks.size(); ++c)
+		build_chunk_runtime(grid, chunks[c], c % columns, c / columns, dx, dy);
+}
+
+/// <summary>Adds up the visible tiles of every chunk, so that the two traversals can be checked against each other.</summary>
+/// <param name="chunks">The chunks.</param>
+/// <returns>A checksum of the tiles' order, sides, and lists of objects.</returns>
+static unsigned long long checksum(const vector<Chunk>& chunks)
+{
+	unsigned long long sum = 0;
+	for (const Chunk& chunk : chunks)
+	{
+		for (const VisibleTile& vtile : chunk.tiles)
+			sum = (sum * 31) + (unsigned long long)((vtile.coords[0] * 7919) + vtile.coords[1] + (vtile.sides[0] * 13) + vtile.sides[1]);
+		sum += chunk.objects.size() + (unsigned long long)chunk.max_height;
+	}
+	return sum;
+}
+
+int main(int argc, char** argv)
+{
+	Bench bench;
+	for (int k = 1; k + 1 < argc; k += 2)
+	{
+		string flag = argv[k];
+		if (flag == "--size")			bench.size = atoi(argv[k + 1]);
+		else if (flag == "--rounds")	bench.rounds = atoi(argv[k + 1]);
+		else if (flag == "--objects")	bench.objects = atoi(argv[k + 1]);
+		else if (flag == "--seed")		bench.seed = (unsigned int)strtoul(argv[k + 1], nullptr, 10);
+		else
+		{
+			cerr << "Unknown option " << flag << endl;
+			return 1;
+		}
+	}
+
+	if (bench.size <= 0 || bench.rounds <= 0)
+	{
+		cerr << "The size and number of rounds must be positive" << endl;
+		return 1;
+	}
+
+	// Rolling heights with a few objects, so that the side faces and object lists both have work to do
+	static const int type = 0;
+	static const int object = 0;
+	mt19937 random(bench.seed);
+
+	Grid grid;
+	grid.width = bench.size;
+	grid.height = bench.size;
+	grid.tiles.resize(grid.width * grid.height);
+	for (int j = 0; j < grid.height; ++j)
+	{
+		for (int i = 0; i < grid.width; ++i)
+		{
+			Tile& tile = grid.tiles[GRID_COORDINATE(i, j, grid.width)];
+			tile = { &type, (int)uniform_int_distribution<int>(0, 8)(random), nullptr, nullptr, { UINT32_MAX, 0 } };
+			if (uniform_int_distribution<int>(0, 99)(random) < bench.objects)
+				tile.obj = &object;
+		}
+	}
+
+	int columns = (grid.width + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+	int rows = (grid.height + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+	vector<Chunk> chunks(columns * rows);
+
+	// Both traversals have to list the same tiles in the same order for the timings to mean anything
+	for (int direction = 0; direction < 4; ++direction)
+	{
+		build_runtime(grid, chunks, columns, direction);
+		unsigned long long expected = checksum(chunks);
+		build_templated(grid, chunks, columns, direction);
+		if (checksum(chunks) != expected)
+		{
+			cerr << "The traversals disagree in direction " << direction << endl;
+			return 1;
+		}
+	}
+
+	// Time each version over every direction, with the chunks' lists already allocated as they are between frames
+	auto time = [&](void (*build)(const Grid&, vector<Chunk>&, int, int)) {
+		auto start = chrono::steady_clock::now();
+		for (int r = 0; r < bench.rounds; ++r)
+			for (int direction = 0; direction < 4; ++direction)
+				build(grid, chunks, columns, direction);
+		return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / (bench.rounds * 4);
+	};
+
+	double runtime = time(build_runtime);
+	double templated = time(build_templated);
+
+	cout << grid.width << "x" << grid.height << " grid, " << chunks.size() << " chunks, " << bench.rounds << " rounds per direction" << endl;
+	cout << "Runtime direction:   " << runtime << " ms per rebuild" << endl;
+	cout << "Template direction:  " << templated << " ms per rebuild" << endl;
+	cout << "Speedup: " << (runtime / templated) << "x" << endl;
+
+	return 0;
+}
@@ -1,10 +1,26 @@
 #pragma once
 #include <unordered_set>
+#include <map>
+#include <deque>
+#include <array>
+#include <span>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
+#include <cstdint>
 #include <onions/matrix.h>
 #include "state.h"
+#include "bitboard.h"
+#include "script.h"
+#include "sim.h"
 
 #define GRID_TILE_SIZE 128
 #define GRID_TILE_HEIGHT (GRID_TILE_SIZE * 9 / 32)
+#define GRID_CHUNK_SIZE 16
 
 
 namespace Battle
@@ -13,6 +29,54 @@ namespace Battle
 	class Highlight;
 
 
+	// Shares sprite sheets and palettes between everything that draws them, so that each is only generated once.
+	class ResourceCache
+	{
+	protected:
+		// A map from a path to the sprite sheet loaded from it.
+		static std::unordered_map<std::string, SpriteSheet*> m_SpriteSheets;
+
+		// A map from the path of a packed sprite sheet to the atlas page its sprites were packed onto.
+		static std::unordered_map<std::string, std::string> m_Atlases;
+
+		// Whether the atlas index has been read.
+		static bool m_AtlasesLoaded;
+
+		/// <summary>Reads the atlas index written by the atlas tool, if it hasn't been read already.</summary>
+		static void load_atlases();
+
+		// A map from the red, green, and blue channels of a palette to the palette.
+		static std::map<std::array<float, 12>, Palette*> m_Palettes;
+
+	public:
+		/// <summary>Retrieves a sprite sheet, generating it the first time it is requested. Sheets packed by the atlas tool are loaded from their atlas page instead.</summary>
+		/// <param name="path">The path to the sprite sheet.</param>
+		/// <returns>The shared sprite sheet.</returns>
+		static SpriteSheet* get_sprite_sheet(std::string path);
+
+		/// <summary>Retrieves the path that a sprite sheet is actually loaded from.</summary>
+		/// <param name="path">The path to the sprite sheet.</param>
+		/// <returns>The path to the atlas page the sheet was packed onto, or the path itself if it wasn't packed.</returns>
+		static std::string get_sheet_path(std::string path);
+
+		/// <summary>Generates a sprite sheet again after its files have changed. If it was packed into an atlas, its atlas page is generated again instead.</summary>
+		/// <param name="path">The path to the sprite sheet.</param>
+		/// <returns>The new sprite sheet. The old one is deleted, so everything drawn from it has to fetch the new one before it is drawn again.</returns>
+		static SpriteSheet* reload_sprite_sheet(std::string path);
+
+		/// <summary>Retrieves a single palette, creating it the first time a palette with the same channels is requested.</summary>
+		/// <param name="red">What the red channel maps to.</param>
+		/// <param name="green">What the green channel maps to.</param>
+		/// <param name="blue">What the blue channel maps to.</param>
+		/// <returns>The shared palette.</returns>
+		static Palette* get_palette(const vec4f& red, const vec4f& green, const vec4f& blue);
+
+		/// <summary>Retrieves the palette that leaves colors unchanged.</summary>
+		/// <returns>The shared palette.</returns>
+		static Palette* get_default_palette();
+	};
+
+
 	struct TileType
 	{
 		// The sprite for the top of the tile.
@@ -22,29 +86,98 @@ namespace Battle
 		Sprite* side;
 	};
 
+	// A sprite listed in a tile set's meta file.
+	struct TileSprite
+	{
+		// The ID of the type of tile the sprite belongs to.
+		std::string type;
+
+		// The name of the sprite.
+		std::string sprite;
+
+		// True if the sprite is for the top of the tile, false if it is for the side.
+		bool top;
+	};
+
 	class TileSet
 	{
 	private:
 		static std::unordered_map<std::string, TileSet*> m_Sets;
 
-		// The sprite sheet.
+		// Guards the loaded tile sets, which a loader may add to on a worker thread.
+		static std::mutex m_SetsMutex;
+
+		// The ID of the tile set.
+		std::string m_ID;
+
+		// The sprite sheet, or nullptr until the graphics are loaded.
 		SpriteSheet* m_SpriteSheet;
 
+		// The sprites read from the meta file, which are looked up when the graphics are loaded.
+		std::vector<TileSprite> m_Sprites;
+
 		std::unordered_map<std::string, TileType*> m_Types;
 
-		TileSet(std::string id);
+		/// <summary>Creates the types of the tile set without their sprites, so that it can be built off the render thread.</summary>
+		TileSet(std::string id, const std::vector<TileSprite>& sprites);
+
+		/// <summary>Looks up the sprites of each type. Types that already exist are updated in place.</summary>
+		/// <param name="sprites">The sprites read from the tile set's meta file.</param>
+		void load_types(const std::vector<TileSprite>& sprites);
 
 	public:
 		static TileSet* get_tile_set(std::string id);
 
+		/// <summary>Retrieves a tile set, using sprites that were already read from its meta file if it hasn't been loaded.</summary>
+		/// <param name="id">The ID of the tile set.</param>
+		/// <param name="sprites">The sprites read by read_sprites.</param>
+		/// <returns>The tile set.</returns>
+		static TileSet* get_tile_set(std::string id, const std::vector<TileSprite>& sprites);
+
+		/// <summary>Reads the sprites listed in a tile set's meta file. Only reads the file, so it can run off the render thread.</summary>
+		/// <param name="id">The ID of the tile set.</param>
+		/// <returns>The sprites for the top and side of each type.</returns>
+		static std::vector<TileSprite> read_sprites(std::string id);
+
+		/// <summary>Generates a loaded tile set's sprite sheet again and reads its meta file again, so that tiles pick up the new sprites without being rebuilt.</summary>
+		/// <param name="id">The ID of the tile set.</param>
+		/// <returns>False if the tile set hasn't been loaded, true otherwise.</returns>
+		static bool reload_tile_set(std::string id);
+
+		/// <summary>Generates the sprite sheet and looks up the sprites of each type, if that hasn't been done yet. Must run on the render thread.</summary>
+		void load_graphics();
+
+		const std::string& get_id() const;
+
 		SpriteSheet* get_sprite_sheet();
 
 		const TileType* get_tile_type(std::string type) const;
+
+		/// <summary>Retrieves every type of tile in the set.</summary>
+		/// <returns>A map from the ID of each type to the type.</returns>
+		const std::unordered_map<std::string, TileType*>& get_tile_types() const;
 	};
 
 
 	class Object;
 	class Terrain;
+	class Snapshot;
+
+	// A handle to a unit in a UnitStore. Stays valid while the unit exists, even as other units are added and removed.
+	struct Entity
+	{
+		// The index of the unit's handle slot.
+		uint32_t index = UINT32_MAX;
+
+		// Which use of the handle slot this is. Goes up each time a unit in the slot is destroyed.
+		uint32_t generation = 0;
+
+		/// <summary>Checks whether the handle refers to no unit.</summary>
+		/// <returns>True if the handle is null.</returns>
+		bool is_null() const { return index == UINT32_MAX; }
+
+		bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+	};
 
 	struct Tile
 	{
@@ -59,6 +192,32 @@ namespace Battle
 
 		// If the tile has any special terrain.
 		Terrain* terrain;
+
+		// The unit standing on the tile, if any.
+		Entity unit;
+	};
+
+	// A rectangle of tiles with the same type and height, as written in the map file.
+	struct TileRegion
+	{
+		// The position of the corner of the rectangle.
+		int x, y;
+
+		// The size of the rectangle.
+		int width, height;
+
+		// The tile that every cell of the rectangle shares, until a cell is changed.
+		Tile tile;
+	};
+
+	// A run of cells in a row that belong to one rectangle.
+	struct RegionRun
+	{
+		// The first cell of the run, and the cell after the last.
+		int x0, x1;
+
+		// The index of the rectangle.
+		int region;
 	};
 
 	class Grid
@@ -67,9 +226,61 @@ namespace Battle
 		// The tile set used for the grid.
 		TileSet* m_TileSet;
 
-		// The array of tiles.
+		// The array of tiles, or nullptr if the grid is stored as rectangles.
 		Tile* m_Tiles;
 
+		// The rectangles of tiles, in the order they were loaded. Later rectangles cover earlier ones.
+		std::vector<TileRegion> m_Regions;
+
+		// For each row, the runs of cells that each rectangle covers, sorted by x, when the grid is stored as rectangles.
+		std::vector<std::vector<RegionRun>> m_RowRuns;
+
+		// The cells that have been changed or given an object, when the grid is stored as rectangles.
+		std::unordered_map<int, Tile> m_Overrides;
+
+		// The tile at cells that no rectangle covers.
+		Tile m_Gap{ nullptr, 0, nullptr, nullptr, Entity() };
+
+		// The tiles that have an object on them.
+		Bitboard m_Occupied;
+
+		// The tiles that can be walked on.
+		Bitboard m_Passable;
+
+		// The number of times the tiles in each chunk have changed type or height.
+		std::vector<unsigned int> m_ChunkVersions;
+
+		// The number of times any tile has changed type or height.
+		unsigned int m_Version;
+
+		/// <summary>Rebuilds the bitboards and chunk versions from every tile.</summary>
+		void reset_bitboards();
+
+		/// <summary>Builds the runs of each row from the rectangles, cutting earlier rectangles where later ones cover them.</summary>
+		void build_row_runs();
+
+		/// <summary>Updates the bitboards for a tile.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		void refresh_bitboards(int x, int y);
+
+		/// <summary>Swaps in the rectangles of a grid loaded from the same map again, comparing only the cells of rectangles that changed.</summary>
+		/// <param name="fresh">The grid loaded again.</param>
+		/// <returns>The number of tiles changed.</returns>
+		int reload_regions(const Grid& fresh);
+
+		/// <summary>Stores a tile without updating the bitboards. A cell stored as rectangles only keeps its own copy while it differs from its rectangle.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <param name="tile">The new tile.</param>
+		/// <returns>True if the tile changed.</returns>
+		bool write_tile(int x, int y, const Tile& tile);
+
+		/// <summary>Marks the chunks that draw a tile as changed. Includes neighboring chunks, whose sides depend on the tile's height.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		void touch_chunks(int x, int y);
+
 	public:
 		// The width of the grid.
 		int width;
@@ -81,11 +292,22 @@ namespace Battle
 		/// <param name="map">The ID of the battle map.</param>
 		Grid(std::string map);
 
-		/// <summary>Retrieves the grid tile at the given coordinates.</summary>
-		/// <param name="x">The x-coordinate of the grid tile.</param>
-		/// <param name="y">The y-coordinate of the grid tile.</param>
-		/// <returns>A pointer to the tile.</returns>
-		Tile* get_tile(int x, int y);
+		/// <summary>Builds the battle grid from a map that has already been read. Doesn't load any graphics, so it can run off the render thread.</summary>
+		/// <param name="map">The map.</param>
+		Grid(const Sim::Map& map);
+
+		/// <summary>Rebuilds the battle grid from a snapshot.</summary>
+		/// <param name="snapshot">The snapshot of the grid.</param>
+		Grid(const Snapshot& snapshot);
+
+		Grid(const Grid&) = delete;
+
+		~Grid();
+
+		/// <summary>Reads the map file again and applies only the tiles whose type, height or object changed. Units stay where they are. On a grid stored as rectangles, only the cells of rectangles that changed are compared.</summary>
+		/// <param name="map">The ID of the battle map.</param>
+		/// <returns>The number of tiles changed, or -1 if the map changed size and has to be loaded from scratch.</returns>
+		int reload(std::string map);
 
 		/// <summary>Retrieves the grid tile at the given coordinates.</summary>
 		/// <param name="x">The x-coordinate of the grid tile.</param>
@@ -93,7 +315,409 @@ namespace Battle
 		/// <returns>A const pointer to the tile.</returns>
 		const Tile* get_tile(int x, int y) const;
 
+		/// <summary>Loads the graphics of the tile set and the objects, which building the grid leaves out. Must run on the render thread.</summary>
+		void load_graphics();
+
 		const SpriteSheet* get_tile_sprite_sheet() const;
+
+		const TileSet* get_tile_set() const;
+
+		/// <summary>Checks whether the grid is stored as rectangles instead of one tile per cell.</summary>
+		/// <returns>True if the grid is stored as rectangles.</returns>
+		bool is_compressed() const;
+
+		/// <summary>Retrieves the rectangles the grid was loaded from, so that whole rectangles can be culled or drawn at once.</summary>
+		/// <returns>The rectangles, in the order they were loaded. Cells changed since may no longer match.</returns>
+		const std::vector<TileRegion>& get_regions() const;
+
+		/// <summary>Retrieves the runs of cells that each rectangle covers in a row, with overlaps already resolved.</summary>
+		/// <param name="y">The row.</param>
+		/// <returns>The runs, sorted by x. Empty if the grid isn't stored as rectangles.</returns>
+		const std::vector<RegionRun>& get_row_runs(int y) const;
+
+		/// <summary>Retrieves the tile that a cell's rectangle gives it, ignoring any change made to the cell since.</summary>
+		/// <param name="x">The x-coordinate of the cell.</param>
+		/// <param name="y">The y-coordinate of the cell.</param>
+		/// <returns>The rectangle's tile, or an empty tile if no rectangle covers the cell. Only valid if the grid is stored as rectangles.</returns>
+		const Tile* get_region_tile(int x, int y) const;
+
+		/// <summary>Retrieves the cells that no longer match their rectangle.</summary>
+		/// <returns>A map from the coordinate of each changed cell to its tile. Empty if the grid isn't stored as rectangles.</returns>
+		const std::unordered_map<int, Tile>& get_overrides() const;
+
+		/// <summary>Changes the type of a tile.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <param name="type">The new type of the tile, or nullptr to remove the tile.</param>
+		void set_tile_type(int x, int y, const TileType* type);
+
+		/// <summary>Changes the height of a tile.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <param name="h">The new height of the tile.</param>
+		void set_tile_height(int x, int y, int h);
+
+		/// <summary>Changes the object on a tile.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <param name="obj">The object to put on the tile, or nullptr to clear it.</param>
+		void set_tile_object(int x, int y, Object* obj);
+
+		/// <summary>Changes the unit standing on a tile.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <param name="unit">The unit, or a null entity to clear it.</param>
+		void set_tile_unit(int x, int y, Entity unit);
+
+		/// <summary>Replaces everything about a tile at once.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <param name="tile">The new tile.</param>
+		void set_tile(int x, int y, const Tile& tile);
+
+		/// <summary>Retrieves the tiles that have an object on them.</summary>
+		/// <returns>A bitboard of the occupied tiles.</returns>
+		const Bitboard& get_occupied() const;
+
+		/// <summary>Retrieves the tiles that can be walked on.</summary>
+		/// <returns>A bitboard of the passable tiles.</returns>
+		const Bitboard& get_passable() const;
+
+		/// <summary>Retrieves the number of columns of render chunks.</summary>
+		/// <returns>The number of chunks across the width of the grid.</returns>
+		int get_chunk_columns() const;
+
+		/// <summary>Retrieves the number of rows of render chunks.</summary>
+		/// <returns>The number of chunks across the height of the grid.</returns>
+		int get_chunk_rows() const;
+
+		/// <summary>Retrieves how many times the tiles in a chunk have changed.</summary>
+		/// <param name="cx">The column of the chunk.</param>
+		/// <param name="cy">The row of the chunk.</param>
+		/// <returns>A counter that changes whenever a tile drawn by the chunk changes type or height.</returns>
+		unsigned int get_chunk_version(int cx, int cy) const;
+
+		/// <summary>Retrieves how many times any tile has changed.</summary>
+		/// <returns>A counter that changes whenever any tile changes type or height.</returns>
+		unsigned int get_version() const;
+	};
+
+	class GridFork
+	{
+	protected:
+		// The grid at the root of the fork.
+		Grid* m_Grid;
+
+		// The fork that this fork was made from, or nullptr if it was made directly from the grid.
+		GridFork* m_Parent;
+
+		// The tiles that have been changed in this fork, keyed by their index in the grid.
+		std::unordered_map<int, Tile> m_Overlay;
+
+	public:
+		// The width of the grid.
+		const int width;
+
+		// The height of the grid.
+		const int height;
+
+		/// <summary>Forks a grid. Changes to the fork don't affect the grid until they are committed.</summary>
+		/// <param name="grid">The grid to fork.</param>
+		GridFork(Grid* grid);
+
+		/// <summary>Forks another fork, for looking further ahead.</summary>
+		/// <param name="parent">The fork to fork. It must outlive this fork.</param>
+		GridFork(GridFork* parent);
+
+		/// <summary>Retrieves the tile at the given coordinates, as seen from this fork.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <returns>A const pointer to the tile, or nullptr if the coordinates are out of bounds.</returns>
+		const Tile* get_tile(int x, int y) const;
+
+		/// <summary>Retrieves the tile at the given coordinates so that it can be changed, copying it into the fork.</summary>
+		/// <param name="x">The x-coordinate of the grid tile.</param>
+		/// <param name="y">The y-coordinate of the grid tile.</param>
+		/// <returns>A pointer to the fork's copy of the tile, or nullptr if the coordinates are out of bounds.</returns>
+		Tile* edit_tile(int x, int y);
+
+		/// <summary>Moves the object on one tile to another.</summary>
+		/// <param name="x1">The x-coordinate of the tile the object is on.</param>
+		/// <param name="y1">The y-coordinate of the tile the object is on.</param>
+		/// <param name="x2">The x-coordinate of the tile to move the object to.</param>
+		/// <param name="y2">The y-coordinate of the tile to move the object to.</param>
+		/// <returns>False if either tile is out of bounds or the destination is occupied, true otherwise.</returns>
+		bool move_object(int x1, int y1, int x2, int y2);
+
+		/// <summary>Retrieves the number of tiles that have been changed in this fork.</summary>
+		/// <returns>The number of changed tiles.</returns>
+		int get_change_count() const;
+
+		/// <summary>Applies the changes to the parent fork or grid, and clears them from this fork.</summary>
+		void commit();
+
+		/// <summary>Discards the changes made in this fork.</summary>
+		void rollback();
+	};
+
+
+
+
+
+	/*
+		FOG OF WAR
+	*/
+
+	class Fog
+	{
+	protected:
+		// Something that reveals the tiles around it, such as a unit.
+		struct Viewer
+		{
+			// The faction that the viewer reveals tiles for, or -1 if the viewer has been removed.
+			int faction;
+
+			// The position of the viewer.
+			int x, y;
+
+			// How many tiles away the viewer can see.
+			int range;
+
+			// How far above its tile the viewer sees from.
+			int eye;
+
+			// The lower corner of the box of tiles that the viewer could see.
+			int x0, y0;
+
+			// The size of the box of tiles that the viewer could see.
+			int w, h;
+
+			// Which tiles in the box the viewer can see, packed into bits row by row.
+			std::vector<uint64_t> bits;
+
+			// Whether a tile in the box has changed height since the viewer was last evaluated.
+			bool dirty;
+		};
+
+		// The grid that the fog covers.
+		const Grid* m_Grid;
+
+		// The number of words in each bitset over the grid.
+		int m_Words;
+
+		// The viewers, indexed by their handles.
+		std::vector<Viewer> m_Viewers;
+
+		// For each faction, how many of its viewers can see each tile.
+		std::vector<std::vector<uint16_t>> m_Counts;
+
+		// For each faction, which tiles can be seen, packed into bits.
+		std::vector<std::vector<uint64_t>> m_Visible;
+
+		// The grid's version of each chunk when the viewers were last checked against it.
+		std::vector<unsigned int> m_ChunkVersions;
+
+
+		/// <summary>Checks whether a tile can be seen from a point, or if it is hidden behind taller tiles.</summary>
+		/// <param name="x1">The x-coordinate of the viewer.</param>
+		/// <param name="y1">The y-coordinate of the viewer.</param>
+		/// <param name="eye">The height that the viewer sees from.</param>
+		/// <param name="x2">The x-coordinate of the tile.</param>
+		/// <param name="y2">The y-coordinate of the tile.</param>
+		/// <returns>True if nothing blocks the line of sight.</returns>
+		bool line_of_sight(int x1, int y1, int eye, int x2, int y2) const;
+
+		/// <summary>Adds or removes a viewer's cached tiles from its faction's visibility.</summary>
+		/// <param name="viewer">The viewer.</param>
+		/// <param name="add">True to add the tiles, false to remove them.</param>
+		void apply(const Viewer& viewer, bool add);
+
+		/// <summary>Recalculates which tiles a viewer can see, and updates its faction's visibility.</summary>
+		/// <param name="viewer">The viewer.</param>
+		void evaluate(Viewer& viewer);
+
+	public:
+		/// <summary>Constructs fog over a grid, with nothing visible.</summary>
+		/// <param name="grid">The grid that the fog covers.</param>
+		/// <param name="factions">The number of factions.</param>
+		Fog(const Grid* grid, int factions);
+
+		/// <summary>Adds a viewer, revealing the tiles around it.</summary>
+		/// <param name="faction">The faction that the viewer reveals tiles for.</param>
+		/// <param name="x">The x-coordinate of the viewer.</param>
+		/// <param name="y">The y-coordinate of the viewer.</param>
+		/// <param name="range">How many tiles away the viewer can see.</param>
+		/// <param name="eye">How far above its tile the viewer sees from.</param>
+		/// <returns>A handle to the viewer.</returns>
+		int add_viewer(int faction, int x, int y, int range, int eye = 1);
+
+		/// <summary>Moves a viewer, re-evaluating only the tiles that it sees.</summary>
+		/// <param name="viewer">The handle to the viewer.</param>
+		/// <param name="x">The new x-coordinate of the viewer.</param>
+		/// <param name="y">The new y-coordinate of the viewer.</param>
+		void move_viewer(int viewer, int x, int y);
+
+		/// <summary>Removes a viewer, hiding any tiles that only it could see.</summary>
+		/// <param name="viewer">The handle to the viewer.</param>
+		void remove_viewer(int viewer);
+
+		/// <summary>Re-evaluates the viewers that could be affected by a tile changing height.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		void update_tile(int x, int y);
+
+		/// <summary>Re-evaluates the viewers whose sight may have changed because tiles near them changed height. Call once per frame.</summary>
+		void update();
+
+		/// <summary>Checks whether a faction can see a tile.</summary>
+		/// <param name="faction">The faction.</param>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <returns>True if any of the faction's viewers can see the tile.</returns>
+		bool is_visible(int faction, int x, int y) const;
+
+		/// <summary>Retrieves the tiles that a faction can see.</summary>
+		/// <param name="faction">The faction.</param>
+		/// <returns>A bitset over the grid, with bit (x + width * y) set if the tile is visible.</returns>
+		const std::vector<uint64_t>& get_visible(int faction) const;
+	};
+
+
+
+
+
+	/*
+		THREAT
+	*/
+
+	class ThreatMap
+	{
+	protected:
+		// An enemy that threatens the tiles around it.
+		struct Threat
+		{
+			// Whether the enemy is still on the map.
+			bool active;
+
+			// Whether the tiles that the enemy threatens need to be recalculated.
+			bool dirty;
+
+			// The position of the enemy.
+			int x, y;
+
+			// The number of tiles the enemy can move.
+			int move;
+
+			// The largest height difference the enemy can climb in one step.
+			int climb;
+
+			// How many tiles away the enemy can attack from where it stands.
+			int range;
+
+			// The tiles the enemy threatened when it was last calculated.
+			Bitboard area;
+
+			// The tiles the enemy threatens now, calculated before they are swapped with the old ones.
+			Bitboard next;
+		};
+
+		// Space that one thread reuses for every enemy it calculates, so that updates don't allocate.
+		struct Scratch
+		{
+			// The steps to each tile in the box around the enemy, and the tiles still to be searched.
+			std::vector<int> distance, frontier;
+
+			// Space for growing the reachable tiles by the attack range.
+			Bitboard grow;
+		};
+
+		// The grid that the enemies are on.
+		const Grid* m_Grid;
+
+		// The enemies, indexed by their handles.
+		std::vector<Threat> m_Threats;
+
+		// How many enemies threaten each tile.
+		std::vector<uint16_t> m_Counts;
+
+		// The handles of the enemies being recalculated in this update.
+		std::vector<int> m_Dirty;
+
+		// The next entry of m_Dirty for a thread to take.
+		std::atomic<int> m_Next;
+
+		// The threads kept between updates, so that each update doesn't start new ones.
+		std::vector<std::thread> m_Workers;
+
+		// The scratch space of each worker, followed by the updating thread's.
+		std::vector<Scratch> m_Scratch;
+
+		// Wakes the workers for a batch, and tells the updating thread when they have finished it.
+		std::mutex m_WorkMutex;
+		std::condition_variable m_WorkReady, m_WorkDone;
+
+		// The number of batches started, the number of workers still working on the current one, and whether the workers should exit.
+		unsigned int m_Batch;
+		int m_Busy;
+		bool m_Stopping;
+
+		/// <summary>Calculates the tiles an enemy threatens: everywhere it can move, expanded by its attack range.</summary>
+		/// <param name="threat">The enemy. Its next tiles are set to the result.</param>
+		/// <param name="scratch">The calling thread's scratch space.</param>
+		void compute(Threat& threat, Scratch& scratch) const;
+
+		/// <summary>Calculates enemies from the current batch until none are left.</summary>
+		/// <param name="scratch">The calling thread's scratch space.</param>
+		void run_batch(Scratch& scratch);
+
+		/// <summary>Waits for batches and runs them, until the threat map is destroyed.</summary>
+		/// <param name="worker">The index of the worker.</param>
+		void work(int worker);
+
+		/// <summary>Adds or removes an enemy's threatened tiles from the counts.</summary>
+		/// <param name="area">The threatened tiles.</param>
+		/// <param name="delta">1 to add the tiles, -1 to remove them.</param>
+		void apply(const Bitboard& area, int delta);
+
+	public:
+		/// <summary>Constructs an empty threat map over a grid.</summary>
+		/// <param name="grid">The grid that the enemies are on.</param>
+		ThreatMap(const Grid* grid);
+
+		ThreatMap(const ThreatMap&) = delete;
+
+		~ThreatMap();
+
+		/// <summary>Adds an enemy. Its threat is calculated on the next update.</summary>
+		/// <param name="x">The x-coordinate of the enemy.</param>
+		/// <param name="y">The y-coordinate of the enemy.</param>
+		/// <param name="move">The number of tiles the enemy can move.</param>
+		/// <param name="climb">The largest height difference the enemy can climb in one step.</param>
+		/// <param name="range">How many tiles away the enemy can attack.</param>
+		/// <returns>A handle to the enemy.</returns>
+		int add_threat(int x, int y, int move, int climb, int range);
+
+		/// <summary>Moves an enemy. Only its threat is recalculated on the next update.</summary>
+		/// <param name="threat">The handle to the enemy.</param>
+		/// <param name="x">The new x-coordinate of the enemy.</param>
+		/// <param name="y">The new y-coordinate of the enemy.</param>
+		void move_threat(int threat, int x, int y);
+
+		/// <summary>Removes an enemy and its threat.</summary>
+		/// <param name="threat">The handle to the enemy.</param>
+		void remove_threat(int threat);
+
+		/// <summary>Marks every enemy for recalculation, e.g. after tile heights or occupancy change.</summary>
+		void invalidate();
+
+		/// <summary>Recalculates the threat of every enemy that has changed, in parallel across cores.</summary>
+		void update();
+
+		/// <summary>Retrieves how many enemies threaten a tile.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <returns>The number of enemies that could attack the tile next turn.</returns>
+		int get_threat(int x, int y) const;
 	};
 
 
@@ -118,12 +742,28 @@ namespace Battle
 		const mat2x2i& m_Bounds;
 
 		// A pointer to the grid.
-		Grid* m_Grid;
+		const Grid* m_Grid;
 
 
 		// The transform matrix for the grid.
 		mat4x4f m_Transform;
 
+		// The inverse of the transform, used to cast rays from the screen back into the grid.
+		struct Picker
+		{
+			// The cosine and sine of the view angle.
+			float cos, sin;
+
+			// The reciprocal of the zoom factor.
+			float inv_zoom;
+
+			// The screen position of the world origin.
+			float tx, ty;
+		} m_Picker;
+
+		// The lowest and highest tile heights on the grid.
+		int m_MinHeight, m_MaxHeight;
+
 
 		// The current angle that the grid is being viewed from. Uses radians.
 		static float m_Angle;
@@ -150,17 +790,103 @@ namespace Battle
 		struct VisibleTile
 		{
 			// The information of the tile.
-			Tile* tile;
+			const Tile* tile;
 
-			// The x, y, z translation from the previous tile.
-			vec3f trans;
+			// The x, y, z position of the tile.
+			vec3f pos;
 
 			// The heights to draw the horizontal and vertical sides.
 			vec2i sides;
+
+			// The x and y coordinates of the tile.
+			vec2i coords;
 		};
 
-		// An array of the visible tiles, in the order that they need to be displayed.
-		std::vector<VisibleTile> m_VisibleTiles;
+		// The kinds of things drawn over the tiles. Things at the same depth are drawn in this order.
+		enum DrawKind
+		{
+			DRAW_TERRAIN,
+			DRAW_OBJECT
+		};
+
+		// Something drawn over the tiles, sorted by its depth each frame.
+		struct DrawItem
+		{
+			// The depth from the camera, as bits that sort back to front as an unsigned integer, with the kind in the lowest bits.
+			uint32_t key;
+
+			// The visible tile that it is drawn on.
+			const VisibleTile* tile;
+		};
+
+		// The things to draw over the tiles this frame, and space to sort them in. Both are kept between frames so that sorting doesn't allocate.
+		mutable std::vector<DrawItem> m_DrawItems, m_DrawScratch;
+
+		// The visible tiles in a square of GRID_CHUNK_SIZE x GRID_CHUNK_SIZE tiles, kept until a tile in it changes.
+		struct Chunk
+		{
+			// Whether the chunk has been built.
+			bool built = false;
+
+			// Whether every tile is listed. When zoomed out, only the tiles with something drawn over them are.
+			bool full = false;
+
+			// The grid's version of the chunk when it was built.
+			unsigned int version = 0;
+
+			// The lowest and highest tile heights in the chunk.
+			int min_height = 0, max_height = 0;
+
+			// The tiles in the chunk, in the order they need to be displayed.
+			std::vector<VisibleTile> tiles;
+
+			// The indices of the tiles that have an object, and of the tiles that have terrain.
+			std::vector<int> objects, terrain;
+		};
+
+		// The chunks for each of the four directions that tiles can be drawn in.
+		std::vector<Chunk> m_Chunks[4];
+
+		// The chunks of the current direction, in the order they need to be displayed.
+		std::vector<int> m_ChunkOrder;
+
+		// The direction that the visible tiles were built for, as an index into m_Chunks.
+		int m_Direction;
+
+		// Whether the visible tiles have been built, and the grid version they were built for.
+		bool m_Built;
+		unsigned int m_BuiltVersion;
+
+
+		// A square block of tiles, drawn as a single tile when zoomed out.
+		struct LodBlock
+		{
+			// The type of tile to draw the block as.
+			const TileType* type;
+
+			// The absolute position of the block, using the average height of its tiles.
+			vec3f pos;
+
+			// The number of tiles the block covers along x and y. Blocks on the far edges of the grid are cut short.
+			vec2i size;
+
+			// How far the block rises above the neighboring blocks drawn before it, in tile heights.
+			vec2f sides;
+		};
+
+		// The number of tiles along each side of a block. 1 if tiles are drawn individually.
+		int m_Lod;
+
+		// The blocks to draw when zoomed out, in the order that they need to be displayed.
+		std::vector<LodBlock> m_LodBlocks;
+
+		// The average height of each block, by block column and row, so that what stands on a tile can be drawn on its block.
+		std::vector<float> m_LodHeights;
+		int m_LodColumns;
+
+		// The block size, draw direction, and grid version that the blocks were built for.
+		int m_LodBuiltSize, m_LodBuiltDirection;
+		unsigned int m_LodBuiltVersion;
 
 
 		// The sprite sheet used to draw tiles.
@@ -169,28 +895,63 @@ namespace Battle
 		// The palette used to display the grid.
 		const Palette* m_Palette;
 
+		// The fog hiding objects from the player, or nullptr if everything is visible.
+		const Fog* m_Fog;
 
-		
-		class Highlight
+		// The faction that the grid is being viewed as.
+		int m_FogFaction;
+
+
+	public:
+		// The layers that tiles can be highlighted with, drawn in this order.
+		enum HighlightLayer
 		{
-		public:
-			/// <summary>Check whether the tile should be highlighted.</summary>
-			/// <param name="vis">The grid visualizer.</param>
-			/// <param name="tile">A pointer to the tile.</param>
-			/// <returns>Whether the indicated tile should be highlighted.</returns>
-			virtual bool highlight_tile(const Visibility* vis, Tile* tile) const = 0;
-
-			/// <summary>Displays the highlighting.</summary>
-			virtual void display() const = 0;
+			// The tiles a unit can move to.
+			HIGHLIGHT_MOVE,
+
+			// The tiles a unit can attack.
+			HIGHLIGHT_ATTACK,
+
+			// The tiles enemies can attack.
+			HIGHLIGHT_THREAT,
+
+			// Units that just took damage.
+			HIGHLIGHT_DAMAGE,
+
+			// Units that just healed.
+			HIGHLIGHT_HEAL,
+
+			// The selected tile.
+			HIGHLIGHT_SELECTED,
+
+			HIGHLIGHT_COUNT
 		};
-		
-		class Selector : public Highlight
+
+	protected:
+		// The overlay drawn for each highlight layer.
+		static Graphic* m_HighlightGraphics[HIGHLIGHT_COUNT];
+
+		// The highlight layers of each tile, with one bit per layer.
+		std::vector<uint8_t> m_Highlights;
+
+		// Whether any tile is highlighted with each layer.
+		bool m_HighlightUsed[HIGHLIGHT_COUNT];
+
+		// Where to draw the overlay of each tile highlighted with each layer, so that a layer is drawn as one list of quads.
+		std::vector<vec3f> m_HighlightQuads[HIGHLIGHT_COUNT];
+
+		// Whether each layer's quads need to be rebuilt because its tiles changed.
+		bool m_HighlightDirty[HIGHLIGHT_COUNT];
+
+		// The grid version and level of detail that the quads were built for, since both move the ground under them.
+		unsigned int m_HighlightVersion;
+		int m_HighlightLod;
+
+		class Selector
 		{
 		protected:
 			friend class Visibility;
 
-			static Graphic* m_Graphic;
-
 			vec2i m_Tile;
 
 		public:
@@ -200,19 +961,40 @@ namespace Battle
 
 			void adjust_tile(Visibility* vis, int dx, int dy);
 
-			bool highlight_tile(const Visibility* vis, Tile* tile) const;
-
-			void display() const;
-
 		} m_Selector;
 
 
 		/// <summary>Resets the transform matrix.</summary>
 		void reset_transform();
+
+		/// <summary>Rebuilds the quads of the highlight layers whose tiles changed, or of every layer if the ground under them moved.</summary>
+		void reset_highlight_quads();
 		
-		/// <summary>Resets which tiles are visible.</summary>
+		/// <summary>Resets which tiles are visible, if the draw direction or the grid has changed since they were built.</summary>
 		void reset_visible_tiles();
 
+		/// <summary>Rebuilds the chunks that have changed and puts them in painter's order, for one draw direction.</summary>
+		/// <typeparam name="DX">The direction to draw columns of tiles in.</typeparam>
+		/// <typeparam name="DY">The direction to draw rows of tiles in.</typeparam>
+		template <int DX, int DY>
+		void build_visible_tiles();
+
+		/// <summary>Rebuilds the list of visible tiles in a chunk.</summary>
+		/// <typeparam name="DX">The direction to draw columns of tiles in.</typeparam>
+		/// <typeparam name="DY">The direction to draw rows of tiles in.</typeparam>
+		/// <param name="chunk">The chunk to rebuild.</param>
+		/// <param name="cx">The column of the chunk.</param>
+		/// <param name="cy">The row of the chunk.</param>
+		/// <param name="full">Whether to list every tile, or only the tiles with terrain or objects.</param>
+		template <int DX, int DY>
+		void build_chunk(Chunk& chunk, int cx, int cy, bool full);
+
+		/// <summary>Rebuilds the blocks drawn when zoomed out, if the block size, direction, or grid has changed.</summary>
+		/// <typeparam name="DX">The direction to draw columns of blocks in.</typeparam>
+		/// <typeparam name="DY">The direction to draw rows of blocks in.</typeparam>
+		template <int DX, int DY>
+		void reset_lod_blocks();
+
 
 		/// <summary>Adjusts the angle that the grid is being viewed from.</summary>
 		/// <param name="adjustment">The angular adjustment, in radians.</param>
@@ -222,20 +1004,58 @@ namespace Battle
 		/// <param name="adjustment">The position adjustment.</param>
 		void adjust_camera(vec3f adjustment);
 
+		/// <summary>Adjusts the zoom factor, switching the level of detail if it crosses a threshold.</summary>
+		/// <param name="adjustment">The zoom adjustment.</param>
+		void adjust_zoom(float adjustment);
+
 
 		/// <summary>Sets the target camera position.</summary>
 		/// <param name="target">The target for the camera position.</param>
 		void set_camera_target(vec3f target);
 
 
+		/// <summary>Displays the base of every visible tile, or every block if zoomed out, for one draw direction.</summary>
+		/// <typeparam name="DX">The direction columns of tiles are drawn in.</typeparam>
+		/// <typeparam name="DY">The direction rows of tiles are drawn in.</typeparam>
+		template <int DX, int DY>
+		void display_tiles() const;
+
 		/// <summary>Displays the base of a tile.</summary>
+		/// <typeparam name="DX">The direction columns of tiles are drawn in.</typeparam>
+		/// <typeparam name="DY">The direction rows of tiles are drawn in.</typeparam>
 		/// <param name="vtile">The data for a visible tile.</param>
+		template <int DX, int DY>
 		void display_tile(const VisibleTile& vtile) const;
 
+		/// <summary>Displays a block of tiles as a single tile.</summary>
+		/// <typeparam name="DX">The direction columns of blocks are drawn in.</typeparam>
+		/// <typeparam name="DY">The direction rows of blocks are drawn in.</typeparam>
+		/// <param name="block">The data for the block.</param>
+		template <int DX, int DY>
+		void display_block(const LodBlock& block) const;
+
+		/// <summary>Finds the height to draw what stands on a tile at. When zoomed out, this is the height of the tile's block.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <param name="height">The height of the tile.</param>
+		/// <returns>The height of the ground under the tile, as drawn.</returns>
+		float get_ground_height(int x, int y, int height) const;
+
+		/// <summary>Finds the height to draw what stands on a tile at. When zoomed out, this is the height of the tile's block.</summary>
+		/// <param name="vtile">The data for a visible tile.</param>
+		/// <returns>The height of the ground under the tile, as drawn.</returns>
+		float get_ground_height(const VisibleTile& vtile) const;
+
 		/// <summary>Displays the object on a tile.</summary>
 		/// <param name="vtile">The data for a visible tile.</param>
 		void display_object(const VisibleTile& vtile) const;
 
+		/// <summary>Displays every highlight layer, one layer at a time.</summary>
+		void display_highlights() const;
+
+		/// <summary>Collects the terrain and objects drawn over the tiles and sorts them back to front.</summary>
+		void sort_draw_items() const;
+
 		/// <summary>Displays the terrain of a tile.</summary>
 		/// <param name="vtile">The data for a visible tile.</param>
 		void display_terrain(const VisibleTile& vtile) const;
@@ -248,37 +1068,268 @@ namespace Battle
 		/// <summary>Constructs the view for the grid.</summary>
 		/// <param name="bounds">The bounds of the screen.</param>
 		/// <param name="grid">The battle grid.</param>
-		Visibility(const mat2x2i& bounds, Grid* grid);
+		Visibility(const mat2x2i& bounds, const Grid* grid);
 
 		/// <summary>Resets what is visible.</summary>
 		void reset();
 
+		/// <summary>Creates the highlight overlays and picks up the tile set's sprite sheet. Must run on the render thread.</summary>
+		void load_graphics();
+
 		/// <summary>Rotates the grid clockwise.</summary>
 		void rotate_left();
 
 		/// <summary>Rotates the grid counter-clockwise.</summary>
 		void rotate_right();
 
+		/// <summary>Zooms in on the grid.</summary>
+		void zoom_in();
+
+		/// <summary>Zooms out from the grid.</summary>
+		void zoom_out();
+
 		/// <summary>Sets which tile is selected.</summary>
 		/// <param name="dx">The x-coordinate of the selected tile.</param>
 		/// <param name="dy">The y-coordinate of the selected tile.</param>
 		void set_selected_tile(int x, int y);
 
-		/// <summary>Adjusts which tile is selected.</summary>
-		/// <param name="dx">The change in x-coordinate, before factoring in the camera.</param>
-		/// <param name="dy">The change in y-coordinate, before factoring in the camera.</param>
-		void adjust_selected_tile(int dx, int dy);
+		/// <summary>Adjusts which tile is selected.</summary>
+		/// <param name="dx">The change in x-coordinate, before factoring in the camera.</param>
+		/// <param name="dy">The change in y-coordinate, before factoring in the camera.</param>
+		void adjust_selected_tile(int dx, int dy);
+
+		/// <summary>Finds the front-most tile drawn at a point on the screen.</summary>
+		/// <param name="sx">The x-coordinate on the screen, in pixels from the center.</param>
+		/// <param name="sy">The y-coordinate on the screen, in pixels from the center, with up being positive.</param>
+		/// <param name="x">Set to the x-coordinate of the tile, if one was found.</param>
+		/// <param name="y">Set to the y-coordinate of the tile, if one was found.</param>
+		/// <returns>True if a tile is drawn at the point, false otherwise.</returns>
+		bool pick_tile(float sx, float sy, int& x, int& y) const;
+
+		/// <summary>Selects the front-most tile drawn at a point on the screen.</summary>
+		/// <param name="sx">The x-coordinate on the screen, in pixels from the center.</param>
+		/// <param name="sy">The y-coordinate on the screen, in pixels from the center, with up being positive.</param>
+		/// <returns>True if a tile was selected, false otherwise.</returns>
+		bool select_tile_at(float sx, float sy);
+
+		/// <summary>Sets the fog used to hide objects.</summary>
+		/// <param name="fog">The fog, or nullptr to show every object.</param>
+		/// <param name="faction">The faction that the grid is being viewed as.</param>
+		void set_fog(const Fog* fog, int faction);
+
+		/// <summary>Sets which tiles are highlighted with a layer, replacing the tiles it highlighted before.</summary>
+		/// <param name="layer">The highlight layer. The selected tile is set with set_selected_tile instead.</param>
+		/// <param name="tiles">The tiles to highlight.</param>
+		void set_highlight(HighlightLayer layer, const Bitboard& tiles);
+
+		/// <summary>Turns a highlight layer on or off for a single tile.</summary>
+		/// <param name="layer">The highlight layer.</param>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <param name="on">Whether the tile should be highlighted.</param>
+		void set_highlight(HighlightLayer layer, int x, int y, bool on);
+
+		/// <summary>Stops a layer from highlighting any tiles.</summary>
+		/// <param name="layer">The highlight layer.</param>
+		void clear_highlight(HighlightLayer layer);
+
+		/// <summary>Updates the view of the grid.</summary>
+		/// <param name="frames_passed">The number of frames that passed since the last update.</param>
+		void update(int frames_passed);
+
+		/// <summary>Displays the grid.</summary>
+		void display() const;
+	};
+
+
+
+	/*
+		MINIMAP
+	*/
+
+	// A small image of the whole grid, kept up to date by redrawing only the pixels of chunks that changed.
+	// Pixels are packed RGBA, with red in the lowest byte, ready to be uploaded as one texture.
+	class Minimap
+	{
+	protected:
+		// The grid that the minimap shows.
+		const Grid* m_Grid;
+
+		// The number of tiles along each side of the square that each pixel covers.
+		int m_Scale;
+
+		// The size of the image, in pixels.
+		int m_Width, m_Height;
+
+		// The pixels of the image, row by row.
+		std::vector<uint32_t> m_Pixels;
+
+		// The color of each type of tile, before shading by height.
+		std::unordered_map<const TileType*, uint32_t> m_Colors;
+
+		// The grid's version of each chunk when its pixels were last drawn.
+		std::vector<unsigned int> m_Versions;
+
+		// Whether the whole image has been drawn at least once.
+		bool m_Built;
+
+		// The fog used to hide units and objects, or nullptr to show everything.
+		const Fog* m_Fog;
+
+		// The faction that the grid is being viewed as.
+		int m_FogFaction;
+
+		// The tiles that the faction could see when the pixels were last drawn, as a bitset over the grid.
+		std::vector<uint64_t> m_Seen;
+
+		// A run of pixels in a row that share a color, drawn as one stretched square.
+		struct PixelRun
+		{
+			// The first pixel of the run.
+			int x, y;
+
+			// The number of pixels across and down that the run covers.
+			int length, rows;
+
+			// The graphic of the run's color.
+			const Graphic* swatch;
+		};
+
+		// The runs that the image is drawn as, rebuilt each time it is uploaded.
+		std::vector<PixelRun> m_Runs;
+
+		// A one-pixel graphic for each color, shared by every minimap.
+		static std::unordered_map<uint32_t, Graphic*> m_Swatches;
+
+		/// <summary>Works out the color of a tile.</summary>
+		/// <param name="tile">The tile.</param>
+		/// <returns>The packed color, or 0 for no tile.</returns>
+		uint32_t get_color(const Tile* tile) const;
+
+		/// <summary>Redraws one pixel from the tiles it covers. A pixel shows a unit marker if any of its tiles has a unit, an object marker if any has an object, and the highest tile otherwise.</summary>
+		/// <param name="px">The x-coordinate of the pixel.</param>
+		/// <param name="py">The y-coordinate of the pixel.</param>
+		/// <returns>True if the pixel changed, false otherwise.</returns>
+		bool draw_pixel(int px, int py);
+
+		/// <summary>Redraws the pixels of the tiles that the faction has started or stopped seeing since the last update.</summary>
+		/// <returns>True if any pixel changed, false otherwise.</returns>
+		bool update_fog();
+
+		/// <summary>Works out the color of a square of pixels, keeping unit and object markers over the tiles.</summary>
+		/// <param name="x0">The x-coordinate of the first pixel.</param>
+		/// <param name="y0">The y-coordinate of the first pixel.</param>
+		/// <param name="step">The number of pixels along each side of the square.</param>
+		/// <returns>The packed color, or 0 if every pixel is empty.</returns>
+		uint32_t get_block_color(int x0, int y0, int step) const;
+
+		/// <summary>Splits the image into runs, with each square of pixels drawn as one.</summary>
+		/// <param name="step">The number of pixels along each side of a square.</param>
+		void build_runs(int step);
+
+	public:
+		/// <summary>Constructs a minimap of a grid. Nothing is drawn until the first update.</summary>
+		/// <param name="grid">The grid to show.</param>
+		/// <param name="size">The largest width or height of the image, in pixels.</param>
+		Minimap(const Grid* grid, int size);
+
+		/// <summary>Gives each type of tile in the grid's tile set its own color, and redraws the whole image the next update. Called again when the tile set is reloaded.</summary>
+		void load_colors();
+
+		/// <summary>Sets the fog used to hide units and objects, and redraws the whole image the next update.</summary>
+		/// <param name="fog">The fog, or nullptr to show every unit and object.</param>
+		/// <param name="faction">The faction that the grid is being viewed as.</param>
+		void set_fog(const Fog* fog, int faction);
+
+		/// <summary>Redraws the pixels of every chunk that has changed since the last update, and of every tile that the faction started or stopped seeing.</summary>
+		/// <returns>True if any pixel changed, meaning the image needs to be uploaded again.</returns>
+		bool update();
+
+		/// <summary>Uploads the pixels so that they can be displayed. Onion can't write pixels into a texture, so the rows are split into runs of one color, each drawn as a single square. If there would be too many runs, the image is drawn at half the resolution until there aren't.</summary>
+		void upload();
+
+		/// <summary>Displays the image as it was last uploaded, with its first pixel at the origin.</summary>
+		/// <param name="pixel_size">The size of each pixel on the screen.</param>
+		void display(float pixel_size) const;
+
+		/// <summary>Retrieves the width of the image.</summary>
+		/// <returns>The width, in pixels.</returns>
+		int get_width() const;
+
+		/// <summary>Retrieves the height of the image.</summary>
+		/// <returns>The height, in pixels.</returns>
+		int get_height() const;
+
+		/// <summary>Retrieves the pixels of the image.</summary>
+		/// <returns>The packed pixels, row by row.</returns>
+		std::span<const uint32_t> get_pixels() const;
+
+		/// <summary>Retrieves a pixel of the image.</summary>
+		/// <param name="x">The x-coordinate of the pixel.</param>
+		/// <param name="y">The y-coordinate of the pixel.</param>
+		/// <returns>The packed color of the pixel, or 0 if it is outside the image.</returns>
+		uint32_t get_pixel(int x, int y) const;
+	};
+
+
+
+
+	/*
+		HOT RELOAD
+	*/
+
+	// Notices when a map file or its tile set's meta file is saved, so that a running battle can pick up the changes.
+	// Uses inotify on Linux, and compares the files' modification times elsewhere.
+	class MapWatcher
+	{
+	protected:
+		// The ID of the map being watched.
+		std::string m_Map;
+
+		// The ID of the tile set being watched.
+		std::string m_TileSet;
+
+		// The inotify instance, or -1 if the files' modification times are compared instead.
+		int m_Handle;
+
+		// The path of the file that the tile set's sprites are drawn from, which is an atlas page if the sheet was packed.
+		std::string m_SheetPath;
+
+		// The inotify watches on the maps folder, the tiles folder and the folder of the sprite sheet.
+		int m_MapWatch, m_TileWatch, m_SheetWatch;
+
+		// The modification times of the map, meta and sprite sheet files when they were last checked.
+		std::filesystem::file_time_type m_MapTime, m_TileTime, m_SheetTime;
+
+		/// <summary>Checks whether a file's modification time has changed, and remembers the new time.</summary>
+		/// <param name="path">The path to the file.</param>
+		/// <param name="time">The time it was last modified, when it was last checked.</param>
+		/// <returns>True if the file has changed, false otherwise.</returns>
+		static bool check_time(const std::string& path, std::filesystem::file_time_type& time);
+
+	public:
+		/// <summary>Starts watching a map and its tile set.</summary>
+		/// <param name="map">The ID of the battle map.</param>
+		/// <param name="tileset">The ID of the map's tile set.</param>
+		MapWatcher(std::string map, std::string tileset);
+
+		MapWatcher(const MapWatcher&) = delete;
 
-		/// <summary>Updates the view of the grid.</summary>
-		/// <param name="frames_passed">The number of frames that passed since the last update.</param>
-		void update(int frames_passed);
+		~MapWatcher();
 
-		/// <summary>Displays the grid.</summary>
-		void display() const;
+		/// <summary>Changes which tile set is watched, for when the map switches to another one.</summary>
+		/// <param name="tileset">The ID of the tile set.</param>
+		void set_tile_set(std::string tileset);
+
+		/// <summary>Checks whether the files have been saved since the last poll. Doesn't block.</summary>
+		/// <param name="map_changed">Set to whether the map file changed.</param>
+		/// <param name="tiles_changed">Set to whether the tile set's meta file or the sprite sheet it is drawn from changed.</param>
+		void poll(bool& map_changed, bool& tiles_changed);
 	};
 
 
 
+
 	/*
 		OBJECTS
 	*/
@@ -292,9 +1343,15 @@ namespace Battle
 		// A map from an ID to the data for the object.
 		static std::unordered_map<std::string, std::unordered_map<std::string, std::string>*> m_ObjectData;
 
+		// Guards the object data and the loaded objects, which a loader may read on a worker thread.
+		static std::mutex m_ObjectDataMutex;
+
 		// A map from an ID to the loaded object.
 		static std::unordered_map<std::string, Object*> m_Objects;
 
+		// The ID of the object.
+		std::string m_ID;
+
 		/// <summary>Adds the object to the map.</summary>
 		/// <param name="id">The ID for the object.</param>
 		Object(std::string id);
@@ -305,6 +1362,27 @@ namespace Battle
 		/// <returns>The object with the given ID.</returns>
 		static Object* get_object(std::string id);
 
+		/// <summary>Reads the data for every object, if it hasn't been read already. Doesn't load any graphics, so it can run off the render thread.</summary>
+		static void load_object_data();
+
+		/// <summary>Loads the graphics of every object that was created without them. Must run on the render thread.</summary>
+		static void load_object_graphics();
+
+		/// <summary>Makes the graphics of every object drawn from a sprite sheet again, after the sheet has been reloaded. Must run on the render thread.</summary>
+		/// <param name="sheet">The path that the sheet is loaded from, as given by ResourceCache::get_sheet_path.</param>
+		static void reload_object_graphics(const std::string& sheet);
+
+		/// <summary>Loads the object's graphics, if they haven't been loaded yet.</summary>
+		virtual void load_graphics();
+
+		/// <summary>Makes the object's graphics again if they are drawn from a sprite sheet that has been reloaded.</summary>
+		/// <param name="sheet">The path that the sheet is loaded from.</param>
+		virtual void reload_graphics(const std::string& sheet);
+
+		/// <summary>Retrieves the ID of the object.</summary>
+		/// <returns>The ID that the object was loaded with.</returns>
+		const std::string& get_id() const;
+
 		/// <summary>Displays the object.</summary>
 		virtual void display() const = 0;
 	};
@@ -312,6 +1390,7 @@ namespace Battle
 	class BillboardedObject : public Object
 	{
 	protected:
+		// The sprite, or nullptr until the graphics are loaded.
 		SpriteGraphic* m_Sprite;
 
 	public:
@@ -322,8 +1401,16 @@ namespace Battle
 
 	class StaticObject : public BillboardedObject
 	{
+	protected:
+		// The path of the sprite sheet and the name of the sprite, kept until the graphics are loaded.
+		std::string m_SpriteSheet, m_SpriteName;
+
 	public:
 		StaticObject(std::string id, std::string sprite_sheet, std::string sprite);
+
+		void load_graphics();
+
+		void reload_graphics(const std::string& sheet);
 	};
 
 	class Actor : public Object
@@ -333,6 +1420,357 @@ namespace Battle
 
 
 
+	/*
+		UNITS
+	*/
+
+	// The components of a unit are shared with the simulation.
+	using Sim::CombatStats;
+	using Sim::UnitPosition;
+	using Sim::UnitMovement;
+	using Sim::UnitStatus;
+
+	// Stores battle units as contiguous arrays of components, so that passes over every unit stay in cache.
+	class UnitStore
+	{
+	protected:
+		// The components of each unit. Index k of each array belongs to the same unit, and the arrays have no gaps.
+		std::vector<UnitPosition> m_Positions;
+		std::vector<CombatStats> m_Stats;
+		std::vector<UnitMovement> m_Movement;
+		std::vector<UnitStatus> m_Status;
+		std::vector<int> m_Factions;
+		std::vector<SpriteGraphic*> m_Sprites;
+
+		// The handle slot of the unit at each index of the component arrays.
+		std::vector<uint32_t> m_Owners;
+
+		// For each handle slot, the index of its unit in the component arrays.
+		std::vector<uint32_t> m_Indices;
+
+		// For each handle slot, its current generation. A deque, so that each slot keeps its address for get_resource.
+		std::deque<uint32_t> m_Generations;
+
+		// Handle slots that are free to reuse.
+		std::vector<uint32_t> m_Free;
+
+	public:
+		/// <summary>Adds a unit, recording it on its tile.</summary>
+		/// <param name="grid">The grid that the unit is on.</param>
+		/// <param name="faction">The faction that the unit belongs to.</param>
+		/// <param name="pos">The position of the unit.</param>
+		/// <param name="stats">The combat stats of the unit.</param>
+		/// <param name="movement">How far the unit can move.</param>
+		/// <param name="status">The starting status of the unit.</param>
+		/// <param name="sprite">The sprite of the unit.</param>
+		/// <returns>A handle to the unit, or a null handle if the tile is out of bounds or already has a unit.</returns>
+		Entity create(Grid* grid, int faction, UnitPosition pos, const CombatStats& stats, const UnitMovement& movement, const UnitStatus& status, SpriteGraphic* sprite);
+
+		/// <summary>Removes a unit and clears it from its tile. The last unit takes its place in the arrays, so its handle is the only one invalidated.</summary>
+		/// <param name="entity">The handle to the unit.</param>
+		/// <param name="grid">The grid that the unit is on.</param>
+		void destroy(Entity entity, Grid* grid);
+
+		/// <summary>Checks whether a handle still refers to a unit.</summary>
+		/// <param name="entity">The handle.</param>
+		/// <returns>True if the unit exists.</returns>
+		bool alive(Entity entity) const;
+
+		/// <summary>Retrieves the index of a unit in the component arrays.</summary>
+		/// <param name="entity">The handle to the unit.</param>
+		/// <returns>The index, or -1 if the unit doesn't exist.</returns>
+		int index_of(Entity entity) const;
+
+		/// <summary>Retrieves an address that identifies a unit's handle slot, for events to claim the unit with.</summary>
+		/// <param name="entity">The handle to the unit.</param>
+		/// <returns>The address, which stays the same while the store exists.</returns>
+		const void* get_resource(Entity entity) const;
+
+		/// <summary>Retrieves the handle to the unit at an index in the component arrays.</summary>
+		/// <param name="index">The index.</param>
+		/// <returns>The handle to the unit.</returns>
+		Entity entity_at(int index) const;
+
+		/// <summary>Moves a unit, updating which tiles it is recorded on.</summary>
+		/// <param name="entity">The handle to the unit.</param>
+		/// <param name="grid">The grid that the unit is on.</param>
+		/// <param name="x">The x-coordinate to move to.</param>
+		/// <param name="y">The y-coordinate to move to.</param>
+		/// <returns>False if the tile is out of bounds or already has a unit, true otherwise.</returns>
+		bool move(Entity entity, Grid* grid, int x, int y);
+
+		/// <summary>Retrieves the number of units.</summary>
+		/// <returns>The number of units, which is also the length of each component array.</returns>
+		int size() const;
+
+		std::span<UnitPosition> get_positions();
+		std::span<CombatStats> get_stats();
+		std::span<UnitMovement> get_movement();
+		std::span<UnitStatus> get_status();
+		std::span<int> get_factions();
+		std::span<SpriteGraphic*> get_sprites();
+
+		std::span<const UnitPosition> get_positions() const;
+		std::span<const CombatStats> get_stats() const;
+		std::span<const UnitMovement> get_movement() const;
+		std::span<const UnitStatus> get_status() const;
+		std::span<const int> get_factions() const;
+		std::span<SpriteGraphic* const> get_sprites() const;
+
+		/// <summary>Retrieves read-only views of every component array, for systems that work on all of the units at once.</summary>
+		/// <returns>The views, all with one entry per unit.</returns>
+		Sim::UnitSpans get_spans() const;
+	};
+
+
+
+
+	/*
+		PATHFINDING
+	*/
+
+	// A request for a path from one tile to another.
+	struct PathQuery
+	{
+		// The tile to start from.
+		int sx, sy;
+
+		// The tile to get to.
+		int tx, ty;
+	};
+
+	// Finds paths across the grid by planning between clusters of tiles first, then filling in the steps inside each cluster.
+	// The clusters are the grid's chunks, so a cluster is repaired only when the grid changes the version of its chunk.
+	class Pathfinder
+	{
+	protected:
+		// A tile on the border of a cluster that paths can cross through.
+		struct Node
+		{
+			// The position of the tile.
+			int x, y;
+
+			// The cluster that the tile is in.
+			int cluster;
+
+			// The node on the other side of the border.
+			int partner;
+
+			// The nodes in the same cluster that can be reached, paired with how many steps away they are.
+			std::vector<std::pair<int, int>> edges;
+		};
+
+		// A path found earlier, kept until a cluster it passes through changes.
+		struct CachedPath
+		{
+			// The steps of the path.
+			std::vector<UnitPosition> path;
+
+			// The clusters that the path passes through.
+			std::vector<int> clusters;
+		};
+
+		// The grid to find paths on.
+		const Grid* m_Grid;
+
+		// The largest height difference that can be climbed in one step.
+		int m_Climb;
+
+		// The number of columns and rows of clusters.
+		int m_Columns, m_Rows;
+
+		// The grid's version of each cluster when it was last repaired.
+		std::vector<unsigned int> m_Versions;
+
+		// Whether the clusters have been built at all.
+		bool m_Built;
+
+		// The nodes, indexed by ID. Removed nodes leave a gap until they are reused.
+		std::vector<Node> m_Nodes;
+
+		// The IDs of removed nodes.
+		std::vector<int> m_FreeNodes;
+
+		// For each cluster, the nodes on its border with the cluster to the right [0] and below [1], on this cluster's side.
+		std::vector<std::vector<int>> m_Borders[2];
+
+		// Paths found earlier, keyed by their start and target tiles.
+		std::unordered_map<uint64_t, CachedPath> m_Cache;
+
+		// Guards the cache while queries run on several threads.
+		std::mutex m_CacheMutex;
+
+		/// <summary>Retrieves the cluster that a tile is in.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <returns>The index of the cluster.</returns>
+		int get_cluster(int x, int y) const;
+
+		/// <summary>Checks whether a unit can step from one tile onto a neighboring tile.</summary>
+		/// <param name="x">The x-coordinate of the tile to step from.</param>
+		/// <param name="y">The y-coordinate of the tile to step from.</param>
+		/// <param name="nx">The x-coordinate of the tile to step onto.</param>
+		/// <param name="ny">The y-coordinate of the tile to step onto.</param>
+		/// <returns>True if the step is allowed.</returns>
+		bool can_step(int x, int y, int nx, int ny) const;
+
+		/// <summary>Finds the fewest steps from a tile to every tile in its cluster, without leaving the cluster.</summary>
+		/// <param name="x">The x-coordinate of the tile to start from.</param>
+		/// <param name="y">The y-coordinate of the tile to start from.</param>
+		/// <param name="distance">Set to the steps to each tile of the cluster, or -1 if it can't be reached. Needs GRID_CHUNK_SIZE * GRID_CHUNK_SIZE entries.</param>
+		/// <param name="parent">If not nullptr, set to the tile that each tile was reached from. Needs as many entries as distance.</param>
+		void flood(int x, int y, int* distance, int* parent) const;
+
+		/// <summary>Adds a node, reusing the ID of a removed node if there is one.</summary>
+		/// <returns>The ID of the node.</returns>
+		int add_node(int x, int y, int cluster);
+
+		/// <summary>Replaces the nodes on the border between a cluster and the cluster to its right or below it.</summary>
+		/// <param name="cluster">The cluster.</param>
+		/// <param name="side">0 for the border to the right, 1 for the border below.</param>
+		void build_border(int cluster, int side);
+
+		/// <summary>Collects every node inside a cluster.</summary>
+		/// <param name="cluster">The cluster.</param>
+		/// <param name="nodes">The vector to add the node IDs to.</param>
+		void get_cluster_nodes(int cluster, std::vector<int>& nodes) const;
+
+		/// <summary>Replaces the edges between the nodes inside a cluster.</summary>
+		/// <param name="cluster">The cluster.</param>
+		void build_edges(int cluster);
+
+		/// <summary>Finds a path without repairing the clusters, so that several can run at once.</summary>
+		/// <param name="query">The start and target tiles.</param>
+		/// <param name="path">Set to the steps of the path, not including the start tile.</param>
+		/// <returns>True if a path was found, false otherwise.</returns>
+		bool search(const PathQuery& query, std::vector<UnitPosition>& path);
+
+		/// <summary>Adds the steps between two tiles in the same cluster to a path.</summary>
+		/// <returns>True if the tiles are connected inside the cluster, false otherwise.</returns>
+		bool refine(int sx, int sy, int tx, int ty, std::vector<UnitPosition>& path) const;
+
+	public:
+		/// <summary>Constructs a pathfinder over a grid. The clusters are built on the first query.</summary>
+		/// <param name="grid">The grid to find paths on.</param>
+		/// <param name="climb">The largest height difference that can be climbed in one step.</param>
+		Pathfinder(const Grid* grid, int climb);
+
+		/// <summary>Repairs the clusters whose tiles have changed since they were last built, and forgets the cached paths through them.</summary>
+		void update();
+
+		/// <summary>Finds the shortest path between two tiles, going around impassable and occupied tiles.</summary>
+		/// <param name="query">The start and target tiles.</param>
+		/// <param name="path">Set to the steps of the path, not including the start tile.</param>
+		/// <returns>True if a path was found, false otherwise.</returns>
+		bool find_path(const PathQuery& query, std::vector<UnitPosition>& path);
+
+		/// <summary>Finds paths for a batch of queries, spread across threads.</summary>
+		/// <param name="queries">The start and target tiles of each path.</param>
+		/// <param name="paths">Set to the steps of each path, empty if there isn't one.</param>
+		/// <returns>The number of paths found.</returns>
+		int find_paths(std::span<const PathQuery> queries, std::vector<std::vector<UnitPosition>>& paths);
+	};
+
+
+
+
+	/*
+		STATUS EFFECTS
+	*/
+
+	// The types of status effect.
+	enum class StatusType
+	{
+		// Loses health each turn.
+		POISON,
+
+		// Gains health each turn.
+		REGENERATION,
+
+		// Attack changed until the effect wears off.
+		ATTACK,
+
+		// Defense changed until the effect wears off.
+		DEFENSE,
+
+		// Accuracy changed until the effect wears off.
+		ACCURACY,
+
+		// Evasion changed until the effect wears off.
+		EVASION,
+
+		COUNT
+	};
+
+	// A visible result of a status effect, such as a damage number or a death.
+	struct StatusResult
+	{
+		// The unit affected.
+		Entity unit;
+
+		// The type of effect.
+		StatusType type;
+
+		// The change in health. Negative for damage.
+		int hp;
+
+		// Whether the unit died.
+		bool died;
+	};
+
+	// Applies status effects to units, one type of effect at a time over all the units that have it.
+	class StatusEffects
+	{
+	protected:
+		// Every active effect of one type, stored as parallel arrays.
+		struct EffectArray
+		{
+			// The unit that each effect is on.
+			std::vector<Entity> units;
+
+			// The strength of each effect: health per turn, or the change to a stat.
+			std::vector<int> amounts;
+
+			// The number of turns left on each effect.
+			std::vector<int> turns;
+
+			/// <summary>Removes an effect, moving the last effect into its place.</summary>
+			void remove(int k);
+		};
+
+		// The active effects of each type.
+		EffectArray m_Effects[(int)StatusType::COUNT];
+
+		/// <summary>Retrieves the stat that a buff or debuff changes.</summary>
+		/// <param name="stats">The unit's stats.</param>
+		/// <param name="type">The type of effect.</param>
+		/// <returns>A pointer to the stat, or nullptr if the effect doesn't change a stat.</returns>
+		static int* get_stat(CombatStats& stats, StatusType type);
+
+	public:
+		/// <summary>Puts a status effect on a unit. Buffs and debuffs change the unit's stats straight away.</summary>
+		/// <param name="units">The units.</param>
+		/// <param name="unit">The unit to affect.</param>
+		/// <param name="type">The type of effect.</param>
+		/// <param name="amount">The health per turn, or the change to the stat.</param>
+		/// <param name="turns">The number of turns the effect lasts.</param>
+		void add(UnitStore& units, Entity unit, StatusType type, int amount, int turns);
+
+		/// <summary>Applies a turn of every effect on a faction's units, then wears the effects down.</summary>
+		/// <param name="units">The units.</param>
+		/// <param name="faction">The faction whose phase is starting.</param>
+		/// <param name="results">The vector to add the visible results to, so they can be shown as events.</param>
+		void tick(UnitStore& units, int faction, std::vector<StatusResult>& results);
+
+		/// <summary>Retrieves the number of active effects of a type.</summary>
+		/// <param name="type">The type of effect.</param>
+		/// <returns>The number of active effects.</returns>
+		int count(StatusType type) const;
+	};
+
+
+
+
 	/*
 		TERRAIN
 	*/
@@ -344,6 +1782,14 @@ namespace Battle
 		/// <returns>How far an object on or in the terrain is displaced from the ground.</returns>
 		virtual int get_height() = 0;
 
+		/// <summary>Retrieves the damage that the terrain blocks for an object standing in it.</summary>
+		/// <returns>The damage subtracted from each attack.</returns>
+		virtual int get_defense() const;
+
+		/// <summary>Retrieves how much harder the terrain makes it to hit an object standing in it.</summary>
+		/// <returns>The chance out of 100 subtracted from each attack's chance to hit.</returns>
+		virtual int get_evasion() const;
+
 		/// <summary>Displays the terrain.</summary>
 		virtual void display() const = 0;
 	};
@@ -351,6 +1797,198 @@ namespace Battle
 
 
 
+	/*
+		COMBAT
+	*/
+
+	// Works out the expected outcome of every unit attacking every other unit at once.
+	class CombatTable
+	{
+	protected:
+		// The stats of each unit, stored as one array per stat so that many targets can be processed at once.
+		// Accuracy and evasion are out of 100.
+		std::vector<float> m_Attack;
+		std::vector<float> m_Defense;
+		std::vector<float> m_Accuracy;
+		std::vector<float> m_Evasion;
+		std::vector<float> m_Height;
+
+		// Copies of the target-side stats, padded with zeros to a multiple of 8. Kept between computes, and only reallocated when the number of units changes.
+		std::vector<float> m_PaddedDefense;
+		std::vector<float> m_PaddedEvasion;
+		std::vector<float> m_PaddedHeight;
+
+		// The number of units.
+		int m_Count;
+
+		// The distance between rows of the result matrices.
+		int m_Stride;
+
+		// The chance out of 1 that each attacker hits each target, row by row.
+		std::vector<float> m_HitChance;
+
+		// The expected damage from each attacker to each target, row by row.
+		std::vector<float> m_Damage;
+
+	public:
+		// The rules for hit chance and damage are the simulation's, so that the two always agree.
+		static const int HEIGHT_DAMAGE = Sim::HEIGHT_DAMAGE;
+		static const int HEIGHT_ACCURACY = Sim::HEIGHT_ACCURACY;
+
+		CombatTable();
+
+		/// <summary>Removes every unit.</summary>
+		void clear();
+
+		/// <summary>Adds a unit.</summary>
+		/// <param name="stats">The unit's stats.</param>
+		/// <param name="tile">The tile that the unit is standing on, for its height and terrain.</param>
+		/// <returns>The index of the unit in the table.</returns>
+		int add(const CombatStats& stats, const Tile* tile);
+
+		/// <summary>Replaces the units with every unit in a set of component arrays, so that each unit keeps its index.</summary>
+		/// <param name="units">The units, such as the spans of a unit store.</param>
+		/// <param name="grid">The grid that the units are standing on.</param>
+		void load(const Sim::UnitSpans& units, const Grid& grid);
+
+		/// <summary>Works out the hit chance and expected damage for every attacker and target.</summary>
+		void compute();
+
+		/// <summary>Retrieves the chance that one unit hits another.</summary>
+		/// <param name="attacker">The index of the attacker.</param>
+		/// <param name="target">The index of the target.</param>
+		/// <returns>The chance to hit, from 0 to 1.</returns>
+		float get_hit_chance(int attacker, int target) const;
+
+		/// <summary>Retrieves the expected damage of one unit attacking another.</summary>
+		/// <param name="attacker">The index of the attacker.</param>
+		/// <param name="target">The index of the target.</param>
+		/// <returns>The damage on a hit, times the chance to hit.</returns>
+		float get_expected_damage(int attacker, int target) const;
+
+		/// <summary>Retrieves a row of expected damage.</summary>
+		/// <param name="attacker">The index of the attacker.</param>
+		/// <returns>The expected damage against each target, indexed by target.</returns>
+		const float* get_damage_row(int attacker) const;
+	};
+
+
+
+
+	/*
+		TIMELINE
+	*/
+
+	// Decides who acts next, based on each actor's speed.
+	// Actors gain charge equal to their speed every tick, and act once their charge reaches CHARGE_TO_ACT.
+	class Timeline
+	{
+	protected:
+		// Something scheduled on the timeline.
+		struct Entry
+		{
+			// Whether the entry is still scheduled.
+			bool active;
+
+			// Whether the entry is a timed effect, which fires once at a fixed time, rather than an actor.
+			bool effect;
+
+			// How much charge the actor gains each tick. An actor with no speed waits until its speed is raised.
+			int speed;
+
+			// The actor's charge at the time it was last updated.
+			long long charge;
+
+			// The time the entry was last updated.
+			long long updated;
+
+			// The time the entry is next ready.
+			long long ready;
+
+			// Breaks ties between entries that are ready at the same time, in the order they were scheduled.
+			unsigned long long order;
+
+			// The position of the entry in the heap.
+			int heap;
+		};
+
+		// The entries, indexed by their handles.
+		std::vector<Entry> m_Entries;
+
+		// Handles to the scheduled entries, as a binary heap with the next entry to be ready at the top.
+		std::vector<int> m_Heap;
+
+		// Handles of removed entries, which can be reused.
+		std::vector<int> m_Free;
+
+		// The current time.
+		long long m_Time;
+
+		// The order to give the next entry that is scheduled.
+		unsigned long long m_NextOrder;
+
+		/// <summary>Checks if one entry is ready before another.</summary>
+		bool before(int a, int b) const;
+
+		/// <summary>Moves an entry up the heap until its parent is ready before it.</summary>
+		void sift_up(int pos);
+
+		/// <summary>Moves an entry down the heap until its children are ready after it.</summary>
+		void sift_down(int pos);
+
+		/// <summary>Calculates when an actor will next have enough charge to act.</summary>
+		/// <param name="entry">The actor.</param>
+		/// <returns>The time that the actor is ready.</returns>
+		static long long ready_time(const Entry& entry);
+
+	public:
+		// The charge that an actor needs to act.
+		static const int CHARGE_TO_ACT = 1000;
+
+		/// <summary>Constructs an empty timeline.</summary>
+		Timeline();
+
+		/// <summary>Adds an actor to the timeline.</summary>
+		/// <param name="speed">How much charge the actor gains each tick.</param>
+		/// <param name="charge">How much charge the actor starts with.</param>
+		/// <returns>A handle to the actor.</returns>
+		int add_actor(int speed, int charge = 0);
+
+		/// <summary>Adds a timed effect to the timeline.</summary>
+		/// <param name="delay">The number of ticks until the effect fires.</param>
+		/// <returns>A handle to the effect.</returns>
+		int add_effect(int delay);
+
+		/// <summary>Removes an actor or effect from the timeline.</summary>
+		/// <param name="handle">The handle to the actor or effect.</param>
+		void remove(int handle);
+
+		/// <summary>Changes an actor's speed, keeping the charge it has built up so far.</summary>
+		/// <param name="handle">The handle to the actor.</param>
+		/// <param name="speed">The new speed of the actor. 0 stops the actor until its speed is raised again.</param>
+		void set_speed(int handle, int speed);
+
+		/// <summary>Retrieves the actor or effect that is ready next, without advancing the timeline.</summary>
+		/// <returns>The handle to the actor or effect, or -1 if nothing will ever be ready.</returns>
+		int peek() const;
+
+		/// <summary>Advances the timeline to the next actor or effect. Actors spend their charge and are rescheduled; effects are removed.</summary>
+		/// <returns>The handle to the actor or effect, or -1 if nothing will ever be ready.</returns>
+		int advance();
+
+		/// <summary>Predicts the next actors and effects, without advancing the timeline.</summary>
+		/// <param name="n">The number of turns to predict.</param>
+		/// <param name="handles">The vector to fill with the handles, in order. Fast actors can appear more than once.</param>
+		void predict(int n, std::vector<int>& handles) const;
+
+		/// <summary>Retrieves the current time.</summary>
+		/// <returns>The number of ticks that have passed.</returns>
+		long long get_time() const;
+	};
+
+
+
+
 	/*
 		EVENTS
 	*/
@@ -358,9 +1996,24 @@ namespace Battle
 	class Event
 	{
 	public:
+		// Something that an event needs to itself while it runs, such as a unit, a tile, or the camera.
+		typedef const void* Resource;
+
+		// The resource for the camera.
+		static const Resource CAMERA;
+
 		virtual int start();
 
 		virtual int update();
+
+		/// <summary>Plays the event as a script. By default the event is started, then updated once a frame until it stops.</summary>
+		/// <returns>The script, which the queue runs on its scheduler.</returns>
+		virtual Script run();
+
+		/// <summary>Lists the resources that the event needs. Events that don't share any resources can run at the same time.</summary>
+		/// <param name="resources">The vector to add the resources to.</param>
+		/// <returns>True if the event only needs the listed resources, false if it can't run alongside any other event.</returns>
+		virtual bool get_resources(std::vector<Resource>& resources) const;
 	};
 	
 	class Queue
@@ -370,20 +2023,174 @@ namespace Battle
 		{
 			Event* event;
 			int priority;
+
+			// The resources that the event needs.
+			std::vector<Event::Resource> resources;
+
+			// Whether the event can't run alongside any other event.
+			bool exclusive;
+
+			// Whether the event's script has run to the end.
+			bool finished;
 		};
 
 		std::list<EventPriority> m_Queue;
 
-		Event* m_Current = nullptr;
+		// The events that are currently running.
+		std::list<EventPriority> m_Running;
+
+		// The scheduler that runs the events' scripts.
+		Scheduler* m_Scheduler;
+
+		/// <summary>Runs an event's script, then marks the event as finished.</summary>
+		/// <param name="entry">The running event.</param>
+		/// <returns>The script, which the scheduler owns.</returns>
+		Script play(EventPriority& entry);
+
+		/// <summary>Starts every queued event that doesn't conflict with a running event or an earlier queued event.</summary>
+		void start_events();
 
 	public:
+		/// <summary>Constructs an empty queue.</summary>
+		/// <param name="scheduler">The scheduler to run the events on.</param>
+		Queue(Scheduler* scheduler);
+
 		void push(Event* event, int priority);
 
 		Event* pop();
 
+		/// <summary>Checks whether there are no events queued or running.</summary>
+		/// <returns>True if the queue is empty and no events are running.</returns>
+		bool empty() const;
+
+		/// <summary>Drops the events that have finished and starts the ones that can now run. The scheduler runs the events themselves.</summary>
 		void update();
 	};
 
+	// Flashes a unit's tile to show its health changing, in place of a damage number until the battle can draw text.
+	class HealthChangeEvent : public Event
+	{
+	protected:
+		// The units, and the unit whose health changed.
+		const UnitStore* m_Units;
+		Entity m_Unit;
+
+		// The change in health. Negative for damage.
+		int m_Change;
+
+		// The view to flash the tile in.
+		Visibility* m_Visibility;
+
+	public:
+		// The number of frames that the tile flashes for.
+		static const int FRAMES = 30;
+
+		HealthChangeEvent(const UnitStore* units, Entity unit, int change, Visibility* visibility);
+
+		Script run();
+
+		bool get_resources(std::vector<Resource>& resources) const;
+	};
+
+	// Removes a unit that has died, clearing it from its tile.
+	class DeathEvent : public Event
+	{
+	protected:
+		// The units, and the unit that died.
+		UnitStore* m_Units;
+		Entity m_Unit;
+
+		// The grid that the unit is on.
+		Grid* m_Grid;
+
+	public:
+		DeathEvent(UnitStore* units, Entity unit, Grid* grid);
+
+		int start();
+
+		bool get_resources(std::vector<Resource>& resources) const;
+	};
+
+
+
+	/*
+		SNAPSHOTS
+	*/
+
+	class Snapshot
+	{
+	protected:
+		friend class Grid;
+
+		// The ID of the tile set used by the grid.
+		std::string m_TileSet;
+
+		// The width and height of the grid.
+		int m_Width, m_Height;
+
+		// The IDs of each type of tile used by the grid.
+		std::vector<std::string> m_Types;
+
+		// The IDs of each object on the grid.
+		std::vector<std::string> m_Objects;
+
+		// The index of the type of each tile, or -1 if the tile has no type.
+		std::vector<int> m_TileTypes;
+
+		// The height of each tile.
+		std::vector<int> m_TileHeights;
+
+		// The index of the object on each tile, or -1 if there is none.
+		std::vector<int> m_TileObjects;
+
+		// The phase of battle.
+		bool m_Phase;
+
+	public:
+		// The version of the snapshot format that is written.
+		static const unsigned int VERSION = 1;
+
+		/// <summary>Constructs an empty snapshot.</summary>
+		Snapshot();
+
+		/// <summary>Captures the state of a battle.</summary>
+		/// <param name="grid">The battle grid.</param>
+		/// <param name="phase">The current phase of battle.</param>
+		Snapshot(const Grid& grid, bool phase);
+
+		/// <summary>Retrieves the phase of battle.</summary>
+		/// <returns>True if Player Phase, false if Enemy Phase.</returns>
+		bool get_phase() const;
+
+		/// <summary>Retrieves the ID of the tile set used by the grid.</summary>
+		/// <returns>The ID of the tile set.</returns>
+		const std::string& get_tile_set() const;
+
+		/// <summary>Encodes the snapshot in the binary format.</summary>
+		/// <param name="data">The buffer to append the encoded snapshot to.</param>
+		void encode(std::vector<unsigned char>& data) const;
+
+		/// <summary>Decodes a snapshot from the binary format.</summary>
+		/// <param name="data">The encoded snapshot.</param>
+		/// <returns>True if the snapshot was decoded, false if the data was malformed or from an unknown version.</returns>
+		bool decode(const std::vector<unsigned char>& data);
+
+		/// <summary>Writes the snapshot to a file.</summary>
+		/// <param name="path">The path to the file.</param>
+		/// <returns>True if the file was written.</returns>
+		bool save(std::string path) const;
+
+		/// <summary>Writes the snapshot to a file on a background thread. The snapshot is moved to the thread, so it is left empty.</summary>
+		/// <param name="path">The path to the file.</param>
+		/// <returns>A future that is true once the file has been written.</returns>
+		std::future<bool> save_async(std::string path) &&;
+
+		/// <summary>Reads the snapshot from a file.</summary>
+		/// <param name="path">The path to the file.</param>
+		/// <returns>True if the file was read and decoded.</returns>
+		bool load(std::string path);
+	};
+
 
 
 }
@@ -405,9 +2212,31 @@ protected:
 	// The grid for the battle.
 	Battle::Grid m_Grid;
 
+	// The units in the battle.
+	Battle::UnitStore m_Units;
+
+	// The tiles that enemy units can attack next phase, and the threat handle of each enemy unit.
+	Battle::ThreatMap m_Threats;
+	std::vector<std::pair<Battle::Entity, int>> m_ThreatHandles;
+
+	// The status effects on the units.
+	Battle::StatusEffects m_StatusEffects;
+
+	// The expected outcome of every unit attacking every other unit, for previews and the AI.
+	Battle::CombatTable m_Combat;
+
+	// The results of the last status effect tick, kept so that each phase change reuses the space.
+	std::vector<Battle::StatusResult> m_StatusResults;
+
 	// The queue for battle events and animations and whatever.
 	Battle::Queue m_Queue;
 
+	// Runs scripted battle events.
+	Battle::Scheduler m_Scripts;
+
+	// The events that the battle has pushed to the queue. The queue doesn't own them, so they are deleted once it has run dry.
+	std::vector<std::unique_ptr<Battle::Event>> m_Events;
+
 
 	// The thing that shows which tiles are targetable.
 	Graphic* m_Targetable;
@@ -416,6 +2245,27 @@ protected:
 	// The current phase of battle. True if Player Phase, false if Enemy Phase.
 	bool m_Phase;
 
+	// The save that is being written in the background, if any.
+	std::future<bool> m_Saving;
+
+	// The ID of the battle map, if the battle was started from one.
+	std::string m_Map;
+
+	// Watches the map files for changes, or nullptr if the battle wasn't started from a map.
+	std::unique_ptr<Battle::MapWatcher> m_Watcher;
+
+	// The minimap in the corner of the screen. Made once the grid has been built.
+	std::unique_ptr<Battle::Minimap> m_Minimap;
+
+	/// <summary>Applies any changes saved to the map or tile set files since the last update.</summary>
+	void hot_reload();
+
+	/// <summary>Brings the threat of every enemy unit up to date, and shows it on the threat highlight layer.</summary>
+	void update_threats();
+
+	/// <summary>Moves on to the other side's phase. Status effects on its units tick, and what they did is queued as events.</summary>
+	void end_phase();
+
 
 	/// <summary>Adjusts the transform in response to the bounds changing.</summary>
 	void __set_bounds();
@@ -432,6 +2282,27 @@ public:
 	/// <param name="map">The ID of the battle map.</param>
 	BattleState(std::string map);
 
+	/// <summary>Builds a battle from a map that has already been read, without loading any graphics, so that it can run off the render thread. finish_loading must be called before the state is used.</summary>
+	/// <param name="id">The ID of the battle map.</param>
+	/// <param name="map">The map.</param>
+	BattleState(std::string id, const Sim::Map& map);
+
+	/// <summary>Does the part of building the battle that needs the render thread: loads the graphics and starts taking input.</summary>
+	void finish_loading();
+
+	/// <summary>Resumes a battle from a snapshot.</summary>
+	/// <param name="snapshot">The snapshot of the battle.</param>
+	BattleState(const Battle::Snapshot& snapshot);
+
+	/// <summary>Starts picking up changes to a map's files while the battle runs. Only does anything in builds with HOT_RELOAD defined, which debug builds define by default.</summary>
+	/// <param name="map">The ID of the battle map.</param>
+	void watch(std::string map);
+
+	/// <summary>Saves the battle in the background.</summary>
+	/// <param name="path">The path to save the battle to.</param>
+	/// <returns>False if a previous save is still being written, true otherwise.</returns>
+	bool save(std::string path);
+
 	/// <summary>Prevents the state from registering updates and inputs.</summary>
 	void freeze();
 
@@ -441,4 +2312,30 @@ public:
 	/// <summary>Responds to a keyboard control being pressed.</summary>
 	/// <param name="event_data">The data for the event.</param>
 	int trigger(const KeyEvent& event_data);
-};
\ No newline at end of file
+};
+
+
+// Builds a battle on a worker thread, then loads its graphics on the main thread.
+class BattleLoader : public StateLoader
+{
+protected:
+	// The ID of the battle map.
+	std::string m_Map;
+
+	// The battle, built without its graphics, or nullptr if it couldn't be loaded.
+	BattleState* m_State;
+
+public:
+	/// <summary>Prepares to load a battle.</summary>
+	/// <param name="map">The ID of the battle map.</param>
+	BattleLoader(std::string map);
+
+	~BattleLoader();
+
+	/// <summary>Reads the map and builds the battle, including its grid, visible tiles and minimap.</summary>
+	void load();
+
+	/// <summary>Loads the graphics for the battle's tile set and objects.</summary>
+	/// <returns>The new battle state, or nullptr if the map couldn't be read.</returns>
+	State* finish();
+};
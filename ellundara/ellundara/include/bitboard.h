@@ -0,0 +1,128 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <bit>
+
+
+namespace Battle
+{
+
+	// A set of tiles on a grid, stored as one bit per tile.
+	class Bitboard
+	{
+	protected:
+		// The width of the grid.
+		int m_Width;
+
+		// The height of the grid.
+		int m_Height;
+
+		// The number of words in each row. Rows start on a word boundary, and unused bits at the end of a row are always 0.
+		int m_Stride;
+
+		// The bits, row by row. Padded with zeros to a multiple of four words, so that SIMD kernels never need a tail loop.
+		std::vector<uint64_t> m_Words;
+
+		/// <summary>Clears the unused bits at the end of each row.</summary>
+		void mask_rows();
+
+		/// <summary>Adds the tiles of another bitboard of the same size, moved by an offset. Tiles moved off the grid are lost.</summary>
+		/// <param name="other">The tiles to add. Must not be this bitboard.</param>
+		/// <param name="dx">The offset in the x-direction.</param>
+		/// <param name="dy">The offset in the y-direction.</param>
+		void or_shifted(const Bitboard& other, int dx, int dy);
+
+	public:
+		/// <summary>Constructs an empty 0x0 bitboard.</summary>
+		Bitboard();
+
+		/// <summary>Constructs a bitboard with no tiles set.</summary>
+		/// <param name="width">The width of the grid.</param>
+		/// <param name="height">The height of the grid.</param>
+		Bitboard(int width, int height);
+
+		int get_width() const;
+
+		int get_height() const;
+
+		/// <summary>Checks whether a tile is set.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <returns>True if the tile is in bounds and set.</returns>
+		bool get(int x, int y) const;
+
+		/// <summary>Sets or clears a tile. Does nothing if the tile is out of bounds.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <param name="value">True to set the tile, false to clear it.</param>
+		void set(int x, int y, bool value);
+
+		/// <summary>Clears every tile.</summary>
+		void clear();
+
+		/// <summary>Sets every tile.</summary>
+		void fill();
+
+		/// <summary>Keeps only the tiles that are also set in another bitboard of the same size.</summary>
+		Bitboard& operator&=(const Bitboard& other);
+
+		/// <summary>Adds the tiles that are set in another bitboard of the same size.</summary>
+		Bitboard& operator|=(const Bitboard& other);
+
+		/// <summary>Removes the tiles that are set in another bitboard of the same size.</summary>
+		/// <param name="other">The tiles to remove.</param>
+		/// <returns>This bitboard.</returns>
+		Bitboard& and_not(const Bitboard& other);
+
+		Bitboard operator&(const Bitboard& other) const;
+
+		Bitboard operator|(const Bitboard& other) const;
+
+		/// <summary>Moves every tile by an offset. Tiles moved off the grid are lost.</summary>
+		/// <param name="dx">The offset in the x-direction.</param>
+		/// <param name="dy">The offset in the y-direction.</param>
+		/// <returns>The shifted bitboard.</returns>
+		Bitboard shift(int dx, int dy) const;
+
+		/// <summary>Grows the set by a number of orthogonal steps.</summary>
+		/// <param name="steps">The number of steps.</param>
+		/// <returns>Every tile within that many steps of a set tile.</returns>
+		Bitboard dilate(int steps) const;
+
+		/// <summary>Grows the set by a number of orthogonal steps, only passing through tiles in a mask.</summary>
+		/// <param name="steps">The number of steps.</param>
+		/// <param name="mask">The tiles that can be stepped on.</param>
+		/// <returns>Every tile in the mask that can be reached within that many steps of a set tile.</returns>
+		Bitboard dilate(int steps, const Bitboard& mask) const;
+
+		/// <summary>Grows the set in place by a number of orthogonal steps. Doesn't allocate once the scratch bitboard has been used at this size.</summary>
+		/// <param name="steps">The number of steps.</param>
+		/// <param name="scratch">Space to work in. Its tiles are overwritten.</param>
+		void grow(int steps, Bitboard& scratch);
+
+		/// <summary>Counts the tiles that are set.</summary>
+		/// <returns>The number of set tiles.</returns>
+		int popcount() const;
+
+		/// <summary>Checks whether no tiles are set.</summary>
+		/// <returns>True if the bitboard is empty.</returns>
+		bool empty() const;
+
+		/// <summary>Calls a function for each set tile, skipping over empty words.</summary>
+		/// <param name="func">A function taking the x and y coordinates of the tile.</param>
+		template <typename F>
+		void for_each(F func) const
+		{
+			for (int j = 0; j < m_Height; ++j)
+			{
+				const uint64_t* row = m_Words.data() + (m_Stride * j);
+				for (int k = 0; k < m_Stride; ++k)
+				{
+					for (uint64_t word = row[k]; word; word &= word - 1)
+						func((k * 64) + std::countr_zero(word), j);
+				}
+			}
+		}
+	};
+
+}
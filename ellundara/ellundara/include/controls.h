@@ -26,3 +26,14 @@
 
 #define CONTROL_ROTATE_RIGHT			7
 #define CONTROL_ROTATE_RIGHT_DEFAULT	83
+
+
+#define CONTROL_ZOOM_IN					8
+#define CONTROL_ZOOM_IN_DEFAULT			81
+
+#define CONTROL_ZOOM_OUT				9
+#define CONTROL_ZOOM_OUT_DEFAULT		87
+
+
+#define CONTROL_END_PHASE				10
+#define CONTROL_END_PHASE_DEFAULT		69
@@ -0,0 +1,203 @@
+#pragma once
+#include <coroutine>
+#include <vector>
+
+
+namespace Battle
+{
+
+	class Scheduler;
+
+
+	// A scripted battle event, written as a coroutine.
+	// Scripts can co_await wait_frames(n), a Signal (such as the end of an animation), or another Script.
+	class Script
+	{
+	public:
+		struct promise_type
+		{
+			// The scheduler running the script.
+			Scheduler* scheduler = nullptr;
+
+			// The script waiting for this one to finish, if any.
+			std::coroutine_handle<> continuation;
+
+			Script get_return_object();
+
+			std::suspend_always initial_suspend() noexcept;
+
+			// Hands control back to the script waiting on this one, if any.
+			struct FinalAwaiter
+			{
+				bool await_ready() const noexcept;
+
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+
+				void await_resume() const noexcept;
+			};
+
+			FinalAwaiter final_suspend() noexcept;
+
+			void return_void();
+
+			void unhandled_exception();
+		};
+
+		// Starts a script from inside another script, resuming the caller once it finishes.
+		struct Awaiter
+		{
+			std::coroutine_handle<promise_type> handle;
+
+			bool await_ready() const;
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> caller);
+
+			void await_resume() const;
+		};
+
+	protected:
+		friend class Scheduler;
+
+		// The coroutine.
+		std::coroutine_handle<promise_type> m_Handle;
+
+	public:
+		Script(std::coroutine_handle<promise_type> handle);
+
+		Script(Script&& other) noexcept;
+
+		Script& operator=(Script&& other) noexcept;
+
+		Script(const Script&) = delete;
+
+		Script& operator=(const Script&) = delete;
+
+		~Script();
+
+		/// <summary>Checks whether the script has finished.</summary>
+		/// <returns>True if the script has run to the end.</returns>
+		bool done() const;
+
+		Awaiter operator co_await() &&;
+	};
+
+
+	// Suspends a script for a number of frames.
+	struct WaitFrames
+	{
+		// The number of frames to wait.
+		int frames;
+
+		bool await_ready() const;
+
+		void await_suspend(std::coroutine_handle<Script::promise_type> handle) const;
+
+		void await_resume() const;
+	};
+
+	/// <summary>Suspends a script for a number of frames.</summary>
+	/// <param name="frames">The number of frames to wait.</param>
+	/// <returns>An awaitable for the script to co_await.</returns>
+	WaitFrames wait_frames(int frames);
+
+
+	// Something that scripts can wait on, such as an animation finishing.
+	class Signal
+	{
+	protected:
+		// The scripts waiting on the signal.
+		std::vector<std::coroutine_handle<>> m_Waiters;
+
+		// Whether the signal has fired since it was last reset.
+		bool m_Fired = false;
+
+	public:
+		/// <summary>Fires the signal, resuming every script waiting on it.</summary>
+		void fire();
+
+		/// <summary>Resets the signal, so that scripts wait on it again.</summary>
+		void reset();
+
+		/// <summary>Checks whether the signal has fired.</summary>
+		/// <returns>True if the signal has fired since it was last reset.</returns>
+		bool fired() const;
+
+		bool await_ready() const;
+
+		void await_suspend(std::coroutine_handle<> handle);
+
+		void await_resume() const;
+	};
+
+
+	// Runs scripts, keeping sleeping scripts on a hierarchical timer wheel so that they cost nothing until they are due.
+	class Scheduler
+	{
+	protected:
+		// The number of bits of the time used by each level of the wheel.
+		static const int WHEEL_BITS = 6;
+
+		// The number of slots in each level of the wheel.
+		static const int WHEEL_SLOTS = 1 << WHEEL_BITS;
+
+		// The number of levels in the wheel. Scripts sleeping past the top level are moved back up when it turns over.
+		static const int WHEEL_LEVELS = 4;
+
+		// A sleeping script.
+		struct Timer
+		{
+			// The frame to wake up on.
+			long long due;
+
+			// The script to resume.
+			std::coroutine_handle<> handle;
+		};
+
+		// The slots of each level of the wheel.
+		std::vector<Timer> m_Wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+		// The number of scripts sleeping on the wheel.
+		int m_Sleeping;
+
+		// The current frame.
+		long long m_Frame;
+
+		// The scripts that have been started, which the scheduler owns.
+		std::vector<Script> m_Scripts;
+
+		// The scripts that are due to be resumed.
+		std::vector<std::coroutine_handle<>> m_Ready;
+
+		/// <summary>Puts a timer into the slot for when it is due.</summary>
+		/// <param name="timer">The timer.</param>
+		void insert(const Timer& timer);
+
+		/// <summary>Moves the wheel forward by one frame, collecting any scripts that are due.</summary>
+		void tick();
+
+	public:
+		Scheduler();
+
+		/// <summary>Starts running a script.</summary>
+		/// <param name="script">The script. The scheduler takes ownership of it.</param>
+		void start(Script&& script);
+
+		/// <summary>Puts a script to sleep.</summary>
+		/// <param name="handle">The script.</param>
+		/// <param name="frames">The number of frames to sleep for.</param>
+		void sleep(std::coroutine_handle<> handle, int frames);
+
+		/// <summary>Moves time forward, resuming any scripts that are due.</summary>
+		/// <param name="frames_passed">The number of frames that passed since the last update.</param>
+		void update(int frames_passed);
+
+		/// <summary>Checks whether every script has finished.</summary>
+		/// <returns>True if there are no scripts left running.</returns>
+		bool idle() const;
+
+		/// <summary>Retrieves the current frame.</summary>
+		/// <returns>The number of frames that have passed.</returns>
+		long long get_frame() const;
+	};
+
+}
@@ -0,0 +1,316 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <span>
+#include <unordered_map>
+#include <random>
+
+
+/*
+	The battle simulation core.
+
+	Everything in here is independent of Onion and owns all of its state, so that any number of simulations can be run at once
+	(e.g. one per core when running balancing sweeps).
+*/
+namespace Sim
+{
+
+	// A tile on a simulated grid.
+	struct Tile
+	{
+		// The index of the type of tile, in the map's list of tile types.
+		int type;
+
+		// The height of the tile.
+		int height;
+
+		// Whether the tile is blocked by an object that isn't a unit.
+		bool blocked;
+
+		// The index of the unit standing on the tile, or -1 if there is none.
+		int unit;
+	};
+
+	// The stats for a unit.
+	struct Unit
+	{
+		// The position of the unit.
+		int x, y;
+
+		// The faction that the unit belongs to. Faction 0 is the player.
+		int faction;
+
+		// The remaining health of the unit. The unit is dead if this is 0.
+		int hp;
+
+		// The damage that the unit does before defense is subtracted.
+		int attack;
+
+		// The damage that the unit ignores from each attack.
+		int defense;
+
+		// The number of tiles that the unit can move each phase.
+		int move;
+
+		// The largest height difference that the unit can climb in one step.
+		int climb;
+
+		// The chance out of 100 that an attack from the unit hits.
+		int accuracy;
+
+		// The chance out of 100 taken off attacks against the unit.
+		int evasion;
+	};
+
+
+	/*
+		The components of a unit, which the battle's unit store keeps in one array each.
+		They are declared here so that the simulation can read the same arrays as the battle.
+	*/
+
+	// The combat stats of a unit.
+	struct CombatStats
+	{
+		// The damage that the unit does before defense is subtracted.
+		int attack;
+
+		// The damage that the unit ignores from each attack.
+		int defense;
+
+		// The chance out of 100 that an attack from the unit hits, before evasion.
+		int accuracy;
+
+		// The chance out of 100 subtracted from attacks against the unit.
+		int evasion;
+	};
+
+	// The position of a unit on the grid.
+	struct UnitPosition
+	{
+		int x, y;
+	};
+
+	// How far a unit can move.
+	struct UnitMovement
+	{
+		// The number of tiles that the unit can move each phase.
+		int move;
+
+		// The largest height difference that the unit can climb in one step.
+		int climb;
+	};
+
+	// The state of a unit that changes over the battle.
+	struct UnitStatus
+	{
+		// The remaining health of the unit.
+		int hp;
+
+		// The maximum health of the unit.
+		int max_hp;
+
+		// Flags for conditions on the unit.
+		unsigned int flags;
+	};
+
+	// A read-only view of units stored as one array per component. Index k of each span belongs to the same unit.
+	struct UnitSpans
+	{
+		std::span<const UnitPosition> positions;
+		std::span<const CombatStats> stats;
+		std::span<const UnitMovement> movement;
+		std::span<const UnitStatus> status;
+		std::span<const int> factions;
+	};
+
+
+	class Map
+	{
+	protected:
+		// The names of each type of tile.
+		std::vector<std::string> m_Types;
+
+		// The array of tiles.
+		std::vector<Tile> m_Tiles;
+
+	public:
+		// The width of the map.
+		int width;
+
+		// The height of the map.
+		int height;
+
+		// The ID of the tile set used by the map.
+		std::string tileset;
+
+		// A rectangle of tiles, as listed in the map file.
+		struct Region
+		{
+			// The index of the type of the tiles.
+			int type;
+
+			// The position of the corner of the rectangle.
+			int x, y;
+
+			// The size of the rectangle.
+			int dx, dy;
+
+			// The height of the tiles.
+			int height;
+		};
+
+		// The rectangles of tiles, in the order they were listed. Later rectangles cover earlier ones.
+		std::vector<Region> regions;
+
+		// An object placed on the map.
+		struct Placement
+		{
+			// The ID of the object.
+			std::string id;
+
+			// The position of the object.
+			int x, y;
+		};
+
+		// The objects placed on the map, in the order they were listed. Objects off the map are left out.
+		std::vector<Placement> objects;
+
+		// The units placed on the map, in the order they were listed. Units off the map or on an object are left out.
+		std::vector<Unit> units;
+
+		/// <summary>Constructs an empty map.</summary>
+		Map();
+
+		/// <summary>Loads the map from a map file.</summary>
+		/// <param name="path">The path to the map file.</param>
+		/// <returns>True if the map was loaded, false if the file couldn't be read.</returns>
+		bool load(std::string path);
+
+		/// <summary>Retrieves the tile at the given coordinates.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <returns>A const pointer to the tile, or nullptr if the coordinates are out of bounds.</returns>
+		const Tile* get_tile(int x, int y) const;
+
+		/// <summary>Retrieves the name of a type of tile.</summary>
+		/// <param name="type">The index of the type of tile.</param>
+		/// <returns>The name of the type.</returns>
+		const std::string& get_type_name(int type) const;
+	};
+
+
+	// The extra damage for each level of height that an attacker is above its target.
+	const int HEIGHT_DAMAGE = 1;
+
+	// The extra chance to hit, out of 100, for each level of height that an attacker is above its target.
+	const int HEIGHT_ACCURACY = 5;
+
+	/// <summary>Works out the chance that an attack hits. Shared by the simulation and the battle's combat table.</summary>
+	/// <param name="accuracy">The attacker's accuracy, out of 100.</param>
+	/// <param name="evasion">The target's evasion, out of 100.</param>
+	/// <param name="height">How many levels the attacker is above the target. Negative if it is below.</param>
+	/// <returns>The chance to hit, from 0 to 100.</returns>
+	int get_hit_chance(int accuracy, int evasion, int height);
+
+	/// <summary>Works out the damage that a hit does. Shared by the simulation and the battle's combat table.</summary>
+	/// <param name="attack">The attacker's attack.</param>
+	/// <param name="defense">The target's defense.</param>
+	/// <param name="height">How many levels the attacker is above the target. Negative if it is below.</param>
+	/// <returns>The damage, which is always at least 1.</returns>
+	int get_damage(int attack, int defense, int height);
+
+
+	class Simulation
+	{
+	protected:
+		// The width of the grid.
+		int m_Width;
+
+		// The height of the grid.
+		int m_Height;
+
+		// The tiles of the grid. Copied from the map, so that the map can be shared between simulations.
+		std::vector<Tile> m_Tiles;
+
+		// The units in the battle.
+		std::vector<Unit> m_Units;
+
+		// The order that units act in during a phase.
+		std::vector<int> m_Queue;
+
+		// The faction whose phase it is.
+		int m_Phase;
+
+		// The number of phases that have passed.
+		int m_Turn;
+
+		// The random number generator.
+		std::mt19937 m_Random;
+
+
+		// Scratch space for searching the grid. The distance to each tile, or -1 if it hasn't been reached.
+		std::vector<int> m_Distance;
+
+		// Scratch space for searching the grid. The tiles that still need to be searched.
+		std::vector<int> m_Frontier;
+
+
+		/// <summary>Retrieves the tile at the given coordinates.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <returns>A pointer to the tile, or nullptr if the coordinates are out of bounds.</returns>
+		Tile* get_tile(int x, int y);
+
+		/// <summary>Finds the distance from a tile to the nearest enemy of a faction.</summary>
+		/// <param name="x">The x-coordinate of the tile.</param>
+		/// <param name="y">The y-coordinate of the tile.</param>
+		/// <param name="faction">The faction to find enemies of.</param>
+		/// <returns>The Manhattan distance to the nearest living enemy.</returns>
+		int enemy_distance(int x, int y, int faction) const;
+
+		/// <summary>Moves a unit towards the nearest enemy.</summary>
+		/// <param name="index">The index of the unit.</param>
+		void move_unit(int index);
+
+		/// <summary>Makes a unit attack an adjacent enemy, if there is one.</summary>
+		/// <param name="index">The index of the unit.</param>
+		void attack(int index);
+
+	public:
+		/// <summary>Sets up a simulation on a map.</summary>
+		/// <param name="map">The map to fight on.</param>
+		/// <param name="seed">The seed for the random number generator.</param>
+		Simulation(const Map& map, unsigned int seed);
+
+		/// <summary>Adds a unit to the battle.</summary>
+		/// <param name="unit">The stats of the unit. Its position must be on an open tile.</param>
+		/// <returns>The index of the unit, or -1 if its tile wasn't open.</returns>
+		int add_unit(const Unit& unit);
+
+		/// <summary>Adds every living unit from a set of component arrays, such as the battle's unit store.</summary>
+		/// <param name="units">The units.</param>
+		/// <returns>The number of units added.</returns>
+		int add_units(const UnitSpans& units);
+
+		/// <summary>Plays out a single phase of the battle.</summary>
+		void step();
+
+		/// <summary>Plays out the battle until one faction remains or the phase limit is hit.</summary>
+		/// <param name="max_turns">The maximum number of phases to play.</param>
+		/// <returns>The winning faction, or -1 if the battle didn't finish.</returns>
+		int run(int max_turns);
+
+		/// <summary>Finds the winner of the battle.</summary>
+		/// <returns>The only faction with living units, or -1 if there is more than one.</returns>
+		int get_winner() const;
+
+		/// <summary>Retrieves the number of phases that have been played.</summary>
+		/// <returns>The number of phases played.</returns>
+		int get_turn() const;
+
+		/// <summary>Retrieves the units in the battle.</summary>
+		/// <returns>The units, indexed in the order they were added.</returns>
+		const std::vector<Unit>& get_units() const;
+	};
+
+}
@@ -1,4 +1,6 @@
 #pragma once
+#include <atomic>
+#include <string>
 #include <onion.h>
 
 // A state that the game can be in.
@@ -11,3 +13,42 @@ State* get_state();
 /// <summary>Sets the global state.</summary>
 /// <param name="state">The new global state.</param>
 void set_state(State* state);
+
+
+// Builds a state in two steps, so that the slow part can run while the current state keeps going.
+class StateLoader
+{
+protected:
+	// How much of the loading has been done, from 0 to 1.
+	std::atomic<float> m_Progress{ 0.f };
+
+	// Why the state couldn't be loaded, or empty if it loaded.
+	std::string m_Error;
+
+public:
+	virtual ~StateLoader() {}
+
+	/// <summary>Does the loading that doesn't need the render thread, such as reading files. Runs on a worker thread.</summary>
+	virtual void load() = 0;
+
+	/// <summary>Builds the state from what was loaded, doing only the work that needs the render thread.</summary>
+	/// <returns>The new state, or nullptr if loading failed.</returns>
+	virtual State* finish() = 0;
+
+	/// <summary>Retrieves how much of the loading has been done.</summary>
+	/// <returns>The progress, from 0 to 1.</returns>
+	float get_progress() const;
+
+	/// <summary>Retrieves why the state couldn't be loaded. Only read once loading has finished.</summary>
+	/// <returns>The reason, or an empty string if the state loaded.</returns>
+	const std::string& get_error() const;
+};
+
+/// <summary>Starts loading the next global state on a worker thread. The current state keeps running until it is ready.</summary>
+/// <param name="loader">The loader for the next state. Takes ownership of the loader.</param>
+/// <returns>False if another state is already being loaded, true otherwise.</returns>
+bool preload_state(StateLoader* loader);
+
+/// <summary>Retrieves how far along the next global state is.</summary>
+/// <returns>The progress, from 0 to 1, or -1 if no state is being loaded.</returns>
+float get_preload_progress();
@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <bit>
+#include "../../include/bitboard.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BITBOARD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BITBOARD_SSE2
+#endif
+
+using namespace std;
+using namespace Battle;
+
+
+/*
+	KERNELS
+
+	Each kernel works on a whole number of 4-word blocks, which the bitboard guarantees by padding its words.
+*/
+
+static void kernel_and(uint64_t* dst, const uint64_t* src, size_t words)
+{
+#if defined(BITBOARD_AVX2)
+	for (size_t k = 0; k < words; k += 4)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(dst + k));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + k));
+		_mm256_storeu_si256((__m256i*)(dst + k), _mm256_and_si256(a, b));
+	}
+#elif defined(BITBOARD_SSE2)
+	for (size_t k = 0; k < words; k += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(dst + k));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + k));
+		_mm_storeu_si128((__m128i*)(dst + k), _mm_and_si128(a, b));
+	}
+#else
+	for (size_t k = 0; k < words; ++k)
+		dst[k] &= src[k];
+#endif
+}
+
+static void kernel_or(uint64_t* dst, const uint64_t* src, size_t words)
+{
+#if defined(BITBOARD_AVX2)
+	for (size_t k = 0; k < words; k += 4)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(dst + k));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + k));
+		_mm256_storeu_si256((__m256i*)(dst + k), _mm256_or_si256(a, b));
+	}
+#elif defined(BITBOARD_SSE2)
+	for (size_t k = 0; k < words; k += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(dst + k));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + k));
+		_mm_storeu_si128((__m128i*)(dst + k), _mm_or_si128(a, b));
+	}
+#else
+	for (size_t k = 0; k < words; ++k)
+		dst[k] |= src[k];
+#endif
+}
+
+static void kernel_and_not(uint64_t* dst, const uint64_t* src, size_t words)
+{
+#if defined(BITBOARD_AVX2)
+	for (size_t k = 0; k < words; k += 4)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(dst + k));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(src + k));
+		_mm256_storeu_si256((__m256i*)(dst + k), _mm256_andnot_si256(b, a));
+	}
+#elif defined(BITBOARD_SSE2)
+	for (size_t k = 0; k < words; k += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(dst + k));
+		__m128i b = _mm_loadu_si128((const __m128i*)(src + k));
+		_mm_storeu_si128((__m128i*)(dst + k), _mm_andnot_si128(b, a));
+	}
+#else
+	for (size_t k = 0; k < words; ++k)
+		dst[k] &= ~src[k];
+#endif
+}
+
+static int kernel_popcount(const uint64_t* src, size_t words)
+{
+	// Four independent counters, so the popcnt instructions don't wait on each other
+	int c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+	for (size_t k = 0; k < words; k += 4)
+	{
+		c0 += popcount(src[k]);
+		c1 += popcount(src[k + 1]);
+		c2 += popcount(src[k + 2]);
+		c3 += popcount(src[k + 3]);
+	}
+	return c0 + c1 + c2 + c3;
+}
+
+
+
+Bitboard::Bitboard() : Bitboard(0, 0) {}
+
+Bitboard::Bitboard(int width, int height)
+{
+	m_Width = width;
+	m_Height = height;
+	m_Stride = (width + 63) / 64;
+	m_Words.assign(((m_Stride * height) + 3) & ~3, 0);
+}
+
+int Bitboard::get_width() const
+{
+	return m_Width;
+}
+
+int Bitboard::get_height() const
+{
+	return m_Height;
+}
+
+void Bitboard::mask_rows()
+{
+	if (m_Width % 64 == 0)
+		return;
+
+	uint64_t mask = (1ull << (m_Width % 64)) - 1;
+	for (int j = 0; j < m_Height; ++j)
+		m_Words[(m_Stride * (j + 1)) - 1] &= mask;
+}
+
+bool Bitboard::get(int x, int y) const
+{
+	if (x < 0 || x >= m_Width || y < 0 || y >= m_Height)
+		return false;
+	return (m_Words[(m_Stride * y) + (x / 64)] >> (x % 64)) & 1;
+}
+
+void Bitboard::set(int x, int y, bool value)
+{
+	if (x < 0 || x >= m_Width || y < 0 || y >= m_Height)
+		return;
+
+	uint64_t& word = m_Words[(m_Stride * y) + (x / 64)];
+	if (value)	word |= 1ull << (x % 64);
+	else		word &= ~(1ull << (x % 64));
+}
+
+void Bitboard::clear()
+{
+	std::fill(m_Words.begin(), m_Words.end(), 0);
+}
+
+void Bitboard::fill()
+{
+	std::fill(m_Words.begin(), m_Words.begin() + (m_Stride * m_Height), ~0ull);
+	mask_rows();
+}
+
+Bitboard& Bitboard::operator&=(const Bitboard& other)
+{
+	kernel_and(m_Words.data(), other.m_Words.data(), m_Words.size());
+	return *this;
+}
+
+Bitboard& Bitboard::operator|=(const Bitboard& other)
+{
+	kernel_or(m_Words.data(), other.m_Words.data(), m_Words.size());
+	return *this;
+}
+
+Bitboard& Bitboard::and_not(const Bitboard& other)
+{
+	kernel_and_not(m_Words.data(), other.m_Words.data(), m_Words.size());
+	return *this;
+}
+
+Bitboard Bitboard::operator&(const Bitboard& other) const
+{
+	Bitboard b = *this;
+	b &= other;
+	return b;
+}
+
+Bitboard Bitboard::operator|(const Bitboard& other) const
+{
+	Bitboard b = *this;
+	b |= other;
+	return b;
+}
+
+void Bitboard::or_shifted(const Bitboard& other, int dx, int dy)
+{
+	if (abs(dx) >= m_Width || abs(dy) >= m_Height)
+		return;
+
+	int q = abs(dx) / 64;
+	int r = abs(dx) % 64;
+
+	for (int j = max(0, dy); j < min(m_Height, m_Height + dy); ++j)
+	{
+		const uint64_t* src = other.m_Words.data() + (m_Stride * (j - dy));
+		uint64_t* dst = m_Words.data() + (m_Stride * j);
+
+		for (int k = 0; k < m_Stride; ++k)
+		{
+			uint64_t word = 0;
+			if (dx >= 0)
+			{
+				// Bits move towards the end of the row
+				if (k - q >= 0)				word = src[k - q] << r;
+				if (r && k - q - 1 >= 0)	word |= src[k - q - 1] >> (64 - r);
+			}
+			else
+			{
+				// Bits move towards the start of the row
+				if (k + q < m_Stride)			word = src[k + q] >> r;
+				if (r && k + q + 1 < m_Stride)	word |= src[k + q + 1] << (64 - r);
+			}
+			dst[k] |= word;
+		}
+	}
+
+	mask_rows();
+}
+
+Bitboard Bitboard::shift(int dx, int dy) const
+{
+	Bitboard b(m_Width, m_Height);
+	b.or_shifted(*this, dx, dy);
+	return b;
+}
+
+void Bitboard::grow(int steps, Bitboard& scratch)
+{
+	for (int s = 0; s < steps; ++s)
+	{
+		// Copying into a bitboard of the same size reuses its words
+		scratch = *this;
+		or_shifted(scratch, 1, 0);
+		or_shifted(scratch, -1, 0);
+		or_shifted(scratch, 0, 1);
+		or_shifted(scratch, 0, -1);
+	}
+}
+
+Bitboard Bitboard::dilate(int steps) const
+{
+	Bitboard b = *this;
+	Bitboard scratch;
+	b.grow(steps, scratch);
+	return b;
+}
+
+Bitboard Bitboard::dilate(int steps, const Bitboard& mask) const
+{
+	Bitboard b = *this;
+	b &= mask;
+
+	Bitboard scratch;
+	for (int s = 0; s < steps; ++s)
+	{
+		b.grow(1, scratch);
+		b &= mask;
+	}
+	return b;
+}
+
+int Bitboard::popcount() const
+{
+	return kernel_popcount(m_Words.data(), m_Words.size());
+}
+
+bool Bitboard::empty() const
+{
+	return all_of(m_Words.begin(), m_Words.end(), [](uint64_t w) { return w == 0; });
+}
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include "../../include/battle.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define COMBAT_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COMBAT_SSE
+#endif
+
+using namespace std;
+using namespace Battle;
+
+
+CombatTable::CombatTable()
+{
+	m_Count = 0;
+	m_Stride = 0;
+}
+
+void CombatTable::clear()
+{
+	m_Attack.clear();
+	m_Defense.clear();
+	m_Accuracy.clear();
+	m_Evasion.clear();
+	m_Height.clear();
+	m_Count = 0;
+}
+
+int CombatTable::add(const CombatStats& stats, const Tile* tile)
+{
+	// Terrain makes the unit harder to hit and harder to hurt
+	int defense = stats.defense + (tile->terrain ? tile->terrain->get_defense() : 0);
+	int evasion = stats.evasion + (tile->terrain ? tile->terrain->get_evasion() : 0);
+
+	m_Attack.push_back((float)stats.attack);
+	m_Defense.push_back((float)defense);
+	m_Accuracy.push_back((float)stats.accuracy);
+	m_Evasion.push_back((float)evasion);
+	m_Height.push_back((float)tile->height);
+	return m_Count++;
+}
+
+void CombatTable::load(const Sim::UnitSpans& units, const Grid& grid)
+{
+	clear();
+	for (size_t k = 0; k < units.positions.size(); ++k)
+		add(units.stats[k], grid.get_tile(units.positions[k].x, units.positions[k].y));
+}
+
+void CombatTable::compute()
+{
+	// Only reallocate when the number of units has changed since the last compute
+	int stride = (m_Count + 7) & ~7;
+	if (stride != m_Stride || m_HitChance.size() != (size_t)m_Count * stride)
+	{
+		m_Stride = stride;
+		m_PaddedDefense.assign(m_Stride, 0.f);
+		m_PaddedEvasion.assign(m_Stride, 0.f);
+		m_PaddedHeight.assign(m_Stride, 0.f);
+		m_HitChance.resize((size_t)m_Count * m_Stride);
+		m_Damage.resize((size_t)m_Count * m_Stride);
+	}
+
+	// Pad the target-side arrays, so each row can be processed 8 at a time
+	copy(m_Defense.begin(), m_Defense.end(), m_PaddedDefense.begin());
+	copy(m_Evasion.begin(), m_Evasion.end(), m_PaddedEvasion.begin());
+	copy(m_Height.begin(), m_Height.end(), m_PaddedHeight.begin());
+	const float* defense = m_PaddedDefense.data();
+	const float* evasion = m_PaddedEvasion.data();
+	const float* height = m_PaddedHeight.data();
+
+	// The vector paths follow Sim::get_hit_chance and Sim::get_damage, lane by lane
+	const float height_damage = (float)HEIGHT_DAMAGE;
+	const float height_accuracy = (float)HEIGHT_ACCURACY;
+
+	for (int a = 0; a < m_Count; ++a)
+	{
+		float* hit_row = m_HitChance.data() + ((size_t)a * m_Stride);
+		float* dmg_row = m_Damage.data() + ((size_t)a * m_Stride);
+		int t = 0;
+
+#if defined(COMBAT_AVX)
+		__m256 atk = _mm256_set1_ps(m_Attack[a]);
+		__m256 acc = _mm256_set1_ps(m_Accuracy[a]);
+		__m256 ah = _mm256_set1_ps(m_Height[a]);
+		__m256 zero = _mm256_setzero_ps();
+		__m256 one = _mm256_set1_ps(1.f);
+		__m256 hundred = _mm256_set1_ps(100.f);
+		__m256 percent = _mm256_set1_ps(0.01f);
+		__m256 hd = _mm256_set1_ps(height_damage);
+		__m256 ha = _mm256_set1_ps(height_accuracy);
+
+		for (; t < m_Stride; t += 8)
+		{
+			// Height difference, positive when the attacker is above
+			__m256 dh = _mm256_sub_ps(ah, _mm256_loadu_ps(height + t));
+
+			__m256 hit = _mm256_sub_ps(acc, _mm256_loadu_ps(evasion + t));
+			hit = _mm256_add_ps(hit, _mm256_mul_ps(dh, ha));
+			hit = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(hit, zero), hundred), percent);
+
+			__m256 dmg = _mm256_sub_ps(atk, _mm256_loadu_ps(defense + t));
+			dmg = _mm256_add_ps(dmg, _mm256_mul_ps(_mm256_max_ps(dh, zero), hd));
+			dmg = _mm256_max_ps(dmg, one);
+
+			_mm256_storeu_ps(hit_row + t, hit);
+			_mm256_storeu_ps(dmg_row + t, _mm256_mul_ps(hit, dmg));
+		}
+#elif defined(COMBAT_SSE)
+		__m128 atk = _mm_set1_ps(m_Attack[a]);
+		__m128 acc = _mm_set1_ps(m_Accuracy[a]);
+		__m128 ah = _mm_set1_ps(m_Height[a]);
+		__m128 zero = _mm_setzero_ps();
+		__m128 one = _mm_set1_ps(1.f);
+		__m128 hundred = _mm_set1_ps(100.f);
+		__m128 percent = _mm_set1_ps(0.01f);
+		__m128 hd = _mm_set1_ps(height_damage);
+		__m128 ha = _mm_set1_ps(height_accuracy);
+
+		for (; t < m_Stride; t += 4)
+		{
+			__m128 dh = _mm_sub_ps(ah, _mm_loadu_ps(height + t));
+
+			__m128 hit = _mm_sub_ps(acc, _mm_loadu_ps(evasion + t));
+			hit = _mm_add_ps(hit, _mm_mul_ps(dh, ha));
+			hit = _mm_mul_ps(_mm_min_ps(_mm_max_ps(hit, zero), hundred), percent);
+
+			__m128 dmg = _mm_sub_ps(atk, _mm_loadu_ps(defense + t));
+			dmg = _mm_add_ps(dmg, _mm_mul_ps(_mm_max_ps(dh, zero), hd));
+			dmg = _mm_max_ps(dmg, one);
+
+			_mm_storeu_ps(hit_row + t, hit);
+			_mm_storeu_ps(dmg_row + t, _mm_mul_ps(hit, dmg));
+		}
+#endif
+
+		// The stats are whole numbers, so the rest can use the simulation's rules directly
+		for (; t < m_Stride; ++t)
+		{
+			int dh = (int)(m_Height[a] - height[t]);
+
+			float hit = Sim::get_hit_chance((int)m_Accuracy[a], (int)evasion[t], dh) * 0.01f;
+			float dmg = (float)Sim::get_damage((int)m_Attack[a], (int)defense[t], dh);
+
+			hit_row[t] = hit;
+			dmg_row[t] = hit * dmg;
+		}
+
+		// A unit can't attack itself
+		hit_row[a] = 0.f;
+		dmg_row[a] = 0.f;
+	}
+}
+
+float CombatTable::get_hit_chance(int attacker, int target) const
+{
+	return m_HitChance[((size_t)attacker * m_Stride) + target];
+}
+
+float CombatTable::get_expected_damage(int attacker, int target) const
+{
+	return m_Damage[((size_t)attacker * m_Stride) + target];
+}
+
+const float* CombatTable::get_damage_row(int attacker) const
+{
+	return m_Damage.data() + ((size_t)attacker * m_Stride);
+}
@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include "../../include/battle.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+using namespace std;
+using namespace Battle;
+
+
+Fog::Fog(const Grid* grid, int factions)
+{
+	m_Grid = grid;
+	m_Words = ((grid->width * grid->height) + 63) / 64;
+
+	m_Counts.assign(factions, vector<uint16_t>(grid->width * grid->height, 0));
+	m_Visible.assign(factions, vector<uint64_t>(m_Words, 0));
+
+	m_ChunkVersions.resize(grid->get_chunk_columns() * grid->get_chunk_rows());
+	for (int cy = 0; cy < grid->get_chunk_rows(); ++cy)
+		for (int cx = 0; cx < grid->get_chunk_columns(); ++cx)
+			m_ChunkVersions[cx + (grid->get_chunk_columns() * cy)] = grid->get_chunk_version(cx, cy);
+}
+
+bool Fog::line_of_sight(int x1, int y1, int eye, int x2, int y2) const
+{
+	int dx = abs(x2 - x1);
+	int dy = abs(y2 - y1);
+	int sx = x1 < x2 ? 1 : -1;
+	int sy = y1 < y2 ? 1 : -1;
+	int steps = max(dx, dy);
+	if (steps <= 1)
+		return true;
+
+	float target = (float)m_Grid->get_tile(x2, y2)->height;
+
+	// Walk the line between the tiles, checking if any tile in between pokes above it
+	int err = dx - dy;
+	int x = x1, y = y1;
+	for (int k = 1; k < steps; ++k)
+	{
+		int e2 = 2 * err;
+		if (e2 > -dy) { err -= dy; x += sx; }
+		if (e2 < dx) { err += dx; y += sy; }
+
+		float t = (float)max(abs(x - x1), abs(y - y1)) / steps;
+		float line = eye + ((target - eye) * t);
+		if (m_Grid->get_tile(x, y)->height > line)
+			return false;
+	}
+
+	return true;
+}
+
+void Fog::apply(const Viewer& viewer, bool add)
+{
+	vector<uint16_t>& counts = m_Counts[viewer.faction];
+	vector<uint64_t>& visible = m_Visible[viewer.faction];
+
+	for (int k = 0; k < (int)viewer.bits.size(); ++k)
+	{
+		// Skip over the parts of the box that can't be seen
+		for (uint64_t word = viewer.bits[k]; word; word &= word - 1)
+		{
+			int b = (k * 64) + countr_zero(word);
+			int c = GRID_COORDINATE(viewer.x0 + (b % viewer.w), viewer.y0 + (b / viewer.w), m_Grid->width);
+
+			if (add)
+			{
+				if (counts[c]++ == 0)
+					visible[c / 64] |= 1ull << (c % 64);
+			}
+			else
+			{
+				if (--counts[c] == 0)
+					visible[c / 64] &= ~(1ull << (c % 64));
+			}
+		}
+	}
+}
+
+void Fog::evaluate(Viewer& viewer)
+{
+	// Take away what the viewer could see before
+	apply(viewer, false);
+	viewer.dirty = false;
+
+	// A viewer off the grid sees nothing, and would give the box a negative size
+	if (viewer.x < 0 || viewer.x >= m_Grid->width || viewer.y < 0 || viewer.y >= m_Grid->height)
+	{
+		viewer.w = 0;
+		viewer.h = 0;
+		viewer.bits.clear();
+		return;
+	}
+
+	viewer.x0 = max(0, viewer.x - viewer.range);
+	viewer.y0 = max(0, viewer.y - viewer.range);
+	viewer.w = min(m_Grid->width - 1, viewer.x + viewer.range) - viewer.x0 + 1;
+	viewer.h = min(m_Grid->height - 1, viewer.y + viewer.range) - viewer.y0 + 1;
+	viewer.bits.assign(((viewer.w * viewer.h) + 63) / 64, 0);
+
+	int eye = m_Grid->get_tile(viewer.x, viewer.y)->height + viewer.eye;
+
+	for (int j = 0; j < viewer.h; ++j)
+	{
+		for (int i = 0; i < viewer.w; ++i)
+		{
+			int x = viewer.x0 + i;
+			int y = viewer.y0 + j;
+			int dx = x - viewer.x;
+			int dy = y - viewer.y;
+
+			if ((dx * dx) + (dy * dy) <= viewer.range * viewer.range && line_of_sight(viewer.x, viewer.y, eye, x, y))
+			{
+				int b = i + (viewer.w * j);
+				viewer.bits[b / 64] |= 1ull << (b % 64);
+			}
+		}
+	}
+
+	apply(viewer, true);
+}
+
+int Fog::add_viewer(int faction, int x, int y, int range, int eye)
+{
+	// Reuse the handle of a removed viewer, if there is one
+	int handle = 0;
+	while (handle < (int)m_Viewers.size() && m_Viewers[handle].faction >= 0)
+		++handle;
+	if (handle == (int)m_Viewers.size())
+		m_Viewers.push_back(Viewer());
+
+	Viewer& viewer = m_Viewers[handle];
+	viewer.faction = faction;
+	viewer.x = x;
+	viewer.y = y;
+	viewer.range = range;
+	viewer.eye = eye;
+	viewer.w = 0;
+	viewer.h = 0;
+	viewer.bits.clear();
+
+	evaluate(viewer);
+	return handle;
+}
+
+void Fog::move_viewer(int viewer, int x, int y)
+{
+	Viewer& v = m_Viewers[viewer];
+	if (v.x == x && v.y == y)
+		return;
+
+	v.x = x;
+	v.y = y;
+	evaluate(v);
+}
+
+void Fog::remove_viewer(int viewer)
+{
+	Viewer& v = m_Viewers[viewer];
+	apply(v, false);
+	v.bits.clear();
+	v.faction = -1;
+}
+
+void Fog::update_tile(int x, int y)
+{
+	// Only viewers whose box contains the tile can have their sight changed by it
+	for (Viewer& viewer : m_Viewers)
+	{
+		if (viewer.faction >= 0 && x >= viewer.x0 && x < viewer.x0 + viewer.w && y >= viewer.y0 && y < viewer.y0 + viewer.h)
+			evaluate(viewer);
+	}
+}
+
+void Fog::update()
+{
+	int columns = m_Grid->get_chunk_columns();
+	int rows = m_Grid->get_chunk_rows();
+
+	// Changing a tile's height changes its chunk's version, so only viewers whose box overlaps a changed chunk are looked at again
+	for (int cy = 0; cy < rows; ++cy)
+	{
+		for (int cx = 0; cx < columns; ++cx)
+		{
+			unsigned int& version = m_ChunkVersions[cx + (columns * cy)];
+			if (version == m_Grid->get_chunk_version(cx, cy))
+				continue;
+			version = m_Grid->get_chunk_version(cx, cy);
+
+			int x0 = cx * GRID_CHUNK_SIZE;
+			int y0 = cy * GRID_CHUNK_SIZE;
+			for (Viewer& viewer : m_Viewers)
+			{
+				if (viewer.faction >= 0 && viewer.x0 < x0 + GRID_CHUNK_SIZE && viewer.x0 + viewer.w > x0 && viewer.y0 < y0 + GRID_CHUNK_SIZE && viewer.y0 + viewer.h > y0)
+					viewer.dirty = true;
+			}
+		}
+	}
+
+	for (Viewer& viewer : m_Viewers)
+		if (viewer.faction >= 0 && viewer.dirty)
+			evaluate(viewer);
+}
+
+bool Fog::is_visible(int faction, int x, int y) const
+{
+	if (x < 0 || x >= m_Grid->width || y < 0 || y >= m_Grid->height)
+		return false;
+
+	int c = GRID_COORDINATE(x, y, m_Grid->width);
+	return (m_Visible[faction][c / 64] >> (c % 64)) & 1;
+}
+
+const vector<uint64_t>& Fog::get_visible(int faction) const
+{
+	return m_Visible[faction];
+}
@@ -0,0 +1,94 @@
+#include "../../include/battle.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+using namespace std;
+using namespace Battle;
+
+
+GridFork::GridFork(Grid* grid) : width(grid->width), height(grid->height)
+{
+	m_Grid = grid;
+	m_Parent = nullptr;
+}
+
+GridFork::GridFork(GridFork* parent) : width(parent->width), height(parent->height)
+{
+	m_Grid = parent->m_Grid;
+	m_Parent = parent;
+}
+
+const Tile* GridFork::get_tile(int x, int y) const
+{
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return nullptr;
+
+	// Look for the newest copy of the tile, walking back towards the grid
+	int k = GRID_COORDINATE(x, y, width);
+	for (const GridFork* fork = this; fork; fork = fork->m_Parent)
+	{
+		auto iter = fork->m_Overlay.find(k);
+		if (iter != fork->m_Overlay.end())
+			return &iter->second;
+	}
+
+	return m_Grid->get_tile(x, y);
+}
+
+Tile* GridFork::edit_tile(int x, int y)
+{
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return nullptr;
+
+	int k = GRID_COORDINATE(x, y, width);
+	auto iter = m_Overlay.find(k);
+	if (iter != m_Overlay.end())
+		return &iter->second;
+
+	return &m_Overlay.emplace(k, *get_tile(x, y)).first->second;
+}
+
+bool GridFork::move_object(int x1, int y1, int x2, int y2)
+{
+	const Tile* from = get_tile(x1, y1);
+	const Tile* to = get_tile(x2, y2);
+	if (!from || !to)
+		return false;
+
+	if (x1 == x2 && y1 == y2)
+		return true;
+
+	if (to->obj)
+		return false;
+
+	Object* obj = from->obj;
+	edit_tile(x1, y1)->obj = nullptr;
+	edit_tile(x2, y2)->obj = obj;
+	return true;
+}
+
+int GridFork::get_change_count() const
+{
+	return (int)m_Overlay.size();
+}
+
+void GridFork::commit()
+{
+	for (auto& iter : m_Overlay)
+	{
+		int x = iter.first % width;
+		int y = iter.first / width;
+
+		if (m_Parent)
+			*m_Parent->edit_tile(x, y) = iter.second;
+		else
+			m_Grid->set_tile(x, y, iter.second);
+	}
+
+	m_Overlay.clear();
+}
+
+void GridFork::rollback()
+{
+	m_Overlay.clear();
+}
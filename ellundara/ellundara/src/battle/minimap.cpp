@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include "../../include/battle.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+// Packs a color into a pixel, with red in the lowest byte.
+#define MINIMAP_RGBA(r, g, b, a) ((uint32_t)(r) | ((uint32_t)(g) << 8) | ((uint32_t)(b) << 16) | ((uint32_t)(a) << 24))
+
+// The color of a pixel with an object on it.
+#define MINIMAP_OBJECT MINIMAP_RGBA(160, 32, 32, 255)
+
+// The color of a pixel with a unit on it.
+#define MINIMAP_UNIT MINIMAP_RGBA(255, 255, 255, 255)
+
+// How much brighter each step of height makes a tile.
+#define MINIMAP_HEIGHT_STEP 12
+
+// The most runs that the image is drawn as, each of which is a separate draw call.
+#define MINIMAP_MAX_RUNS 2048
+
+using namespace std;
+using namespace Battle;
+
+
+unordered_map<uint32_t, Graphic*> Minimap::m_Swatches{};
+
+Minimap::Minimap(const Grid* grid, int size)
+{
+	m_Grid = grid;
+
+	// Shrink the grid until it fits, a whole number of tiles per pixel
+	int longest = max(grid->width, grid->height);
+	m_Scale = max(1, (longest + size - 1) / max(1, size));
+	m_Width = (grid->width + m_Scale - 1) / m_Scale;
+	m_Height = (grid->height + m_Scale - 1) / m_Scale;
+
+	m_Pixels.assign(m_Width * m_Height, 0);
+	m_Versions.assign(grid->get_chunk_columns() * grid->get_chunk_rows(), 0);
+	m_Built = false;
+	m_Fog = nullptr;
+	m_FogFaction = 0;
+
+	load_colors();
+}
+
+void Minimap::load_colors()
+{
+	// Give each type of tile its own color, the same every time the map is loaded
+	m_Colors.clear();
+	if (const TileSet* set = m_Grid->get_tile_set())
+	{
+		for (const auto& type : set->get_tile_types())
+		{
+			size_t h = hash<string>()(type.first);
+			m_Colors[type.second] = MINIMAP_RGBA(64 + (h & 0x7F), 64 + ((h >> 8) & 0x7F), 64 + ((h >> 16) & 0x7F), 255);
+		}
+	}
+
+	m_Built = false;
+}
+
+uint32_t Minimap::get_color(const Tile* tile) const
+{
+	if (!tile || !tile->type)
+		return 0;
+
+	auto iter = m_Colors.find(tile->type);
+	uint32_t color = iter != m_Colors.end() ? iter->second : MINIMAP_RGBA(128, 128, 128, 255);
+
+	// Higher tiles are drawn brighter
+	int shade = max(-64, min(64, tile->height * MINIMAP_HEIGHT_STEP));
+	int r = max(0, min(255, (int)(color & 0xFF) + shade));
+	int g = max(0, min(255, (int)((color >> 8) & 0xFF) + shade));
+	int b = max(0, min(255, (int)((color >> 16) & 0xFF) + shade));
+	return MINIMAP_RGBA(r, g, b, 255);
+}
+
+bool Minimap::draw_pixel(int px, int py)
+{
+	int x0 = px * m_Scale;
+	int y0 = py * m_Scale;
+	int x1 = min(x0 + m_Scale, m_Grid->width);
+	int y1 = min(y0 + m_Scale, m_Grid->height);
+
+	const Tile* top = nullptr;
+	bool object = false, unit = false, seen = false;
+	for (int j = y0; j < y1 && !unit; ++j)
+	{
+		for (int i = x0; i < x1; ++i)
+		{
+			// Units and objects hidden in the fog aren't shown
+			const Tile* tile = m_Grid->get_tile(i, j);
+			bool visible = !m_Fog || m_Fog->is_visible(m_FogFaction, i, j);
+			seen |= visible;
+			if (visible && !tile->unit.is_null())
+			{
+				unit = true;
+				break;
+			}
+			if (!tile->type)
+				continue;
+			if (visible && tile->obj)
+				object = true;
+			if (!top || tile->height > top->height)
+				top = tile;
+		}
+	}
+
+	uint32_t color = unit ? MINIMAP_UNIT : (object ? MINIMAP_OBJECT : get_color(top));
+
+	// Pixels that the faction can't see any of are drawn at half brightness
+	if (!seen && color)
+		color = ((color >> 1) & MINIMAP_RGBA(0x7F, 0x7F, 0x7F, 0)) | MINIMAP_RGBA(0, 0, 0, 255);
+	uint32_t& pixel = m_Pixels[GRID_COORDINATE(px, py, m_Width)];
+	if (pixel == color)
+		return false;
+
+	pixel = color;
+	return true;
+}
+
+void Minimap::set_fog(const Fog* fog, int faction)
+{
+	m_Fog = fog;
+	m_FogFaction = faction;
+	m_Seen.clear();
+	m_Built = false;
+}
+
+bool Minimap::update_fog()
+{
+	if (!m_Fog)
+		return false;
+
+	const vector<uint64_t>& visible = m_Fog->get_visible(m_FogFaction);
+	if (m_Seen.size() != visible.size())
+	{
+		// Every pixel was just drawn against the current fog
+		m_Seen = visible;
+		return false;
+	}
+
+	bool changed = false;
+	for (int w = 0; w < (int)visible.size(); ++w)
+	{
+		// Only look at the tiles whose bits changed
+		for (uint64_t bits = visible[w] ^ m_Seen[w]; bits; bits &= bits - 1)
+		{
+			int k = (w * 64) + countr_zero(bits);
+			changed |= draw_pixel((k % m_Grid->width) / m_Scale, (k / m_Grid->width) / m_Scale);
+		}
+		m_Seen[w] = visible[w];
+	}
+	return changed;
+}
+
+bool Minimap::update()
+{
+	// Pixels drawn by the chunks below already use the current fog
+	bool full = !m_Built;
+
+	int columns = m_Grid->get_chunk_columns();
+	int rows = m_Grid->get_chunk_rows();
+
+	bool changed = false;
+	for (int cy = 0; cy < rows; ++cy)
+	{
+		for (int cx = 0; cx < columns; ++cx)
+		{
+			unsigned int version = m_Grid->get_chunk_version(cx, cy);
+			unsigned int& drawn = m_Versions[GRID_COORDINATE(cx, cy, columns)];
+			if (m_Built && drawn == version)
+				continue;
+			drawn = version;
+
+			// Redraw the pixels that cover any tile of the chunk
+			int px0 = (cx * GRID_CHUNK_SIZE) / m_Scale;
+			int py0 = (cy * GRID_CHUNK_SIZE) / m_Scale;
+			int px1 = (min((cx + 1) * GRID_CHUNK_SIZE, m_Grid->width) - 1) / m_Scale;
+			int py1 = (min((cy + 1) * GRID_CHUNK_SIZE, m_Grid->height) - 1) / m_Scale;
+
+			for (int py = py0; py <= py1; ++py)
+				for (int px = px0; px <= px1; ++px)
+					changed |= draw_pixel(px, py);
+		}
+	}
+
+	m_Built = true;
+	if (full)
+		m_Seen.clear();
+	return update_fog() || changed;
+}
+
+uint32_t Minimap::get_block_color(int x0, int y0, int step) const
+{
+	int x1 = min(x0 + step, m_Width);
+	int y1 = min(y0 + step, m_Height);
+
+	uint32_t color = 0;
+	bool object = false;
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			uint32_t pixel = m_Pixels[GRID_COORDINATE(x, y, m_Width)];
+			if (pixel == MINIMAP_UNIT)
+				return pixel;
+			if (pixel == MINIMAP_OBJECT)
+				object = true;
+			else if (!color)
+				color = pixel;
+		}
+	}
+	return object ? MINIMAP_OBJECT : color;
+}
+
+void Minimap::build_runs(int step)
+{
+	m_Runs.clear();
+	for (int y = 0; y < m_Height; y += step)
+	{
+		int rows = min(step, m_Height - y);
+		for (int x = 0; x < m_Width;)
+		{
+			uint32_t color = get_block_color(x, y, step);
+			int length = step;
+			while (x + length < m_Width && get_block_color(x + length, y, step) == color)
+				length += step;
+			length = min(length, m_Width - x);
+
+			// Empty pixels aren't drawn at all
+			if (color)
+			{
+				Graphic*& swatch = m_Swatches[color];
+				if (!swatch)
+					swatch = SolidColorGraphic::generate(color & 0xFF, (color >> 8) & 0xFF, (color >> 16) & 0xFF, (color >> 24) & 0xFF, 1, 1);
+				m_Runs.push_back({ x, y, length, rows, swatch });
+			}
+
+			x += length;
+		}
+	}
+}
+
+void Minimap::upload()
+{
+	// Each halving at least quarters the number of squares, so this stops by the time the whole image is one square
+	int step = 1;
+	build_runs(step);
+	while ((int)m_Runs.size() > MINIMAP_MAX_RUNS)
+	{
+		step *= 2;
+		build_runs(step);
+	}
+}
+
+void Minimap::display(float pixel_size) const
+{
+	for (const PixelRun& run : m_Runs)
+	{
+		mat_push();
+		mat_translate(run.x * pixel_size, run.y * pixel_size, 0.f);
+		mat_scale(run.length * pixel_size, run.rows * pixel_size, 1.f);
+		run.swatch->display();
+		mat_pop();
+	}
+}
+
+int Minimap::get_width() const
+{
+	return m_Width;
+}
+
+int Minimap::get_height() const
+{
+	return m_Height;
+}
+
+span<const uint32_t> Minimap::get_pixels() const
+{
+	return m_Pixels;
+}
+
+uint32_t Minimap::get_pixel(int x, int y) const
+{
+	if (x < 0 || x >= m_Width || y < 0 || y >= m_Height)
+		return 0;
+	return m_Pixels[GRID_COORDINATE(x, y, m_Width)];
+}
@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <queue>
+#include <thread>
+#include "../../include/battle.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+// The coordinate of a tile inside its cluster.
+#define LOCAL_COORDINATE(x, y) GRID_COORDINATE((x) % GRID_CHUNK_SIZE, (y) % GRID_CHUNK_SIZE, GRID_CHUNK_SIZE)
+
+// Border openings at least this long get an entrance at each end instead of one in the middle.
+#define PATH_WIDE_ENTRANCE 6
+
+// The number of paths to keep before the cache is emptied.
+#define PATH_CACHE_SIZE 1024
+
+using namespace std;
+using namespace Battle;
+
+
+Pathfinder::Pathfinder(const Grid* grid, int climb)
+{
+	m_Grid = grid;
+	m_Climb = climb;
+	m_Columns = grid->get_chunk_columns();
+	m_Rows = grid->get_chunk_rows();
+	m_Versions.assign(m_Columns * m_Rows, 0);
+	m_Built = false;
+	m_Borders[0].assign(m_Columns * m_Rows, {});
+	m_Borders[1].assign(m_Columns * m_Rows, {});
+}
+
+int Pathfinder::get_cluster(int x, int y) const
+{
+	return GRID_COORDINATE(x / GRID_CHUNK_SIZE, y / GRID_CHUNK_SIZE, m_Columns);
+}
+
+bool Pathfinder::can_step(int x, int y, int nx, int ny) const
+{
+	if (nx < 0 || nx >= m_Grid->width || ny < 0 || ny >= m_Grid->height)
+		return false;
+	if (!m_Grid->get_passable().get(nx, ny) || m_Grid->get_occupied().get(nx, ny))
+		return false;
+	return abs(m_Grid->get_tile(nx, ny)->height - m_Grid->get_tile(x, y)->height) <= m_Climb;
+}
+
+void Pathfinder::flood(int x, int y, int* distance, int* parent) const
+{
+	int x0 = x - (x % GRID_CHUNK_SIZE);
+	int y0 = y - (y % GRID_CHUNK_SIZE);
+	int x1 = min(x0 + GRID_CHUNK_SIZE, m_Grid->width);
+	int y1 = min(y0 + GRID_CHUNK_SIZE, m_Grid->height);
+
+	fill(distance, distance + (GRID_CHUNK_SIZE * GRID_CHUNK_SIZE), -1);
+
+	int frontier[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+	int count = 0;
+
+	distance[LOCAL_COORDINATE(x, y)] = 0;
+	frontier[count++] = LOCAL_COORDINATE(x, y);
+
+	const int dx[4] = { 1, -1, 0, 0 };
+	const int dy[4] = { 0, 0, 1, -1 };
+
+	for (int k = 0; k < count; ++k)
+	{
+		int c = frontier[k];
+		int cx = x0 + (c % GRID_CHUNK_SIZE);
+		int cy = y0 + (c / GRID_CHUNK_SIZE);
+
+		for (int n = 0; n < 4; ++n)
+		{
+			int nx = cx + dx[n];
+			int ny = cy + dy[n];
+			if (nx < x0 || nx >= x1 || ny < y0 || ny >= y1)
+				continue;
+
+			int nc = LOCAL_COORDINATE(nx, ny);
+			if (distance[nc] >= 0 || !can_step(cx, cy, nx, ny))
+				continue;
+
+			distance[nc] = distance[c] + 1;
+			if (parent)
+				parent[nc] = c;
+			frontier[count++] = nc;
+		}
+	}
+}
+
+int Pathfinder::add_node(int x, int y, int cluster)
+{
+	int id;
+	if (!m_FreeNodes.empty())
+	{
+		id = m_FreeNodes.back();
+		m_FreeNodes.pop_back();
+	}
+	else
+	{
+		id = (int)m_Nodes.size();
+		m_Nodes.push_back(Node());
+	}
+
+	Node& node = m_Nodes[id];
+	node.x = x;
+	node.y = y;
+	node.cluster = cluster;
+	node.partner = -1;
+	node.edges.clear();
+	return id;
+}
+
+void Pathfinder::build_border(int cluster, int side)
+{
+	// Remove the old entrances on both sides of the border
+	vector<int>& border = m_Borders[side][cluster];
+	for (int id : border)
+	{
+		m_FreeNodes.push_back(m_Nodes[id].partner);
+		m_FreeNodes.push_back(id);
+	}
+	border.clear();
+
+	int cx = cluster % m_Columns;
+	int cy = cluster / m_Columns;
+	if ((side == 0 && cx == m_Columns - 1) || (side == 1 && cy == m_Rows - 1))
+		return;
+
+	int other = side == 0 ? cluster + 1 : cluster + m_Columns;
+
+	// Walk along the border; (x, y) is on this side and the step across is (sx, sy)
+	int sx = side == 0 ? 1 : 0;
+	int sy = side == 0 ? 0 : 1;
+	int x = side == 0 ? ((cx + 1) * GRID_CHUNK_SIZE) - 1 : cx * GRID_CHUNK_SIZE;
+	int y = side == 0 ? cy * GRID_CHUNK_SIZE : ((cy + 1) * GRID_CHUNK_SIZE) - 1;
+	int length = side == 0 ? min(GRID_CHUNK_SIZE, m_Grid->height - y) : min(GRID_CHUNK_SIZE, m_Grid->width - x);
+
+	auto add_entrance = [&](int k) {
+		int ax = x + (sy * k);
+		int ay = y + (sx * k);
+		int a = add_node(ax, ay, cluster);
+		int b = add_node(ax + sx, ay + sy, other);
+		m_Nodes[a].partner = b;
+		m_Nodes[b].partner = a;
+		border.push_back(a);
+	};
+
+	// Each run of tiles that can be crossed becomes one or two entrances. A run also ends where it can't be walked
+	// along on both sides, so that every crossing in a run is connected to its entrances
+	int start = -1;
+	for (int k = 0; k <= length; ++k)
+	{
+		int ax = x + (sy * k);
+		int ay = y + (sx * k);
+		bool open = k < length && can_step(ax, ay, ax + sx, ay + sy) && can_step(ax + sx, ay + sy, ax, ay);
+		bool joined = open && start >= 0 &&
+			can_step(ax - sy, ay - sx, ax, ay) && can_step(ax, ay, ax - sy, ay - sx) &&
+			can_step(ax - sy + sx, ay - sx + sy, ax + sx, ay + sy) && can_step(ax + sx, ay + sy, ax - sy + sx, ay - sx + sy);
+
+		if (start >= 0 && !joined)
+		{
+			if (k - start >= PATH_WIDE_ENTRANCE)
+			{
+				add_entrance(start);
+				add_entrance(k - 1);
+			}
+			else
+			{
+				add_entrance((start + k - 1) / 2);
+			}
+			start = -1;
+		}
+
+		if (open && start < 0)
+			start = k;
+	}
+}
+
+void Pathfinder::get_cluster_nodes(int cluster, vector<int>& nodes) const
+{
+	nodes.insert(nodes.end(), m_Borders[0][cluster].begin(), m_Borders[0][cluster].end());
+	nodes.insert(nodes.end(), m_Borders[1][cluster].begin(), m_Borders[1][cluster].end());
+
+	// The entrances from the clusters to the left and above are stored with those clusters
+	if (cluster % m_Columns > 0)
+		for (int id : m_Borders[0][cluster - 1])
+			nodes.push_back(m_Nodes[id].partner);
+	if (cluster >= m_Columns)
+		for (int id : m_Borders[1][cluster - m_Columns])
+			nodes.push_back(m_Nodes[id].partner);
+}
+
+void Pathfinder::build_edges(int cluster)
+{
+	vector<int> nodes;
+	get_cluster_nodes(cluster, nodes);
+
+	int distance[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+	for (int id : nodes)
+	{
+		Node& node = m_Nodes[id];
+		node.edges.clear();
+		flood(node.x, node.y, distance, nullptr);
+
+		for (int other : nodes)
+		{
+			int d = distance[LOCAL_COORDINATE(m_Nodes[other].x, m_Nodes[other].y)];
+			if (other != id && d >= 0)
+				node.edges.push_back({ other, d });
+		}
+	}
+}
+
+void Pathfinder::update()
+{
+	int count = m_Columns * m_Rows;
+
+	vector<bool> dirty(count, false);
+	bool any = false;
+	for (int c = 0; c < count; ++c)
+	{
+		unsigned int version = m_Grid->get_chunk_version(c % m_Columns, c / m_Columns);
+		if (!m_Built || m_Versions[c] != version)
+		{
+			dirty[c] = true;
+			m_Versions[c] = version;
+			any = true;
+		}
+	}
+	m_Built = true;
+
+	if (!any)
+		return;
+
+	// Rebuild every border of a changed cluster, then the edges of every cluster on either side of those borders
+	vector<bool> affected(count, false);
+	for (int c = 0; c < count; ++c)
+	{
+		if (!dirty[c])
+			continue;
+
+		affected[c] = true;
+		build_border(c, 0);
+		build_border(c, 1);
+
+		if (c % m_Columns < m_Columns - 1)	affected[c + 1] = true;
+		if (c + m_Columns < count)			affected[c + m_Columns] = true;
+
+		if (c % m_Columns > 0)
+		{
+			affected[c - 1] = true;
+			if (!dirty[c - 1])
+				build_border(c - 1, 0);
+		}
+		if (c >= m_Columns)
+		{
+			affected[c - m_Columns] = true;
+			if (!dirty[c - m_Columns])
+				build_border(c - m_Columns, 1);
+		}
+	}
+
+	for (int c = 0; c < count; ++c)
+		if (affected[c])
+			build_edges(c);
+
+	// Forget the paths that went through anything that was rebuilt
+	lock_guard<mutex> lock(m_CacheMutex);
+	for (auto iter = m_Cache.begin(); iter != m_Cache.end();)
+	{
+		const vector<int>& clusters = iter->second.clusters;
+		if (any_of(clusters.begin(), clusters.end(), [&](int c) { return affected[c]; }))
+			iter = m_Cache.erase(iter);
+		else
+			++iter;
+	}
+}
+
+bool Pathfinder::refine(int sx, int sy, int tx, int ty, vector<UnitPosition>& path) const
+{
+	if (sx == tx && sy == ty)
+		return true;
+
+	int distance[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+	int parent[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+	flood(sx, sy, distance, parent);
+
+	int c = LOCAL_COORDINATE(tx, ty);
+	if (distance[c] < 0)
+		return false;
+
+	// Walk back from the target, then add the steps in order
+	int x0 = sx - (sx % GRID_CHUNK_SIZE);
+	int y0 = sy - (sy % GRID_CHUNK_SIZE);
+	size_t first = path.size();
+	for (int k = distance[c]; k > 0; --k)
+	{
+		path.push_back({ x0 + (c % GRID_CHUNK_SIZE), y0 + (c / GRID_CHUNK_SIZE) });
+		c = parent[c];
+	}
+	reverse(path.begin() + first, path.end());
+	return true;
+}
+
+bool Pathfinder::search(const PathQuery& query, vector<UnitPosition>& path)
+{
+	path.clear();
+
+	if (query.sx < 0 || query.sx >= m_Grid->width || query.sy < 0 || query.sy >= m_Grid->height)
+		return false;
+	if (query.tx < 0 || query.tx >= m_Grid->width || query.ty < 0 || query.ty >= m_Grid->height)
+		return false;
+	if (query.sx == query.tx && query.sy == query.ty)
+		return true;
+	if (!m_Grid->get_passable().get(query.tx, query.ty) || m_Grid->get_occupied().get(query.tx, query.ty))
+		return false;
+
+	uint64_t key = ((uint64_t)GRID_COORDINATE(query.sx, query.sy, m_Grid->width) << 32) | (uint32_t)GRID_COORDINATE(query.tx, query.ty, m_Grid->width);
+	{
+		lock_guard<mutex> lock(m_CacheMutex);
+		auto iter = m_Cache.find(key);
+		if (iter != m_Cache.end())
+		{
+			path = iter->second.path;
+			return true;
+		}
+	}
+
+	int sc = get_cluster(query.sx, query.sy);
+	int tc = get_cluster(query.tx, query.ty);
+
+	// Paths that stay inside one cluster don't need the cluster graph
+	bool found = sc == tc && refine(query.sx, query.sy, query.tx, query.ty, path);
+
+	if (!found)
+	{
+		// Connect the start and target to the entrances of their clusters
+		vector<int> start_nodes;
+		get_cluster_nodes(sc, start_nodes);
+
+		int start_distance[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+		int target_distance[GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+		flood(query.sx, query.sy, start_distance, nullptr);
+		flood(query.tx, query.ty, target_distance, nullptr);
+
+		// The start is usually the mover's own tile, which counts as occupied, so no entrance is built on it when it
+		// lies on a border. Each step from the start into a neighboring cluster becomes a crossing of its own instead
+		const int dx[4] = { 1, -1, 0, 0 };
+		const int dy[4] = { 0, 0, 1, -1 };
+		UnitPosition crossings[4];
+		int crossing_distance[4][GRID_CHUNK_SIZE * GRID_CHUNK_SIZE];
+		int crossing_count = 0;
+		for (int k = 0; k < 4; ++k)
+		{
+			int nx = query.sx + dx[k];
+			int ny = query.sy + dy[k];
+			if (!can_step(query.sx, query.sy, nx, ny) || get_cluster(nx, ny) == sc)
+				continue;
+
+			crossings[crossing_count] = { nx, ny };
+			flood(nx, ny, crossing_distance[crossing_count], nullptr);
+			++crossing_count;
+		}
+
+		// A* over the entrances, with the start, target and crossings as extra nodes
+		int n = (int)m_Nodes.size();
+		int start = n, target = n + 1, first_crossing = n + 2;
+		vector<int> cost(n + 2 + crossing_count, INT_MAX);
+		vector<int> previous(n + 2 + crossing_count, -1);
+		vector<bool> closed(n + 2 + crossing_count, false);
+
+		auto estimate = [&](int id) {
+			if (id >= first_crossing)
+				return abs(crossings[id - first_crossing].x - query.tx) + abs(crossings[id - first_crossing].y - query.ty);
+			if (id >= n)
+				return id == target ? 0 : abs(query.sx - query.tx) + abs(query.sy - query.ty);
+			return abs(m_Nodes[id].x - query.tx) + abs(m_Nodes[id].y - query.ty);
+		};
+
+		priority_queue<pair<int, int>, vector<pair<int, int>>, greater<pair<int, int>>> open;
+		auto relax = [&](int from, int to, int steps) {
+			if (cost[from] + steps < cost[to])
+			{
+				cost[to] = cost[from] + steps;
+				previous[to] = from;
+				open.push({ cost[to] + estimate(to), to });
+			}
+		};
+
+		cost[start] = 0;
+		open.push({ estimate(start), start });
+
+		while (!open.empty())
+		{
+			int id = open.top().second;
+			open.pop();
+
+			if (closed[id])
+				continue;
+			closed[id] = true;
+
+			if (id == target)
+				break;
+
+			if (id == start)
+			{
+				for (int other : start_nodes)
+				{
+					int d = start_distance[LOCAL_COORDINATE(m_Nodes[other].x, m_Nodes[other].y)];
+					if (d >= 0)
+						relax(id, other, d);
+				}
+				for (int k = 0; k < crossing_count; ++k)
+					relax(id, first_crossing + k, 1);
+				continue;
+			}
+
+			if (id >= first_crossing)
+			{
+				// A crossing joins the entrances of the cluster it steps into, and the target if it is in that cluster
+				const UnitPosition& crossing = crossings[id - first_crossing];
+				const int* distance = crossing_distance[id - first_crossing];
+				int cluster = get_cluster(crossing.x, crossing.y);
+
+				vector<int> nodes;
+				get_cluster_nodes(cluster, nodes);
+				for (int other : nodes)
+				{
+					int d = distance[LOCAL_COORDINATE(m_Nodes[other].x, m_Nodes[other].y)];
+					if (d >= 0)
+						relax(id, other, d);
+				}
+				if (cluster == tc)
+				{
+					int d = distance[LOCAL_COORDINATE(query.tx, query.ty)];
+					if (d >= 0)
+						relax(id, target, d);
+				}
+				continue;
+			}
+
+			const Node& node = m_Nodes[id];
+			for (const pair<int, int>& edge : node.edges)
+				relax(id, edge.first, edge.second);
+			relax(id, node.partner, 1);
+
+			if (node.cluster == tc)
+			{
+				int d = target_distance[LOCAL_COORDINATE(node.x, node.y)];
+				if (d >= 0)
+					relax(id, target, d);
+			}
+		}
+
+		if (!closed[target])
+			return false;
+
+		// Fill in the steps between each pair of entrances along the way
+		vector<UnitPosition> waypoints;
+		for (int id = target; id != -1; id = previous[id])
+		{
+			if (id == target)				waypoints.push_back({ query.tx, query.ty });
+			else if (id == start)			waypoints.push_back({ query.sx, query.sy });
+			else if (id >= first_crossing)	waypoints.push_back(crossings[id - first_crossing]);
+			else							waypoints.push_back({ m_Nodes[id].x, m_Nodes[id].y });
+		}
+		reverse(waypoints.begin(), waypoints.end());
+
+		for (size_t k = 1; k < waypoints.size(); ++k)
+		{
+			const UnitPosition& a = waypoints[k - 1];
+			const UnitPosition& b = waypoints[k];
+
+			if (get_cluster(a.x, a.y) != get_cluster(b.x, b.y))
+				path.push_back(b);
+			else
+				refine(a.x, a.y, b.x, b.y, path);
+		}
+	}
+
+	// Remember the path, along with the clusters it depends on
+	CachedPath cached;
+	cached.path = path;
+	cached.clusters.push_back(sc);
+	for (const UnitPosition& step : path)
+		cached.clusters.push_back(get_cluster(step.x, step.y));
+	sort(cached.clusters.begin(), cached.clusters.end());
+	cached.clusters.erase(unique(cached.clusters.begin(), cached.clusters.end()), cached.clusters.end());
+
+	lock_guard<mutex> lock(m_CacheMutex);
+	if (m_Cache.size() >= PATH_CACHE_SIZE)
+		m_Cache.clear();
+	m_Cache[key] = move(cached);
+	return true;
+}
+
+bool Pathfinder::find_path(const PathQuery& query, vector<UnitPosition>& path)
+{
+	update();
+	return search(query, path);
+}
+
+int Pathfinder::find_paths(span<const PathQuery> queries, vector<vector<UnitPosition>>& paths)
+{
+	update();
+
+	paths.assign(queries.size(), {});
+	if (queries.empty())
+		return 0;
+
+	// Queries only read the clusters, so they can all run at once
+	atomic<int> next(0), found(0);
+	auto work = [&]() {
+		int k;
+		while ((k = next++) < (int)queries.size())
+			if (search(queries[k], paths[k]))
+				++found;
+	};
+
+	int count = min((int)queries.size(), max(1, (int)thread::hardware_concurrency()));
+	vector<thread> workers;
+	for (int t = 1; t < count; ++t)
+		workers.emplace_back(work);
+	work();
+	for (thread& w : workers)
+		w.join();
+
+	return found;
+}
@@ -0,0 +1,113 @@
+#include "../../include/battle.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace Battle;
+
+
+MapWatcher::MapWatcher(string map, string tileset)
+{
+	m_Map = map;
+	m_Handle = -1;
+	m_MapWatch = -1;
+	m_TileWatch = -1;
+	m_SheetWatch = -1;
+
+	check_time("res/maps/" + m_Map + ".txt", m_MapTime);
+
+#ifdef __linux__
+	// Watch the folders rather than the files, since editors often save by replacing the file
+	m_Handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_Handle >= 0)
+	{
+		m_MapWatch = inotify_add_watch(m_Handle, "res/maps", IN_CLOSE_WRITE | IN_MOVED_TO);
+		m_TileWatch = inotify_add_watch(m_Handle, "res/img/tiles", IN_CLOSE_WRITE | IN_MOVED_TO);
+		if (m_MapWatch < 0 || m_TileWatch < 0)
+		{
+			close(m_Handle);
+			m_Handle = -1;
+			m_MapWatch = -1;
+			m_TileWatch = -1;
+		}
+	}
+#endif
+
+	set_tile_set(tileset);
+}
+
+MapWatcher::~MapWatcher()
+{
+#ifdef __linux__
+	if (m_Handle >= 0)
+		close(m_Handle);
+#endif
+}
+
+bool MapWatcher::check_time(const string& path, filesystem::file_time_type& time)
+{
+	error_code error;
+	filesystem::file_time_type current = filesystem::last_write_time(path, error);
+	if (error || current == time)
+		return false;
+
+	time = current;
+	return true;
+}
+
+void MapWatcher::set_tile_set(string tileset)
+{
+	m_TileSet = tileset;
+	m_SheetPath = "res/img/" + ResourceCache::get_sheet_path("tiles/" + m_TileSet + ".png");
+	check_time("res/img/tiles/" + m_TileSet + ".meta", m_TileTime);
+	check_time(m_SheetPath, m_SheetTime);
+
+#ifdef __linux__
+	// A packed sheet's atlas page is outside the tiles folder. Watching the same folder twice gives back the same watch
+	if (m_Handle >= 0)
+		m_SheetWatch = inotify_add_watch(m_Handle, filesystem::path(m_SheetPath).parent_path().c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+#endif
+}
+
+void MapWatcher::poll(bool& map_changed, bool& tiles_changed)
+{
+	map_changed = false;
+	tiles_changed = false;
+
+#ifdef __linux__
+	if (m_Handle >= 0)
+	{
+		string map = m_Map + ".txt";
+		string meta = m_TileSet + ".meta";
+		string sheet = filesystem::path(m_SheetPath).filename().string();
+
+		alignas(inotify_event) char buffer[4096];
+		ssize_t length;
+		while ((length = read(m_Handle, buffer, sizeof(buffer))) > 0)
+		{
+			for (char* p = buffer; p < buffer + length;)
+			{
+				const inotify_event* event = (const inotify_event*)p;
+				// Only count a file in the folder it belongs in, not one with the same name in the other folder
+				if (event->len)
+				{
+					if (event->wd == m_MapWatch && map == event->name)			map_changed = true;
+					if (event->wd == m_TileWatch && meta == event->name)		tiles_changed = true;
+					if (event->wd == m_SheetWatch && sheet == event->name)		tiles_changed = true;
+				}
+				p += sizeof(inotify_event) + event->len;
+			}
+		}
+		return;
+	}
+#endif
+
+	map_changed = check_time("res/maps/" + m_Map + ".txt", m_MapTime);
+	// Both times are checked, so that neither change is picked up again on the next poll
+	bool meta_changed = check_time("res/img/tiles/" + m_TileSet + ".meta", m_TileTime);
+	bool sheet_changed = check_time(m_SheetPath, m_SheetTime);
+	tiles_changed = meta_changed || sheet_changed;
+}
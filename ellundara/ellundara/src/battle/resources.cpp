@@ -0,0 +1,91 @@
+#include "../../include/battle.h"
+
+using namespace std;
+using namespace Battle;
+
+
+unordered_map<string, SpriteSheet*> ResourceCache::m_SpriteSheets{};
+
+unordered_map<string, string> ResourceCache::m_Atlases{};
+
+bool ResourceCache::m_AtlasesLoaded{ false };
+
+map<array<float, 12>, Palette*> ResourceCache::m_Palettes{};
+
+void ResourceCache::load_atlases()
+{
+	if (m_AtlasesLoaded)
+		return;
+
+	// Written by the atlas tool. Without it, every sheet is loaded on its own
+	m_AtlasesLoaded = true;
+	if (!filesystem::exists("res/img/atlas.txt"))
+		return;
+
+	LoadFile file("res/img/atlas.txt");
+	while (file.good())
+	{
+		unordered_map<string, string> data;
+		string line = file.load_data(data);
+		if (!line.empty() && data.count("atlas"))
+			m_Atlases.emplace(line, data["atlas"]);
+	}
+}
+
+string ResourceCache::get_sheet_path(string path)
+{
+	load_atlases();
+
+	auto atlas = m_Atlases.find(path);
+	return atlas != m_Atlases.end() ? atlas->second : path;
+}
+
+SpriteSheet* ResourceCache::get_sprite_sheet(string path)
+{
+	path = get_sheet_path(path);
+
+	auto iter = m_SpriteSheets.find(path);
+	if (iter != m_SpriteSheets.end())
+		return iter->second;
+
+	SpriteSheet* sheet = SpriteSheet::generate(path.c_str());
+	m_SpriteSheets.emplace(path, sheet);
+	return sheet;
+}
+
+SpriteSheet* ResourceCache::reload_sprite_sheet(string path)
+{
+	// A packed sheet is drawn from its atlas page, so the page is what gets generated again
+	path = get_sheet_path(path);
+
+	SpriteSheet* sheet = SpriteSheet::generate(path.c_str());
+	SpriteSheet*& cached = m_SpriteSheets[path];
+	delete cached;
+	cached = sheet;
+	return sheet;
+}
+
+Palette* ResourceCache::get_palette(const vec4f& red, const vec4f& green, const vec4f& blue)
+{
+	array<float, 12> key;
+	for (int k = 0; k < 4; ++k)
+	{
+		key[k] = red.get(k);
+		key[k + 4] = green.get(k);
+		key[k + 8] = blue.get(k);
+	}
+
+	auto iter = m_Palettes.find(key);
+	if (iter != m_Palettes.end())
+		return iter->second;
+
+	Palette* palette = new SinglePalette(red, green, blue);
+	m_Palettes.emplace(key, palette);
+	return palette;
+}
+
+Palette* ResourceCache::get_default_palette()
+{
+	static Palette* palette = get_palette(vec4f(1.f, 0.f, 0.f, 0.f), vec4f(0.f, 1.f, 0.f, 0.f), vec4f(0.f, 0.f, 1.f, 0.f));
+	return palette;
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <exception>
+#include "../../include/script.h"
+
+using namespace std;
+using namespace Battle;
+
+
+Script Script::promise_type::get_return_object()
+{
+	return Script(coroutine_handle<promise_type>::from_promise(*this));
+}
+
+suspend_always Script::promise_type::initial_suspend() noexcept
+{
+	return {};
+}
+
+bool Script::promise_type::FinalAwaiter::await_ready() const noexcept
+{
+	return false;
+}
+
+coroutine_handle<> Script::promise_type::FinalAwaiter::await_suspend(coroutine_handle<promise_type> handle) noexcept
+{
+	if (handle.promise().continuation)
+		return handle.promise().continuation;
+	return noop_coroutine();
+}
+
+void Script::promise_type::FinalAwaiter::await_resume() const noexcept {}
+
+Script::promise_type::FinalAwaiter Script::promise_type::final_suspend() noexcept
+{
+	return {};
+}
+
+void Script::promise_type::return_void() {}
+
+void Script::promise_type::unhandled_exception()
+{
+	terminate();
+}
+
+
+bool Script::Awaiter::await_ready() const
+{
+	return !handle || handle.done();
+}
+
+coroutine_handle<> Script::Awaiter::await_suspend(coroutine_handle<promise_type> caller)
+{
+	// The child runs on the same scheduler, and resumes the caller when it finishes
+	handle.promise().scheduler = caller.promise().scheduler;
+	handle.promise().continuation = caller;
+	return handle;
+}
+
+void Script::Awaiter::await_resume() const {}
+
+
+Script::Script(coroutine_handle<promise_type> handle)
+{
+	m_Handle = handle;
+}
+
+Script::Script(Script&& other) noexcept
+{
+	m_Handle = other.m_Handle;
+	other.m_Handle = nullptr;
+}
+
+Script& Script::operator=(Script&& other) noexcept
+{
+	if (this != &other)
+	{
+		if (m_Handle)
+			m_Handle.destroy();
+		m_Handle = other.m_Handle;
+		other.m_Handle = nullptr;
+	}
+	return *this;
+}
+
+Script::~Script()
+{
+	if (m_Handle)
+		m_Handle.destroy();
+}
+
+bool Script::done() const
+{
+	return !m_Handle || m_Handle.done();
+}
+
+Script::Awaiter Script::operator co_await() &&
+{
+	return { m_Handle };
+}
+
+
+
+bool WaitFrames::await_ready() const
+{
+	return frames <= 0;
+}
+
+void WaitFrames::await_suspend(coroutine_handle<Script::promise_type> handle) const
+{
+	handle.promise().scheduler->sleep(handle, frames);
+}
+
+void WaitFrames::await_resume() const {}
+
+WaitFrames Battle::wait_frames(int frames)
+{
+	return { frames };
+}
+
+
+
+void Signal::fire()
+{
+	m_Fired = true;
+
+	// Resuming a script can make it wait on the signal again, so take the list first
+	vector<coroutine_handle<>> waiters;
+	waiters.swap(m_Waiters);
+	for (coroutine_handle<> handle : waiters)
+		handle.resume();
+}
+
+void Signal::reset()
+{
+	m_Fired = false;
+}
+
+bool Signal::fired() const
+{
+	return m_Fired;
+}
+
+bool Signal::await_ready() const
+{
+	return m_Fired;
+}
+
+void Signal::await_suspend(coroutine_handle<> handle)
+{
+	m_Waiters.push_back(handle);
+}
+
+void Signal::await_resume() const {}
+
+
+
+Scheduler::Scheduler()
+{
+	m_Sleeping = 0;
+	m_Frame = 0;
+}
+
+void Scheduler::insert(const Timer& timer)
+{
+	// Timers that are already due wake straight away, whether they were just slept or cascaded down a level
+	long long delta = timer.due - m_Frame;
+	if (delta <= 0)
+	{
+		m_Ready.push_back(timer.handle);
+		--m_Sleeping;
+		return;
+	}
+
+	if (delta < WHEEL_SLOTS)
+	{
+		m_Wheel[0][timer.due & (WHEEL_SLOTS - 1)].push_back(timer);
+		return;
+	}
+
+	// Find the lowest level where the timer's slot comes around before the level turns over
+	for (int level = 1; level < WHEEL_LEVELS; ++level)
+	{
+		int shift = WHEEL_BITS * level;
+		if ((timer.due >> shift) - (m_Frame >> shift) < WHEEL_SLOTS)
+		{
+			m_Wheel[level][(timer.due >> shift) & (WHEEL_SLOTS - 1)].push_back(timer);
+			return;
+		}
+	}
+
+	// Too far away for the wheel, so park it in the last slot of the top level to be sorted again later
+	int shift = WHEEL_BITS * (WHEEL_LEVELS - 1);
+	m_Wheel[WHEEL_LEVELS - 1][((m_Frame >> shift) + WHEEL_SLOTS - 1) & (WHEEL_SLOTS - 1)].push_back(timer);
+}
+
+void Scheduler::tick()
+{
+	++m_Frame;
+
+	// When a level turns over, move the timers in its next slot down to the levels below, starting from the top
+	int top = 0;
+	while (top + 1 < WHEEL_LEVELS && (m_Frame & ((1ll << (WHEEL_BITS * (top + 1))) - 1)) == 0)
+		++top;
+
+	for (int level = top; level >= 1; --level)
+	{
+		vector<Timer> timers;
+		timers.swap(m_Wheel[level][(m_Frame >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)]);
+		for (const Timer& timer : timers)
+			insert(timer);
+	}
+
+	// Wake up the timers that are due now
+	vector<Timer>& slot = m_Wheel[0][m_Frame & (WHEEL_SLOTS - 1)];
+	for (const Timer& timer : slot)
+	{
+		m_Ready.push_back(timer.handle);
+		--m_Sleeping;
+	}
+	slot.clear();
+}
+
+void Scheduler::start(Script&& script)
+{
+	script.m_Handle.promise().scheduler = this;
+	m_Scripts.push_back(move(script));
+	m_Scripts.back().m_Handle.resume();
+}
+
+void Scheduler::sleep(coroutine_handle<> handle, int frames)
+{
+	++m_Sleeping;
+	insert({ m_Frame + frames, handle });
+}
+
+void Scheduler::update(int frames_passed)
+{
+	// With nothing asleep there is nothing to wake, so skip straight ahead
+	if (m_Sleeping == 0)
+	{
+		m_Frame += frames_passed;
+	}
+	else
+	{
+		for (int k = 0; k < frames_passed; ++k)
+		{
+			tick();
+
+			// Scripts resumed here can go back to sleep, so take the list first
+			vector<coroutine_handle<>> ready;
+			ready.swap(m_Ready);
+			for (coroutine_handle<> handle : ready)
+				handle.resume();
+		}
+	}
+
+	// Clean up the scripts that have finished
+	m_Scripts.erase(remove_if(m_Scripts.begin(), m_Scripts.end(), [](const Script& s) { return s.done(); }), m_Scripts.end());
+}
+
+bool Scheduler::idle() const
+{
+	return m_Scripts.empty();
+}
+
+long long Scheduler::get_frame() const
+{
+	return m_Frame;
+}
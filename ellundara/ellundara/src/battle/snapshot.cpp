@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iterator>
+#include "../../include/battle.h"
+
+#define SNAPSHOT_MAGIC "ELSN"
+
+using namespace std;
+using namespace Battle;
+
+
+/// <summary>Appends an unsigned integer, using 7 bits per byte.</summary>
+static void write_varint(vector<unsigned char>& data, unsigned int value)
+{
+	while (value >= 0x80)
+	{
+		data.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	data.push_back((unsigned char)value);
+}
+
+/// <summary>Appends a signed integer, zigzag-encoded so that small negative numbers stay small.</summary>
+static void write_signed(vector<unsigned char>& data, int value)
+{
+	write_varint(data, ((unsigned int)value << 1) ^ (unsigned int)(value >> 31));
+}
+
+/// <summary>Appends a string, prefixed by its length.</summary>
+static void write_string(vector<unsigned char>& data, const string& value)
+{
+	write_varint(data, (unsigned int)value.size());
+	data.insert(data.end(), value.begin(), value.end());
+}
+
+
+// Reads values back out of an encoded snapshot, failing instead of reading past the end.
+struct SnapshotReader
+{
+	const vector<unsigned char>& data;
+	size_t pos;
+	bool good;
+
+	unsigned int read_varint()
+	{
+		unsigned int value = 0;
+		for (int shift = 0; shift < 35; shift += 7)
+		{
+			if (pos >= data.size())
+			{
+				good = false;
+				return 0;
+			}
+
+			unsigned char byte = data[pos++];
+			value |= (unsigned int)(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+
+		good = false;
+		return 0;
+	}
+
+	int read_signed()
+	{
+		unsigned int value = read_varint();
+		return (int)(value >> 1) ^ -(int)(value & 1);
+	}
+
+	string read_string()
+	{
+		unsigned int size = read_varint();
+		if (!good || size > data.size() - pos)
+		{
+			good = false;
+			return string();
+		}
+
+		string value(data.begin() + pos, data.begin() + pos + size);
+		pos += size;
+		return value;
+	}
+};
+
+
+
+Snapshot::Snapshot()
+{
+	m_Width = 0;
+	m_Height = 0;
+	m_Phase = true;
+}
+
+Snapshot::Snapshot(const Grid& grid, bool phase)
+{
+	m_TileSet = grid.get_tile_set()->get_id();
+	m_Width = grid.width;
+	m_Height = grid.height;
+	m_Phase = phase;
+
+	// Number each type and object, so that the arrays only store small indices
+	unordered_map<const TileType*, int> types;
+	for (auto& iter : grid.get_tile_set()->get_tile_types())
+	{
+		types.emplace(iter.second, (int)m_Types.size());
+		m_Types.push_back(iter.first);
+	}
+
+	unordered_map<const Object*, int> objects;
+
+	int size = m_Width * m_Height;
+	m_TileTypes.resize(size);
+	m_TileHeights.resize(size);
+	m_TileObjects.resize(size);
+
+	for (int j = 0; j < m_Height; ++j)
+	{
+		for (int i = 0; i < m_Width; ++i)
+		{
+			const Tile* tile = grid.get_tile(i, j);
+			int k = i + (m_Width * j);
+
+			auto type_iter = types.find(tile->type);
+			m_TileTypes[k] = type_iter != types.end() ? type_iter->second : -1;
+			m_TileHeights[k] = tile->height;
+
+			if (tile->obj)
+			{
+				auto obj_iter = objects.find(tile->obj);
+				if (obj_iter == objects.end())
+				{
+					obj_iter = objects.emplace(tile->obj, (int)m_Objects.size()).first;
+					m_Objects.push_back(tile->obj->get_id());
+				}
+				m_TileObjects[k] = obj_iter->second;
+			}
+			else
+			{
+				m_TileObjects[k] = -1;
+			}
+		}
+	}
+}
+
+bool Snapshot::get_phase() const
+{
+	return m_Phase;
+}
+
+const string& Snapshot::get_tile_set() const
+{
+	return m_TileSet;
+}
+
+void Snapshot::encode(vector<unsigned char>& data) const
+{
+	// Header
+	data.insert(data.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+	write_varint(data, VERSION);
+	data.push_back(m_Phase ? 1 : 0);
+
+	// Tables of IDs
+	write_string(data, m_TileSet);
+	write_varint(data, m_Width);
+	write_varint(data, m_Height);
+
+	write_varint(data, (unsigned int)m_Types.size());
+	for (const string& id : m_Types)
+		write_string(data, id);
+
+	write_varint(data, (unsigned int)m_Objects.size());
+	for (const string& id : m_Objects)
+		write_string(data, id);
+
+	// Types and heights are mostly the same as the previous tile, so store the differences
+	int prev = 0;
+	for (int type : m_TileTypes)
+	{
+		write_signed(data, type - prev);
+		prev = type;
+	}
+
+	prev = 0;
+	for (int h : m_TileHeights)
+	{
+		write_signed(data, h - prev);
+		prev = h;
+	}
+
+	// Objects are sparse, so only store the tiles that have them
+	unsigned int count = 0;
+	for (int obj : m_TileObjects)
+		if (obj >= 0)
+			++count;
+	write_varint(data, count);
+
+	prev = 0;
+	for (int k = 0; k < (int)m_TileObjects.size(); ++k)
+	{
+		if (m_TileObjects[k] >= 0)
+		{
+			write_varint(data, k - prev);
+			write_varint(data, m_TileObjects[k]);
+			prev = k;
+		}
+	}
+}
+
+bool Snapshot::decode(const vector<unsigned char>& data)
+{
+	SnapshotReader in{ data, 0, true };
+
+	// Header
+	if (data.size() < 4 || !equal(data.begin(), data.begin() + 4, SNAPSHOT_MAGIC))
+		return false;
+	in.pos = 4;
+
+	if (in.read_varint() != VERSION || in.pos >= data.size())
+		return false;
+	m_Phase = data[in.pos++] != 0;
+
+	// Tables of IDs
+	m_TileSet = in.read_string();
+	unsigned int width = in.read_varint();
+	unsigned int height = in.read_varint();
+	// An empty grid is written as 0x0, so only sizes that don't fit an int are rejected
+	if (!in.good || width > INT_MAX || height > INT_MAX)
+		return false;
+	m_Width = (int)width;
+	m_Height = (int)height;
+
+	// Every tile takes at least two bytes, which bounds the size before anything is allocated
+	uint64_t size = (uint64_t)width * height;
+	if (size * 2 > data.size())
+		return false;
+
+	// Every ID takes at least one byte, so the tables can't be longer than the rest of the data
+	unsigned int count = in.read_varint();
+	if (!in.good || count > data.size() - in.pos)
+		return false;
+	m_Types.resize(count);
+	for (string& id : m_Types)
+		id = in.read_string();
+
+	count = in.read_varint();
+	if (!in.good || count > data.size() - in.pos)
+		return false;
+	m_Objects.resize(count);
+	for (string& id : m_Objects)
+		id = in.read_string();
+
+	if (!in.good)
+		return false;
+
+	// Types and heights
+	m_TileTypes.resize(size);
+	int prev = 0;
+	for (int& type : m_TileTypes)
+	{
+		type = prev + in.read_signed();
+		if (type < -1 || type >= (int)m_Types.size())
+			return false;
+		prev = type;
+	}
+
+	m_TileHeights.resize(size);
+	prev = 0;
+	for (int& h : m_TileHeights)
+	{
+		h = prev + in.read_signed();
+		prev = h;
+	}
+
+	// Objects
+	m_TileObjects.assign(size, -1);
+	count = in.read_varint();
+	prev = 0;
+	for (unsigned int k = 0; k < count && in.good; ++k)
+	{
+		prev += (int)in.read_varint();
+		unsigned int obj = in.read_varint();
+		if (prev < 0 || prev >= (int)size || obj >= m_Objects.size())
+			return false;
+		m_TileObjects[prev] = (int)obj;
+	}
+
+	return in.good;
+}
+
+bool Snapshot::save(string path) const
+{
+	vector<unsigned char> data;
+	encode(data);
+
+	ofstream file(path, ios::binary | ios::trunc);
+	file.write((const char*)data.data(), data.size());
+	return file.good();
+}
+
+future<bool> Snapshot::save_async(string path) &&
+{
+	// The snapshot is moved to the thread rather than copied, so the battle can keep changing while it is written
+	return async(launch::async, [snapshot = move(*this), path]() { return snapshot.save(path); });
+}
+
+bool Snapshot::load(string path)
+{
+	ifstream file(path, ios::binary);
+	if (!file.good())
+		return false;
+
+	vector<unsigned char> data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	return decode(data);
+}
@@ -1,5 +1,9 @@
 #include <algorithm>
 #include <regex>
+#include <limits>
+#include <cstring>
+#include <atomic>
+#include <thread>
 #include "../../include/controls.h"
 #include "../../include/battle.h"
 
@@ -7,23 +11,52 @@
 
 #define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
 
+// Maps with at least this many cells may be kept as rectangles instead of one tile per cell.
+#define GRID_COMPRESS_AREA (256 * 256)
+
+// Maps are kept as rectangles when their rectangles cover at least this many cells each, on average.
+#define GRID_COMPRESS_RATIO 64
+
 using namespace std;
 using namespace Battle;
 
 
 std::unordered_map<string, TileSet*> TileSet::m_Sets{};
 
-TileSet::TileSet(string id)
+mutex TileSet::m_SetsMutex{};
+
+TileSet::TileSet(string id, const vector<TileSprite>& sprites)
 {
-	string path = "tiles/" + id + ".png";
-	m_SpriteSheet = SpriteSheet::generate(path.c_str());
+	m_ID = id;
+	m_SpriteSheet = nullptr;
+	m_Sprites = sprites;
+
+	// The tiles only need the types to exist; their sprites are looked up with the graphics
+	for (const TileSprite& s : sprites)
+	{
+		TileType*& type = m_Types[s.type];
+		if (!type)
+			type = new TileType();
+	}
+}
 
-	path = "res/img/tiles/" + id + ".meta";
-	LoadFile file(path);
+void TileSet::load_graphics()
+{
+	if (m_SpriteSheet)
+		return;
+
+	m_SpriteSheet = ResourceCache::get_sprite_sheet("tiles/" + m_ID + ".png");
+	load_types(m_Sprites);
+}
+
+vector<TileSprite> TileSet::read_sprites(string id)
+{
+	LoadFile file("res/img/tiles/" + id + ".meta");
 
 	regex top_regex("(.*)\\s+top");
 	regex side_regex("(.*)\\s+side");
 
+	vector<TileSprite> sprites;
 	while (file.good())
 	{
 		unordered_map<string, int> data;
@@ -31,47 +64,78 @@ TileSet::TileSet(string id)
 
 		smatch match;
 		if (regex_match(line, match, top_regex))
-		{
-			auto iter = m_Types.find(match[1].str());
-			if (iter != m_Types.end())
-			{
-				iter->second->top = Sprite::get_sprite(line);
-			}
-			else
-			{
-				TileType* type = new TileType();
-				type->top = Sprite::get_sprite(line);
-				m_Types.emplace(match[1].str(), type);
-			}
-		}
+			sprites.push_back({ match[1].str(), line, true });
 		else if (regex_match(line, match, side_regex))
-		{
-			auto iter = m_Types.find(match[1].str());
-			if (iter != m_Types.end())
-			{
-				iter->second->side = Sprite::get_sprite(line);
-			}
-			else
-			{
-				TileType* type = new TileType();
-				type->side = Sprite::get_sprite(line);
-				m_Types.emplace(match[1].str(), type);
-			}
-		}
+			sprites.push_back({ match[1].str(), line, false });
+	}
+
+	return sprites;
+}
+
+void TileSet::load_types(const vector<TileSprite>& sprites)
+{
+	for (const TileSprite& s : sprites)
+	{
+		TileType*& type = m_Types[s.type];
+		if (!type)
+			type = new TileType();
+
+		if (s.top)
+			type->top = Sprite::get_sprite(s.sprite);
+		else
+			type->side = Sprite::get_sprite(s.sprite);
 	}
 }
 
 TileSet* TileSet::get_tile_set(string id)
 {
+	{
+		lock_guard<mutex> lock(m_SetsMutex);
+		auto iter = m_Sets.find(id);
+		if (iter != m_Sets.end())
+			return iter->second;
+	}
+
+	return get_tile_set(id, read_sprites(id));
+}
+
+TileSet* TileSet::get_tile_set(string id, const vector<TileSprite>& sprites)
+{
+	lock_guard<mutex> lock(m_SetsMutex);
 	auto iter = m_Sets.find(id);
 	if (iter != m_Sets.end())
 		return iter->second;
 	
-	TileSet* s = new TileSet(id);
+	TileSet* s = new TileSet(id, sprites);
 	m_Sets.emplace(id, s);
 	return s;
 }
 
+bool TileSet::reload_tile_set(string id)
+{
+	TileSet* set;
+	{
+		lock_guard<mutex> lock(m_SetsMutex);
+		auto iter = m_Sets.find(id);
+		if (iter == m_Sets.end())
+			return false;
+		set = iter->second;
+	}
+
+	// Regenerate the sheet first, so that the sprites are looked up again from the new one
+	set->m_SpriteSheet = ResourceCache::reload_sprite_sheet("tiles/" + id + ".png");
+
+	// Tiles point at the types, so the types are updated rather than replaced
+	set->m_Sprites = read_sprites(id);
+	set->load_types(set->m_Sprites);
+	return true;
+}
+
+const string& TileSet::get_id() const
+{
+	return m_ID;
+}
+
 SpriteSheet* TileSet::get_sprite_sheet()
 {
 	return m_SpriteSheet;
@@ -85,111 +149,345 @@ const TileType* TileSet::get_tile_type(string type) const
 	return nullptr;
 }
 
+const unordered_map<string, TileType*>& TileSet::get_tile_types() const
+{
+	return m_Types;
+}
+
 
 
-Grid::Grid(string map)
+/// <summary>Reads a battle map with the simulation's parser, which the grid is built from.</summary>
+/// <param name="id">The ID of the battle map.</param>
+/// <returns>The map, which is empty if the file couldn't be read.</returns>
+static Sim::Map read_map(const string& id)
 {
-	width = 0;
-	height = 0;
-	m_Tiles = nullptr;
+	Sim::Map map;
+	map.load("res/maps/" + id + ".txt");
+	return map;
+}
 
-	LoadFile file("res/maps/" + map + ".txt");
+Grid::Grid(string map) : Grid(read_map(map)) {}
 
-	regex tileset_regex("tileset\\s+(.*)");
-	regex tile_regex("tile\\s+(.*)");
-	regex obj_regex("obj\\s+(.*)");
+Grid::Grid(const Sim::Map& map)
+{
+	width = map.width;
+	height = map.height;
+	m_Tiles = nullptr;
+	m_TileSet = TileSet::get_tile_set(map.tileset);
 
-	while (file.good())
+	for (const Sim::Map::Region& r : map.regions)
 	{
-		// Read the next line of the file
-		std::unordered_map<string, int> line;
-		string id = file.load_data(line);
+		TileRegion region;
+		region.x = r.x;
+		region.y = r.y;
+		region.width = r.dx;
+		region.height = r.dy;
+		region.tile = m_Gap;
+		region.tile.type = m_TileSet->get_tile_type(map.get_type_name(r.type));
+		region.tile.height = r.height;
+		m_Regions.push_back(region);
+	}
 
-		smatch match;
-		
-		// Load tileset
-		if (regex_match(id, match, tileset_regex))
+	// Big maps made of a few big rectangles are kept as rectangles; the rest are expanded into tiles
+	if (width * height >= GRID_COMPRESS_AREA && (int)m_Regions.size() * GRID_COMPRESS_RATIO <= width * height)
+	{
+		build_row_runs();
+	}
+	else
+	{
+		m_Tiles = new Tile[width * height];
+		for (int k = (width * height) - 1; k >= 0; --k)
+			m_Tiles[k] = m_Gap;
+
+		for (const TileRegion& region : m_Regions)
+			for (int j = region.y; j < region.y + region.height; ++j)
+				for (int i = region.x; i < region.x + region.width; ++i)
+					m_Tiles[GRID_COORDINATE(i, j, width)] = region.tile;
+	}
+
+	for (const Sim::Map::Placement& obj : map.objects)
+	{
+		if (const Tile* tile = get_tile(obj.x, obj.y))
 		{
-			m_TileSet = TileSet::get_tile_set(match[1].str());
+			Tile placed = *tile;
+			placed.obj = Object::get_object(obj.id);
+			write_tile(obj.x, obj.y, placed);
 		}
+	}
 
-		// Construct tiles
-		else if (regex_match(id, match, tile_regex))
-		{
-			int x = line["x"];
-			int y = line["y"];
-			int dx = line["dx"];
-			int dy = line["dy"];
+	reset_bitboards();
+}
 
-			if (x + dx > width || y + dy > height)
-			{
-				int new_width = max(x + dx, width);
-				int new_height = max(y + dy, height);
+void Grid::build_row_runs()
+{
+	m_RowRuns.assign(height, {});
 
-				Tile* new_tiles = new Tile[new_width * new_height];
-				for (int k = (new_width * new_height) - 1; k >= 0; --k)
-				{
-					new_tiles[k].height = 0;
-					new_tiles[k].terrain = nullptr;
-					new_tiles[k].obj = nullptr;
-				}
+	vector<RegionRun> kept;
+	for (int r = 0; r < (int)m_Regions.size(); ++r)
+	{
+		const TileRegion& region = m_Regions[r];
+		int x0 = region.x;
+		int x1 = region.x + region.width;
 
-				for (int i = 0; i < width; ++i)
-				{
-					for (int j = 0; j < height; ++j)
-					{
-						new_tiles[GRID_COORDINATE(i, j, new_width)] = m_Tiles[GRID_COORDINATE(i, j, width)];
-					}
-				}
+		for (int j = region.y; j < region.y + region.height; ++j)
+		{
+			vector<RegionRun>& runs = m_RowRuns[j];
 
-				if (m_Tiles)
-					delete m_Tiles;
-				m_Tiles = new_tiles;
-				width = new_width;
-				height = new_height;
+			// Most rectangles don't overlap, so the run just slots in
+			auto iter = lower_bound(runs.begin(), runs.end(), x0, [](const RegionRun& run, int x) { return run.x0 < x; });
+			bool before = iter == runs.begin() || (iter - 1)->x1 <= x0;
+			bool after = iter == runs.end() || iter->x0 >= x1;
+			if (before && after)
+			{
+				runs.insert(iter, { x0, x1, r });
+				continue;
 			}
 
-			int h = line["height"];
-			const TileType* type = m_TileSet->get_tile_type(match[1].str());
-
-			for (int i = x; i < x + dx; ++i)
+			// Otherwise cut the new run out of the runs it covers
+			kept.clear();
+			for (const RegionRun& run : runs)
 			{
-				for (int j = y; j < y + dy; ++j)
+				if (run.x1 <= x0 || run.x0 >= x1)
 				{
-					Tile* tile = get_tile(i, j);
-					tile->type = type;
-					tile->height = h;
+					kept.push_back(run);
+					continue;
 				}
+				if (run.x0 < x0)	kept.push_back({ run.x0, x0, run.region });
+				if (run.x1 > x1)	kept.push_back({ x1, run.x1, run.region });
 			}
+			kept.push_back({ x0, x1, r });
+			sort(kept.begin(), kept.end(), [](const RegionRun& a, const RegionRun& b) { return a.x0 < b.x0; });
+			runs = kept;
 		}
+	}
+}
+
+Grid::Grid(const Snapshot& snapshot)
+{
+	width = snapshot.m_Width;
+	height = snapshot.m_Height;
+	m_TileSet = TileSet::get_tile_set(snapshot.m_TileSet);
+
+	// Look up each type and object once, rather than once per tile
+	vector<const TileType*> types;
+	for (const string& id : snapshot.m_Types)
+		types.push_back(m_TileSet->get_tile_type(id));
+
+	vector<Object*> objects;
+	for (const string& id : snapshot.m_Objects)
+		objects.push_back(Object::get_object(id));
+
+	m_Tiles = new Tile[width * height];
+	for (int k = (width * height) - 1; k >= 0; --k)
+	{
+		int type = snapshot.m_TileTypes[k];
+		int obj = snapshot.m_TileObjects[k];
 
-		// Construct objects
-		else if (regex_match(id, match, obj_regex))
+		m_Tiles[k].type = type >= 0 ? types[type] : nullptr;
+		m_Tiles[k].height = snapshot.m_TileHeights[k];
+		m_Tiles[k].obj = obj >= 0 ? objects[obj] : nullptr;
+		m_Tiles[k].terrain = nullptr;
+	}
+
+	reset_bitboards();
+}
+
+Grid::~Grid()
+{
+	delete[] m_Tiles;
+}
+
+/// <summary>Checks whether two tiles are the same in every way.</summary>
+static bool same_tile(const Tile& a, const Tile& b)
+{
+	return a.type == b.type && a.height == b.height && a.obj == b.obj && a.terrain == b.terrain && a.unit == b.unit;
+}
+
+/// <summary>Checks whether two rectangles cover the same cells with the same tile.</summary>
+static bool same_region(const TileRegion& a, const TileRegion& b)
+{
+	return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height && same_tile(a.tile, b.tile);
+}
+
+int Grid::reload(string map)
+{
+	Grid fresh(map);
+	if (fresh.width != width || fresh.height != height)
+		return -1;
+
+	m_TileSet = fresh.m_TileSet;
+	if (!m_Tiles)
+		return reload_regions(fresh);
+	m_Regions = fresh.m_Regions;
+
+	// Only touching the tiles that changed keeps every other chunk's cached state
+	int changed = 0;
+	for (int j = 0; j < height; ++j)
+	{
+		for (int i = 0; i < width; ++i)
 		{
-			int x = line["x"];
-			int y = line["y"];
+			const Tile* from = fresh.get_tile(i, j);
+			const Tile* to = get_tile(i, j);
+			if (from->type == to->type && from->height == to->height && from->obj == to->obj)
+				continue;
+
+			Tile tile = *to;
+			tile.type = from->type;
+			tile.height = from->height;
+			tile.obj = from->obj;
+			set_tile(i, j, tile);
+			++changed;
+		}
+	}
+	return changed;
+}
+
+int Grid::reload_regions(const Grid& fresh)
+{
+	// Only the cells of rectangles that were added, removed or changed can read differently, along with the cells
+	// that have their own copy or an object
+	Bitboard cells(width, height);
+	auto mark = [&](const TileRegion& region) {
+		for (int j = region.y; j < region.y + region.height; ++j)
+			for (int i = region.x; i < region.x + region.width; ++i)
+				cells.set(i, j, true);
+	};
+
+	size_t count = max(m_Regions.size(), fresh.m_Regions.size());
+	for (size_t r = 0; r < count; ++r)
+	{
+		bool before = r < m_Regions.size();
+		bool after = r < fresh.m_Regions.size();
+		if (before && after && same_region(m_Regions[r], fresh.m_Regions[r]))
+			continue;
+		if (before)
+			mark(m_Regions[r]);
+		if (after)
+			mark(fresh.m_Regions[r]);
+	}
+
+	for (const pair<const int, Tile>& cell : m_Overrides)
+		cells.set(cell.first % width, cell.first / width, true);
+	cells |= fresh.m_Occupied;
 
-			Tile* tile = get_tile(x, y);
-			if (tile)
-				tile->obj = Object::get_object(match[1].str());
+	// Remember what those cells hold, since swapping in the new rectangles changes what they read as
+	vector<pair<int, Tile>> old;
+	cells.for_each([&](int x, int y) { old.emplace_back(GRID_COORDINATE(x, y, width), *get_tile(x, y)); });
 
-			cout << "Object loaded.";
+	m_Regions = fresh.m_Regions;
+	build_row_runs();
+	m_Overrides.clear();
+
+	// Units and terrain stay where they are, and cells only get their own copy again if they differ from the new rectangles
+	int changed = 0;
+	for (const pair<int, Tile>& cell : old)
+	{
+		int x = cell.first % width;
+		int y = cell.first / width;
+		const Tile* from = fresh.get_tile(x, y);
+
+		Tile tile = cell.second;
+		tile.type = from->type;
+		tile.height = from->height;
+		tile.obj = from->obj;
+		write_tile(x, y, tile);
+
+		if (from->type != cell.second.type || from->height != cell.second.height || from->obj != cell.second.obj)
+		{
+			refresh_bitboards(x, y);
+			touch_chunks(x, y);
+			++changed;
 		}
 	}
+	return changed;
 }
 
-Tile* Grid::get_tile(int x, int y)
+void Grid::reset_bitboards()
 {
-	if (x >= 0 && x < width && y >= 0 && y < height)
-		return m_Tiles + GRID_COORDINATE(x, y, width);
-	return nullptr;
+	m_Occupied = Bitboard(width, height);
+	m_Passable = Bitboard(width, height);
+	m_ChunkVersions.assign(get_chunk_columns() * get_chunk_rows(), 0);
+	m_Version = 0;
+
+	if (m_Tiles)
+	{
+		for (int j = 0; j < height; ++j)
+			for (int i = 0; i < width; ++i)
+				refresh_bitboards(i, j);
+		return;
+	}
+
+	// Whole runs share a tile, so only the changed cells need to be looked at one by one
+	for (int j = 0; j < height; ++j)
+		for (const RegionRun& run : m_RowRuns[j])
+			if (m_Regions[run.region].tile.type)
+				for (int i = run.x0; i < run.x1; ++i)
+					m_Passable.set(i, j, true);
+
+	for (const pair<const int, Tile>& cell : m_Overrides)
+		refresh_bitboards(cell.first % width, cell.first / width);
+}
+
+void Grid::refresh_bitboards(int x, int y)
+{
+	if (const Tile* tile = get_tile(x, y))
+	{
+		m_Occupied.set(x, y, tile->obj != nullptr || !tile->unit.is_null());
+		m_Passable.set(x, y, tile->type != nullptr);
+	}
+}
+
+void Grid::touch_chunks(int x, int y)
+{
+	++m_Version;
+
+	int columns = get_chunk_columns();
+	int cx = x / GRID_CHUNK_SIZE;
+	int cy = y / GRID_CHUNK_SIZE;
+	++m_ChunkVersions[cx + (columns * cy)];
+
+	// The sides of the neighboring tiles depend on this tile's height
+	if (x % GRID_CHUNK_SIZE == 0 && cx > 0)
+		++m_ChunkVersions[(cx - 1) + (columns * cy)];
+	if (x % GRID_CHUNK_SIZE == GRID_CHUNK_SIZE - 1 && cx < columns - 1)
+		++m_ChunkVersions[(cx + 1) + (columns * cy)];
+	if (y % GRID_CHUNK_SIZE == 0 && cy > 0)
+		++m_ChunkVersions[cx + (columns * (cy - 1))];
+	if (y % GRID_CHUNK_SIZE == GRID_CHUNK_SIZE - 1 && cy < get_chunk_rows() - 1)
+		++m_ChunkVersions[cx + (columns * (cy + 1))];
 }
 
 const Tile* Grid::get_tile(int x, int y) const
 {
-	if (x >= 0 && x < width && y >= 0 && y < height)
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return nullptr;
+	if (m_Tiles)
 		return m_Tiles + GRID_COORDINATE(x, y, width);
-	return nullptr;
+
+	if (!m_Overrides.empty())
+	{
+		auto iter = m_Overrides.find(GRID_COORDINATE(x, y, width));
+		if (iter != m_Overrides.end())
+			return &iter->second;
+	}
+
+	return get_region_tile(x, y);
+}
+
+const Tile* Grid::get_region_tile(int x, int y) const
+{
+	// Find the first run that ends after the cell
+	const vector<RegionRun>& runs = m_RowRuns[y];
+	auto iter = upper_bound(runs.begin(), runs.end(), x, [](int x, const RegionRun& run) { return x < run.x1; });
+	if (iter != runs.end() && iter->x0 <= x)
+		return &m_Regions[iter->region].tile;
+	return &m_Gap;
+}
+
+void Grid::load_graphics()
+{
+	m_TileSet->load_graphics();
+	Object::load_object_graphics();
 }
 
 const SpriteSheet* Grid::get_tile_sprite_sheet() const
@@ -197,50 +495,169 @@ const SpriteSheet* Grid::get_tile_sprite_sheet() const
 	return m_TileSet->get_sprite_sheet();
 }
 
+const TileSet* Grid::get_tile_set() const
+{
+	return m_TileSet;
+}
 
+bool Grid::is_compressed() const
+{
+	return m_Tiles == nullptr;
+}
 
+const vector<TileRegion>& Grid::get_regions() const
+{
+	return m_Regions;
+}
 
+const vector<RegionRun>& Grid::get_row_runs(int y) const
+{
+	static const vector<RegionRun> none;
+	return m_Tiles ? none : m_RowRuns[y];
+}
 
-Graphic* Visibility::Selector::m_Graphic{ nullptr };
+const unordered_map<int, Tile>& Grid::get_overrides() const
+{
+	return m_Overrides;
+}
 
-Visibility::Selector::Selector()
+bool Grid::write_tile(int x, int y, const Tile& tile)
 {
-	if (!m_Graphic)
-		m_Graphic = SolidColorGraphic::generate(255, 255, 0, 128, GRID_TILE_SIZE, GRID_TILE_SIZE);
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return false;
 
-	m_Tile = vec2i(0, 0);
+	int k = GRID_COORDINATE(x, y, width);
+	if (m_Tiles)
+	{
+		if (same_tile(m_Tiles[k], tile))
+			return false;
+		m_Tiles[k] = tile;
+		return true;
+	}
+
+	// Cells only keep their own copy while they differ from their rectangle
+	auto iter = m_Overrides.find(k);
+	const Tile& old = iter != m_Overrides.end() ? iter->second : *get_region_tile(x, y);
+	if (same_tile(old, tile))
+		return false;
+
+	if (same_tile(*get_region_tile(x, y), tile))
+		m_Overrides.erase(iter);
+	else if (iter != m_Overrides.end())
+		iter->second = tile;
+	else
+		m_Overrides.emplace(k, tile);
+	return true;
 }
 
-void Visibility::Selector::set_tile(Visibility* vis, int x, int y)
+void Grid::set_tile(int x, int y, const Tile& tile)
 {
-	m_Tile = vec2i(x, y);
+	if (write_tile(x, y, tile))
+	{
+		refresh_bitboards(x, y);
+		touch_chunks(x, y);
+	}
+}
 
-	if (m_Tile.get(0) < 0)								m_Tile.set(0, 0, 0);
-	else if (m_Tile.get(0) >= vis->m_Grid->width)		m_Tile.set(0, 0, vis->m_Grid->width - 1);
+void Grid::set_tile_type(int x, int y, const TileType* type)
+{
+	if (const Tile* tile = get_tile(x, y))
+	{
+		Tile changed = *tile;
+		changed.type = type;
+		set_tile(x, y, changed);
+	}
+}
 
-	if (m_Tile.get(1) < 0)								m_Tile.set(1, 0, 0);
-	else if (m_Tile.get(1) >= vis->m_Grid->height)		m_Tile.set(1, 0, vis->m_Grid->height - 1);
+void Grid::set_tile_height(int x, int y, int h)
+{
+	if (const Tile* tile = get_tile(x, y))
+	{
+		Tile changed = *tile;
+		changed.height = h;
+		set_tile(x, y, changed);
+	}
 }
 
-void Visibility::Selector::adjust_tile(Visibility* vis, int dx, int dy)
+void Grid::set_tile_object(int x, int y, Object* obj)
+{
+	if (const Tile* tile = get_tile(x, y))
+	{
+		Tile changed = *tile;
+		changed.obj = obj;
+		set_tile(x, y, changed);
+	}
+}
+
+void Grid::set_tile_unit(int x, int y, Entity unit)
+{
+	if (const Tile* tile = get_tile(x, y))
+	{
+		Tile changed = *tile;
+		changed.unit = unit;
+		set_tile(x, y, changed);
+	}
+}
+
+const Bitboard& Grid::get_occupied() const
+{
+	return m_Occupied;
+}
+
+const Bitboard& Grid::get_passable() const
+{
+	return m_Passable;
+}
+
+int Grid::get_chunk_columns() const
+{
+	return (width + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+}
+
+int Grid::get_chunk_rows() const
+{
+	return (height + GRID_CHUNK_SIZE - 1) / GRID_CHUNK_SIZE;
+}
+
+unsigned int Grid::get_chunk_version(int cx, int cy) const
+{
+	return m_ChunkVersions[cx + (get_chunk_columns() * cy)];
+}
+
+unsigned int Grid::get_version() const
+{
+	return m_Version;
+}
+
+
+
+
+
+Graphic* Visibility::m_HighlightGraphics[HIGHLIGHT_COUNT]{};
+
+Visibility::Selector::Selector()
+{
+	m_Tile = vec2i(0, 0);
+}
+
+void Visibility::Selector::set_tile(Visibility* vis, int x, int y)
 {
-	m_Tile += vec2i(dx, dy);
+	vis->set_highlight(HIGHLIGHT_SELECTED, m_Tile.get(0), m_Tile.get(1), false);
+
+	m_Tile = vec2i(x, y);
 
 	if (m_Tile.get(0) < 0)								m_Tile.set(0, 0, 0);
 	else if (m_Tile.get(0) >= vis->m_Grid->width)		m_Tile.set(0, 0, vis->m_Grid->width - 1);
 
 	if (m_Tile.get(1) < 0)								m_Tile.set(1, 0, 0);
 	else if (m_Tile.get(1) >= vis->m_Grid->height)		m_Tile.set(1, 0, vis->m_Grid->height - 1);
-}
 
-bool Visibility::Selector::highlight_tile(const Visibility* vis, Tile* tile) const
-{
-	return tile == vis->m_Grid->get_tile(m_Tile.get(0), m_Tile.get(1));
+	vis->set_highlight(HIGHLIGHT_SELECTED, m_Tile.get(0), m_Tile.get(1), true);
 }
 
-void Visibility::Selector::display() const
+void Visibility::Selector::adjust_tile(Visibility* vis, int dx, int dy)
 {
-	m_Graphic->display();
+	set_tile(vis, m_Tile.get(0) + dx, m_Tile.get(1) + dy);
 }
 
 
@@ -258,6 +675,22 @@ void Visibility::Selector::display() const
 
 #define TOP_DOWN_ANGLE		0.872664626f
 
+#define ZOOM_SPEED			0.1f
+#define ZOOM_THRESHOLD		0.001f
+#define ZOOM_MIN			0.0625f
+#define ZOOM_MAX			2.f
+
+// Below these zoom factors, tiles are drawn in blocks of 2x2 and 4x4
+#define LOD_ZOOM_2			0.5f
+#define LOD_ZOOM_4			0.25f
+
+// Below this many chunks to rebuild, the visible tiles are built without starting any threads
+#define THREAD_CHUNKS		8
+
+// Highlights and objects are lifted off the tiles by these heights, so that they don't fight the ground for depth
+#define HIGHLIGHT_BIAS		0.01f
+#define OBJECT_BIAS			0.02f
+
 float Visibility::m_Angle{ QUARTER_PI };
 vec3f Visibility::m_Camera{};
 float Visibility::m_Zoom{ 1.f };
@@ -267,13 +700,55 @@ float Visibility::get_angle()
 	return m_Angle;
 }
 
-Visibility::Visibility(const mat2x2i& bounds, Grid* grid) : m_Bounds(bounds)
+Visibility::Visibility(const mat2x2i& bounds, const Grid* grid) : m_Bounds(bounds)
 {
 	m_Grid = grid;
 
-	m_Palette = new SinglePalette(vec4f(1.f, 0.f, 0.f, 0.f), vec4f(0.f, 1.f, 0.f, 0.f), vec4f(0.f, 0.f, 1.f, 0.f));
+	m_Palette = ResourceCache::get_default_palette();
 
 	m_TargetAngle = m_Angle;
+
+	m_MinHeight = 0;
+	m_MaxHeight = 0;
+
+	m_Fog = nullptr;
+	m_FogFaction = 0;
+
+	m_TileSpriteSheet = nullptr;
+
+	m_TargetZoom = m_Zoom;
+	m_Lod = m_Zoom < LOD_ZOOM_4 ? 4 : (m_Zoom < LOD_ZOOM_2 ? 2 : 1);
+	m_LodBuiltSize = 0;
+	m_LodBuiltDirection = 0;
+	m_LodBuiltVersion = 0;
+	m_LodColumns = 0;
+	m_Direction = 0;
+	m_Built = false;
+	m_BuiltVersion = 0;
+
+	// The grid may not be constructed yet, so the highlights are sized by reset
+	for (int k = 0; k < HIGHLIGHT_COUNT; ++k)
+	{
+		m_HighlightUsed[k] = false;
+		m_HighlightDirty[k] = false;
+	}
+	m_HighlightVersion = 0;
+	m_HighlightLod = 0;
+}
+
+void Visibility::load_graphics()
+{
+	if (!m_HighlightGraphics[HIGHLIGHT_SELECTED])
+	{
+		m_HighlightGraphics[HIGHLIGHT_MOVE] = SolidColorGraphic::generate(0, 128, 255, 96, GRID_TILE_SIZE, GRID_TILE_SIZE);
+		m_HighlightGraphics[HIGHLIGHT_ATTACK] = SolidColorGraphic::generate(255, 64, 0, 96, GRID_TILE_SIZE, GRID_TILE_SIZE);
+		m_HighlightGraphics[HIGHLIGHT_THREAT] = SolidColorGraphic::generate(160, 0, 160, 64, GRID_TILE_SIZE, GRID_TILE_SIZE);
+		m_HighlightGraphics[HIGHLIGHT_DAMAGE] = SolidColorGraphic::generate(255, 0, 0, 160, GRID_TILE_SIZE, GRID_TILE_SIZE);
+		m_HighlightGraphics[HIGHLIGHT_HEAL] = SolidColorGraphic::generate(0, 255, 64, 160, GRID_TILE_SIZE, GRID_TILE_SIZE);
+		m_HighlightGraphics[HIGHLIGHT_SELECTED] = SolidColorGraphic::generate(255, 255, 0, 128, GRID_TILE_SIZE, GRID_TILE_SIZE);
+	}
+
+	m_TileSpriteSheet = m_Grid->get_tile_sprite_sheet();
 }
 
 void Visibility::reset_transform()
@@ -300,67 +775,316 @@ void Visibility::reset_transform()
 	m_Transform.set(2, 1, rsin * bcos);
 	m_Transform.set(2, 2, -rcot);
 	m_Transform.set(2, 3, (rsin * ty) + (rcot * m_Camera.get(2)));
+
+	// Store the inverse, so that picking doesn't have to invert the matrix every time
+	m_Picker.cos = bcos;
+	m_Picker.sin = bsin;
+	m_Picker.inv_zoom = 1.f / m_Zoom;
+	m_Picker.tx = m_Transform.get(0, 3);
+	m_Picker.ty = m_Transform.get(1, 3);
 }
 
-void Visibility::reset_visible_tiles()
+template <int DX, int DY>
+void Visibility::build_chunk(Chunk& chunk, int cx, int cy, bool full)
 {
-	m_VisibleTiles.clear();
+	chunk.tiles.clear();
+	chunk.objects.clear();
+	chunk.terrain.clear();
+	chunk.version = m_Grid->get_chunk_version(cx, cy);
+	chunk.built = true;
+	chunk.full = full;
+	chunk.min_height = 0;
+	chunk.max_height = 0;
+
+	int x0 = cx * GRID_CHUNK_SIZE;
+	int y0 = cy * GRID_CHUNK_SIZE;
+	int x1 = min(x0 + GRID_CHUNK_SIZE, m_Grid->width);
+	int y1 = min(y0 + GRID_CHUNK_SIZE, m_Grid->height);
+
+	const Grid* grid = m_Grid;
+
+	constexpr bool flip_x = DX < 0;
+	constexpr bool flip_y = DY < 0;
+
+	int istart = flip_x ? x1 - 1 : x0;
+	int iend = flip_x ? x0 - 1 : x1;
+	int jstart = flip_y ? y1 - 1 : y0;
+	int jend = flip_y ? y0 - 1 : y1;
+
+	for (int i = istart; i != iend; i += DX)
+	{
+		for (int j = jstart; j != jend; j += DY)
+		{
+			const Tile* tile = grid->get_tile(i, j);
+			if (!tile || !tile->type)
+				continue;
+
+			if (tile->height < chunk.min_height)		chunk.min_height = tile->height;
+			else if (tile->height > chunk.max_height)	chunk.max_height = tile->height;
+
+			// Blocks are drawn instead of tiles when zoomed out, so only what stands on the tiles is needed
+			if (!full && !tile->obj && !tile->terrain)
+				continue;
+
+			const Tile* tx = full ? grid->get_tile(i + DX, j) : nullptr;
+			const Tile* ty = full ? grid->get_tile(i, j + DY) : nullptr;
 
-	// Decide which order to draw the tiles in
+			if (tile->obj)		chunk.objects.push_back((int)chunk.tiles.size());
+			if (tile->terrain)	chunk.terrain.push_back((int)chunk.tiles.size());
+
+			chunk.tiles.push_back({
+				tile,
+				vec3f(GRID_TILE_SIZE * i, GRID_TILE_SIZE * j, GRID_TILE_HEIGHT * tile->height),
+				vec2i(tile->height - (tx ? tx->height : 0), tile->height - (ty ? ty->height : 0)),
+				vec2i(i, j)
+			});
+		}
+	}
+}
+
+void Visibility::reset_visible_tiles()
+{
+	// Decide which order to draw the tiles in, then use the version of the traversal built for it
 	int dx = sin(m_Angle) > 0 ? -1 : 1;
 	int dy = cos(m_Angle) > 0 ? -1 : 1;
-	int istart, iend, jstart, jend;
-	if (dx < 0)
+	int direction = (dx < 0 ? 2 : 0) + (dy < 0 ? 1 : 0);
+
+	// The chunks are kept between frames, so there is nothing to do until the grid or the direction changes
+	if (m_Built && direction == m_Direction && m_BuiltVersion == m_Grid->get_version())
+		return;
+
+	m_Direction = direction;
+	m_Built = true;
+	m_BuiltVersion = m_Grid->get_version();
+
+	switch (m_Direction)
 	{
-		istart = m_Grid->width - 1;
-		iend = -1;
+	case 0:	build_visible_tiles<1, 1>();	break;
+	case 1:	build_visible_tiles<1, -1>();	break;
+	case 2:	build_visible_tiles<-1, 1>();	break;
+	case 3:	build_visible_tiles<-1, -1>();	break;
 	}
-	else
+
+	if (m_Lod > 1)
+	{
+		switch (m_Direction)
+		{
+		case 0:	reset_lod_blocks<1, 1>();	break;
+		case 1:	reset_lod_blocks<1, -1>();	break;
+		case 2:	reset_lod_blocks<-1, 1>();	break;
+		case 3:	reset_lod_blocks<-1, -1>();	break;
+		}
+	}
+}
+
+template <int DX, int DY>
+void Visibility::build_visible_tiles()
+{
+	vector<Chunk>& chunks = m_Chunks[m_Direction];
+
+	int columns = m_Grid->get_chunk_columns();
+	int rows = m_Grid->get_chunk_rows();
+	if ((int)chunks.size() != columns * rows)
+		chunks.assign(columns * rows, Chunk());
+
+	// Chunks built while zoomed in still work when zoomed out, but not the other way around
+	bool full = m_Lod == 1;
+
+	// Drawing chunk by chunk, in the same order as the tiles inside each chunk, still draws back to front
+	int cistart = DX < 0 ? columns - 1 : 0;
+	int ciend = DX < 0 ? -1 : columns;
+	int cjstart = DY < 0 ? rows - 1 : 0;
+	int cjend = DY < 0 ? -1 : rows;
+
+	vector<int> dirty;
+	m_ChunkOrder.clear();
+	for (int ci = cistart; ci != ciend; ci += DX)
 	{
-		istart = 0;
-		iend = m_Grid->width;
+		for (int cj = cjstart; cj != cjend; cj += DY)
+		{
+			// Only rebuild the chunk if one of its tiles has changed, or it is missing tiles that are now drawn
+			int c = ci + (columns * cj);
+			m_ChunkOrder.push_back(c);
+			if (!chunks[c].built || chunks[c].version != m_Grid->get_chunk_version(ci, cj) || (full && !chunks[c].full))
+				dirty.push_back(c);
+		}
 	}
-	if (dy < 0)
+
+	// Each chunk only reads the grid and writes its own lists, so they can be rebuilt at once
+	atomic<int> next(0);
+	auto work = [&]() {
+		int k;
+		while ((k = next++) < (int)dirty.size())
+			build_chunk<DX, DY>(chunks[dirty[k]], dirty[k] % columns, dirty[k] / columns, full);
+	};
+
+	int count = (int)dirty.size() < THREAD_CHUNKS ? 1 : min((int)dirty.size(), max(1, (int)thread::hardware_concurrency()));
+	vector<thread> workers;
+	for (int t = 1; t < count; ++t)
+		workers.emplace_back(work);
+	work();
+	for (thread& w : workers)
+		w.join();
+
+	// The chunks are drawn where they are, so only the range of heights is gathered
+	m_MinHeight = 0;
+	m_MaxHeight = 0;
+	for (const Chunk& chunk : chunks)
 	{
-		jstart = m_Grid->height - 1;
-		jend = -1;
+		m_MinHeight = min(m_MinHeight, chunk.min_height);
+		m_MaxHeight = max(m_MaxHeight, chunk.max_height);
 	}
-	else
+}
+
+// The tiles counted towards one zoomed-out block.
+struct BlockTally
+{
+	// The total height of the tiles, and the number of tiles.
+	int total = 0, count = 0;
+
+	// The number of tiles of each type.
+	vector<pair<const TileType*, int>> types;
+
+	void clear()
 	{
-		jstart = 0;
-		jend = m_Grid->height;
+		total = 0;
+		count = 0;
+		types.clear();
 	}
 
-	// Determine which tiles are visible
-	vec2f trans(GRID_TILE_SIZE * istart, GRID_TILE_SIZE * jstart);
-	int prev_height = 0;
-	for (int i = istart; i != iend; i += dx)
+	/// <summary>Counts cells that share a tile. A negative number of cells takes them back out.</summary>
+	void add(const Tile& tile, int cells)
 	{
-		for (int j = jstart; j != jend; j += dy)
+		if (!tile.type)
+			return;
+
+		total += tile.height * cells;
+		count += cells;
+
+		// Blocks only hold a few types, so a list is faster than a map
+		for (pair<const TileType*, int>& type : types)
 		{
-			if (true) // TODO check if visible
+			if (type.first == tile.type)
 			{
-				if (Tile* tile = m_Grid->get_tile(i, j))
-				{
-					const Tile* tx = m_Grid->get_tile(i + dx, j);
-					const Tile* ty = m_Grid->get_tile(i, j + dy);
+				type.second += cells;
+				return;
+			}
+		}
+		types.push_back({ tile.type, cells });
+	}
+};
+
+template <int DX, int DY>
+void Visibility::reset_lod_blocks()
+{
+	constexpr int direction = (DX < 0 ? 2 : 0) + (DY < 0 ? 1 : 0);
+	if (m_LodBuiltSize == m_Lod && m_LodBuiltDirection == direction && m_LodBuiltVersion == m_Grid->get_version())
+		return;
+
+	m_LodBlocks.clear();
+	m_LodBuiltSize = m_Lod;
+	m_LodBuiltDirection = direction;
+	m_LodBuiltVersion = m_Grid->get_version();
+
+	int columns = (m_Grid->width + m_Lod - 1) / m_Lod;
+	int rows = (m_Grid->height + m_Lod - 1) / m_Lod;
+
+	// Average the height of each block, and use its most common type as the sprite. Blocks are counted one row of
+	// blocks at a time, so only one row of tallies is needed
+	vector<float> heights(columns * rows, 0.f);
+	vector<const TileType*> types(columns * rows, nullptr);
+	vector<BlockTally> tallies(columns);
+
+	// On a grid stored as rectangles, whole runs of cells are counted at once, then the changed cells are corrected
+	bool compressed = m_Grid->is_compressed();
+	const vector<TileRegion>& regions = m_Grid->get_regions();
+	vector<vector<int>> changed;
+	if (compressed)
+	{
+		changed.resize(m_Grid->height);
+		for (const pair<const int, Tile>& cell : m_Grid->get_overrides())
+			changed[cell.first / m_Grid->width].push_back(cell.first);
+	}
 
-					m_VisibleTiles.push_back({
-						tile,
-						vec3f(trans, GRID_TILE_HEIGHT * (tile->height - prev_height)),
-						vec2i(tile->height - (tx ? tx->height : 0), tile->height - (ty ? ty->height : 0))
-					});
+	for (int bj = 0; bj < rows; ++bj)
+	{
+		for (BlockTally& tally : tallies)
+			tally.clear();
 
-					trans = vec2f();
-					prev_height = tile->height;
-				}
+		for (int j = bj * m_Lod; j < min((bj + 1) * m_Lod, m_Grid->height); ++j)
+		{
+			if (!compressed)
+			{
+				for (int i = 0; i < m_Grid->width; ++i)
+					tallies[i / m_Lod].add(*m_Grid->get_tile(i, j), 1);
+				continue;
+			}
+
+			for (const RegionRun& run : m_Grid->get_row_runs(j))
+			{
+				const Tile& tile = regions[run.region].tile;
+				for (int bi = run.x0 / m_Lod; bi * m_Lod < run.x1; ++bi)
+					tallies[bi].add(tile, min(run.x1, (bi + 1) * m_Lod) - max(run.x0, bi * m_Lod));
+			}
+
+			for (int k : changed[j])
+			{
+				int i = k % m_Grid->width;
+				tallies[i / m_Lod].add(*m_Grid->get_region_tile(i, j), -1);
+				tallies[i / m_Lod].add(m_Grid->get_overrides().at(k), 1);
 			}
+		}
+
+		for (int bi = 0; bi < columns; ++bi)
+		{
+			const BlockTally& tally = tallies[bi];
+			if (tally.count <= 0)
+				continue;
+
+			heights[bi + (columns * bj)] = (float)tally.total / tally.count;
 
-			trans.set(1, 0, trans.get(1) + (dy * GRID_TILE_SIZE));
+			int best = 0;
+			for (const pair<const TileType*, int>& type : tally.types)
+			{
+				if (type.second > best)
+				{
+					best = type.second;
+					types[bi + (columns * bj)] = type.first;
+				}
+			}
 		}
+	}
+
+	m_LodHeights = heights;
+	m_LodColumns = columns;
 
-		trans.set(0, 0, trans.get(0) + (dx * GRID_TILE_SIZE));
-		trans.set(1, 0, trans.get(1) + ((jstart - jend) * GRID_TILE_SIZE));
+	// Emit the blocks back to front, the same as individual tiles
+	int istart = DX < 0 ? columns - 1 : 0;
+	int iend = DX < 0 ? -1 : columns;
+	int jstart = DY < 0 ? rows - 1 : 0;
+	int jend = DY < 0 ? -1 : rows;
+
+	for (int bi = istart; bi != iend; bi += DX)
+	{
+		for (int bj = jstart; bj != jend; bj += DY)
+		{
+			int k = bi + (columns * bj);
+			if (!types[k])
+				continue;
+
+			// Only one neighbour of each pair can be missing, so each check folds to a single compare
+			bool has_x = DX > 0 ? bi + 1 < columns : bi > 0;
+			bool has_y = DY > 0 ? bj + 1 < rows : bj > 0;
+			float hx = has_x ? heights[k + DX] : 0.f;
+			float hy = has_y ? heights[k + (columns * DY)] : 0.f;
+
+			m_LodBlocks.push_back({
+				types[k],
+				vec3f(GRID_TILE_SIZE * m_Lod * bi, GRID_TILE_SIZE * m_Lod * bj, GRID_TILE_HEIGHT * heights[k]),
+				vec2i(min(m_Lod, m_Grid->width - (m_Lod * bi)), min(m_Lod, m_Grid->height - (m_Lod * bj))),
+				vec2f(heights[k] - hx, heights[k] - hy)
+			});
+		}
 	}
 }
 
@@ -368,11 +1092,67 @@ void Visibility::reset()
 {
 	m_TileSpriteSheet = m_Grid->get_tile_sprite_sheet();
 
+	// Size the highlights the first time the grid is seen, then place the selector on it
+	if ((int)m_Highlights.size() != m_Grid->width * m_Grid->height)
+	{
+		m_Highlights.assign(m_Grid->width * m_Grid->height, 0);
+		for (int k = 0; k < HIGHLIGHT_COUNT; ++k)
+		{
+			m_HighlightUsed[k] = false;
+			m_HighlightDirty[k] = true;
+		}
+
+		if (!m_Highlights.empty())
+		{
+			// The old tile is cleared before the new one is set, so it has to be on the grid too
+			int x = min(m_Selector.m_Tile.get(0), m_Grid->width - 1);
+			int y = min(m_Selector.m_Tile.get(1), m_Grid->height - 1);
+			m_Selector.m_Tile = vec2i(x, y);
+			m_Selector.set_tile(this, x, y);
+		}
+	}
+
 	// Reset the transform matrix
 	reset_transform();
 
-	// Reset which tiles are visible
+	// Check every chunk against the grid again
+	m_Built = false;
 	reset_visible_tiles();
+	reset_highlight_quads();
+}
+
+void Visibility::reset_highlight_quads()
+{
+	// Runs after the chunks and blocks are brought up to date, so the heights under the quads are final
+	bool moved = m_HighlightVersion != m_Grid->get_version() || m_HighlightLod != m_Lod;
+	m_HighlightVersion = m_Grid->get_version();
+	m_HighlightLod = m_Lod;
+
+	int width = m_Grid->width;
+	for (int k = 0; k < HIGHLIGHT_COUNT; ++k)
+	{
+		if (!m_HighlightDirty[k] && !moved)
+			continue;
+		m_HighlightDirty[k] = false;
+
+		vector<vec3f>& quads = m_HighlightQuads[k];
+		quads.clear();
+		if (!m_HighlightUsed[k])
+			continue;
+
+		uint8_t bit = 1 << k;
+		for (int n = 0; n < (int)m_Highlights.size(); ++n)
+		{
+			if (!(m_Highlights[n] & bit))
+				continue;
+
+			int i = n % width;
+			int j = n / width;
+			const Tile* tile = m_Grid->get_tile(i, j);
+			float theight = (tile->terrain ? tile->terrain->get_height() : 0) * GRID_TILE_HEIGHT;
+			quads.push_back(vec3f(GRID_TILE_SIZE * i, GRID_TILE_SIZE * j, get_ground_height(i, j, tile->height) + theight + HIGHLIGHT_BIAS));
+		}
+	}
 }
 
 void Visibility::adjust_angle(float adjustment)
@@ -412,8 +1192,21 @@ void Visibility::adjust_camera(vec3f adjustment)
 {
 	m_Camera += adjustment;
 
-	// TODO make this more efficient
-	reset();
+	// Every tile is drawn wherever the camera is, so only the transform changes
+	reset_transform();
+}
+
+void Visibility::adjust_zoom(float adjustment)
+{
+	m_Zoom += adjustment;
+
+	// Switch to coarser blocks as tiles get smaller on the screen
+	int lod = m_Lod;
+	m_Lod = m_Zoom < LOD_ZOOM_4 ? 4 : (m_Zoom < LOD_ZOOM_2 ? 2 : 1);
+
+	reset_transform();
+	if (m_Lod != lod)
+		reset();
 }
 
 void Visibility::rotate_left()
@@ -428,6 +1221,16 @@ void Visibility::rotate_right()
 		m_TargetAngle -= HALF_PI;
 }
 
+void Visibility::zoom_in()
+{
+	m_TargetZoom = min(m_TargetZoom * 2.f, ZOOM_MAX);
+}
+
+void Visibility::zoom_out()
+{
+	m_TargetZoom = max(m_TargetZoom * 0.5f, ZOOM_MIN);
+}
+
 void Visibility::set_selected_tile(int x, int y)
 {
 	m_Selector.set_tile(this, x, y);
@@ -455,8 +1258,164 @@ void Visibility::adjust_selected_tile(int dx, int dy)
 	);
 }
 
+bool Visibility::pick_tile(float sx, float sy, int& x, int& y) const
+{
+	// Every point along the ray has the same rotated x-coordinate u, and satisfies v * cos(TOP_DOWN_ANGLE) + z = c
+	float u = (sx - m_Picker.tx) * m_Picker.inv_zoom;
+	float c = (sy - m_Picker.ty) * m_Picker.inv_zoom;
+	float vcos = cosf(TOP_DOWN_ANGLE);
+
+	// The ray starts above the highest tile and moves away from the camera, with x and y increasing along (sin, cos)
+	float ox = m_Picker.cos * u;
+	float oy = -m_Picker.sin * u;
+	float dirx = m_Picker.sin;
+	float diry = m_Picker.cos;
+
+	// Clip the ray to the part that passes through the heights of the tiles
+	float vmin = (c - (m_MaxHeight * GRID_TILE_HEIGHT)) / vcos;
+	float vmax = (c - (m_MinHeight * GRID_TILE_HEIGHT)) / vcos;
+
+	// Clip the ray to the bounds of the grid
+	float bounds[2] = { (float)(m_Grid->width * GRID_TILE_SIZE), (float)(m_Grid->height * GRID_TILE_SIZE) };
+	float origin[2] = { ox, oy };
+	float dir[2] = { dirx, diry };
+	for (int k = 0; k < 2; ++k)
+	{
+		if (fabsf(dir[k]) < 1e-6f)
+		{
+			if (origin[k] < 0.f || origin[k] >= bounds[k])
+				return false;
+		}
+		else
+		{
+			float t0 = -origin[k] / dir[k];
+			float t1 = (bounds[k] - origin[k]) / dir[k];
+			if (t0 > t1) swap(t0, t1);
+
+			if (t0 > vmin) vmin = t0;
+			if (t1 < vmax) vmax = t1;
+		}
+	}
+	if (vmin >= vmax)
+		return false;
+
+	// Walk the ray through the grid one tile at a time
+	float px = (ox + (vmin * dirx)) / GRID_TILE_SIZE;
+	float py = (oy + (vmin * diry)) / GRID_TILE_SIZE;
+	int i = min(max((int)floorf(px), 0), m_Grid->width - 1);
+	int j = min(max((int)floorf(py), 0), m_Grid->height - 1);
+
+	int stepx = dirx > 0.f ? 1 : -1;
+	int stepy = diry > 0.f ? 1 : -1;
+
+	float inf = numeric_limits<float>::infinity();
+	float deltax = fabsf(dirx) < 1e-6f ? inf : GRID_TILE_SIZE / fabsf(dirx);
+	float deltay = fabsf(diry) < 1e-6f ? inf : GRID_TILE_SIZE / fabsf(diry);
+	float nextx = fabsf(dirx) < 1e-6f ? inf : vmin + ((((stepx > 0 ? i + 1 : i) * GRID_TILE_SIZE) - (ox + (vmin * dirx))) / dirx);
+	float nexty = fabsf(diry) < 1e-6f ? inf : vmin + ((((stepy > 0 ? j + 1 : j) * GRID_TILE_SIZE) - (oy + (vmin * diry))) / diry);
+
+	while (i >= 0 && i < m_Grid->width && j >= 0 && j < m_Grid->height)
+	{
+		float vexit = min(min(nextx, nexty), vmax);
+
+		// The ray hits the tile if it has dropped below the top of the tile by the time it leaves it
+		if (const Tile* tile = m_Grid->get_tile(i, j))
+		{
+			if (c - (vexit * vcos) <= tile->height * GRID_TILE_HEIGHT)
+			{
+				x = i;
+				y = j;
+				return true;
+			}
+		}
+
+		if (vexit >= vmax)
+			break;
+
+		if (nextx < nexty)
+		{
+			i += stepx;
+			nextx += deltax;
+		}
+		else
+		{
+			j += stepy;
+			nexty += deltay;
+		}
+	}
+
+	return false;
+}
+
+bool Visibility::select_tile_at(float sx, float sy)
+{
+	int x, y;
+	if (pick_tile(sx, sy, x, y))
+	{
+		set_selected_tile(x, y);
+		return true;
+	}
+	return false;
+}
+
+void Visibility::set_highlight(HighlightLayer layer, int x, int y, bool on)
+{
+	if (x < 0 || x >= m_Grid->width || y < 0 || y >= m_Grid->height || m_Highlights.empty())
+		return;
+
+	uint8_t& layers = m_Highlights[GRID_COORDINATE(x, y, m_Grid->width)];
+	uint8_t before = layers;
+	if (on)
+	{
+		layers |= 1 << layer;
+		m_HighlightUsed[layer] = true;
+	}
+	else
+	{
+		layers &= ~(1 << layer);
+	}
+
+	if (layers != before)
+		m_HighlightDirty[layer] = true;
+}
+
+void Visibility::set_highlight(HighlightLayer layer, const Bitboard& tiles)
+{
+	if (layer == HIGHLIGHT_SELECTED)
+		return;
+
+	clear_highlight(layer);
+	tiles.for_each([&](int x, int y)
+	{
+		if (x < m_Grid->width && y < m_Grid->height)
+			set_highlight(layer, x, y, true);
+	});
+}
+
+void Visibility::clear_highlight(HighlightLayer layer)
+{
+	if (layer == HIGHLIGHT_SELECTED || !m_HighlightUsed[layer])
+		return;
+
+	uint8_t mask = ~(1 << layer);
+	for (uint8_t& layers : m_Highlights)
+		layers &= mask;
+	m_HighlightUsed[layer] = false;
+	m_HighlightDirty[layer] = true;
+}
+
+void Visibility::set_fog(const Fog* fog, int faction)
+{
+	m_Fog = fog;
+	m_FogFaction = faction;
+}
+
 void Visibility::update(int frames_passed)
 {
+	// Rebuild the chunks whose tiles have changed since the last frame, then the highlights that changed or moved with them
+	reset_visible_tiles();
+	reset_highlight_quads();
+
 	if (m_TargetAngle < m_Angle)
 	{
 		adjust_angle(-frames_passed * ROTATE_SPEED);
@@ -496,12 +1455,44 @@ void Visibility::update(int frames_passed)
 			adjust_camera(frames_passed * CAMERA_SPEED * (m_TargetCamera - m_Camera));
 		}
 	}
+
+	if (m_TargetZoom != m_Zoom)
+	{
+		if (fabsf(m_TargetZoom - m_Zoom) < ZOOM_THRESHOLD)
+		{
+			adjust_zoom(m_TargetZoom - m_Zoom);
+		}
+		else
+		{
+			adjust_zoom(min(1.f, frames_passed * ZOOM_SPEED) * (m_TargetZoom - m_Zoom));
+		}
+	}
 }
 
+template <int DX, int DY>
+void Visibility::display_tiles() const
+{
+	if (m_Lod > 1)
+	{
+		for (const LodBlock& block : m_LodBlocks)
+			display_block<DX, DY>(block);
+	}
+	else
+	{
+		// Draw straight from the cached chunks, in painter's order
+		const vector<Chunk>& chunks = m_Chunks[m_Direction];
+		for (int c : m_ChunkOrder)
+			for (const VisibleTile& vtile : chunks[c].tiles)
+				display_tile<DX, DY>(vtile);
+	}
+}
+
+template <int DX, int DY>
 void Visibility::display_tile(const VisibleTile& vtile) const
 {
 	// Draw the ground of the tile
-	mat_translate(vtile.trans.get(0), vtile.trans.get(1), vtile.trans.get(2));
+	mat_push();
+	mat_translate(vtile.pos.get(0), vtile.pos.get(1), vtile.pos.get(2));
 	m_TileSpriteSheet->display(vtile.tile->type->top->key, m_Palette);
 
 	// Draw the sides of the tile
@@ -510,7 +1501,7 @@ void Visibility::display_tile(const VisibleTile& vtile) const
 	{
 		mat_push();
 
-		if (m_Angle < 0.f)//(dx > 0)
+		if constexpr (DX > 0)
 		{
 			mat_translate(GRID_TILE_SIZE, GRID_TILE_SIZE, 0.f);
 			mat_scale(1.f, -1.f, 1.f);
@@ -533,7 +1524,7 @@ void Visibility::display_tile(const VisibleTile& vtile) const
 	{
 		mat_push();
 
-		if (m_Angle > HALF_PI || m_Angle < -HALF_PI)//(dy > 0)
+		if constexpr (DY > 0)
 		{
 			mat_translate(GRID_TILE_SIZE, GRID_TILE_SIZE, 0.f);
 			mat_scale(-1.f, 1.f, 1.f);
@@ -543,52 +1534,195 @@ void Visibility::display_tile(const VisibleTile& vtile) const
 
 		for (int k = 0; k < dh; ++k)
 		{
-			mat_translate(0.f, -GRID_TILE_HEIGHT, 0.f);
-			m_TileSpriteSheet->display(vtile.tile->type->side->key, m_Palette);
+			mat_translate(0.f, -GRID_TILE_HEIGHT, 0.f);
+			m_TileSpriteSheet->display(vtile.tile->type->side->key, m_Palette);
+		}
+
+		mat_pop();
+	}
+
+	mat_pop();
+}
+
+template <int DX, int DY>
+void Visibility::display_block(const LodBlock& block) const
+{
+	float sx = (float)block.size.get(0);
+	float sy = (float)block.size.get(1);
+
+	mat_push();
+	mat_translate(block.pos.get(0), block.pos.get(1), block.pos.get(2));
+
+	// Draw the ground of the block as one big tile
+	mat_push();
+	mat_scale(sx, sy, 1.f);
+	m_TileSpriteSheet->display(block.type->top->key, m_Palette);
+	mat_pop();
+
+	// Draw each side as one stretched face, instead of one face per step of height
+	float dh = block.sides.get(0);
+	if (dh > 0.f)
+	{
+		mat_push();
+
+		if constexpr (DX > 0)
+		{
+			mat_translate(sx * GRID_TILE_SIZE, sy * GRID_TILE_SIZE, 0.f);
+			mat_scale(1.f, -1.f, 1.f);
+		}
+
+		// This face runs along the y-axis
+		mat_rotatez(1.5708f);
+		mat_rotatex(1.5708f);
+		mat_translate(0.f, -GRID_TILE_HEIGHT * dh, 0.f);
+		mat_scale(sy, dh, 1.f);
+		m_TileSpriteSheet->display(block.type->side->key, m_Palette);
+
+		mat_pop();
+	}
+
+	dh = block.sides.get(1);
+	if (dh > 0.f)
+	{
+		mat_push();
+
+		if constexpr (DY > 0)
+		{
+			mat_translate(sx * GRID_TILE_SIZE, sy * GRID_TILE_SIZE, 0.f);
+			mat_scale(-1.f, 1.f, 1.f);
+		}
+
+		mat_rotatex(1.5708f);
+		mat_translate(0.f, -GRID_TILE_HEIGHT * dh, 0.f);
+		mat_scale(sx, dh, 1.f);
+		m_TileSpriteSheet->display(block.type->side->key, m_Palette);
+
+		mat_pop();
+	}
+
+	mat_pop();
+}
+
+float Visibility::get_ground_height(int x, int y, int height) const
+{
+	if (m_Lod == 1 || m_LodBuiltSize != m_Lod)
+		return GRID_TILE_HEIGHT * height;
+
+	int bi = x / m_Lod;
+	int bj = y / m_Lod;
+	int k = bi + (m_LodColumns * bj);
+	if (bi >= m_LodColumns || k >= (int)m_LodHeights.size())
+		return GRID_TILE_HEIGHT * height;
+	return GRID_TILE_HEIGHT * m_LodHeights[k];
+}
+
+float Visibility::get_ground_height(const VisibleTile& vtile) const
+{
+	return get_ground_height(vtile.coords.get(0), vtile.coords.get(1), vtile.tile->height);
+}
+
+void Visibility::display_object(const VisibleTile& vtile) const
+{
+	float theight = (vtile.tile->terrain ? vtile.tile->terrain->get_height() : 0) * GRID_TILE_HEIGHT;
+
+	mat_push();
+	mat_translate(vtile.pos.get(0), vtile.pos.get(1), get_ground_height(vtile) + theight + OBJECT_BIAS);
+	vtile.tile->obj->display();
+	mat_pop();
+}
+
+void Visibility::display_highlights() const
+{
+	// Onion draws one graphic per call, so each layer is a single pass over its quads with the same overlay
+	for (int k = 0; k < HIGHLIGHT_COUNT; ++k)
+	{
+		const Graphic* overlay = m_HighlightGraphics[k];
+		for (const vec3f& pos : m_HighlightQuads[k])
+		{
+			mat_push();
+			mat_translate(pos.get(0), pos.get(1), pos.get(2));
+			overlay->display();
+			mat_pop();
 		}
-
-		mat_pop();
 	}
 }
 
-void Visibility::display_object(const VisibleTile& vtile) const
+/// <summary>Sorts draw items by key with an 8-bit radix sort, keeping items with equal keys in order.</summary>
+/// <param name="items">The items to sort.</param>
+/// <param name="scratch">Space for the sort to use. It is resized to match the items.</param>
+template <typename T>
+static void radix_sort(vector<T>& items, vector<T>& scratch)
 {
-	mat_translate(vtile.trans.get(0), vtile.trans.get(1), vtile.trans.get(2));
-
-	float theight = ((vtile.tile->terrain ? vtile.tile->terrain->get_height() : 0) * GRID_TILE_HEIGHT) + 0.01f;
+	int n = (int)items.size();
+	scratch.resize(n);
 
-	if (vtile.tile->obj)
+	for (int shift = 0; shift < 32; shift += 8)
 	{
-		mat_translate(0.f, 0.f, theight + 0.01f);
-		vtile.tile->obj->display();
+		int counts[256] = {};
+		for (const T& item : items)
+			++counts[(item.key >> shift) & 0xFF];
 
-		if (m_Selector.highlight_tile(this, vtile.tile))
-		{
-			mat_translate(0.f, 0.f, -0.01f);
-			m_Selector.display();
-			mat_translate(0.f, 0.f, -theight);
-		}
-		else
+		// Skip the pass if every item has the same digit
+		if (counts[(items[0].key >> shift) & 0xFF] == n)
+			continue;
+
+		int offset = 0;
+		for (int d = 0; d < 256; ++d)
 		{
-			mat_translate(0.f, 0.f, -theight - 0.01f);
+			int c = counts[d];
+			counts[d] = offset;
+			offset += c;
 		}
+
+		for (const T& item : items)
+			scratch[counts[(item.key >> shift) & 0xFF]++] = item;
+		items.swap(scratch);
 	}
-	else if (m_Selector.highlight_tile(this, vtile.tile))
+}
+
+void Visibility::sort_draw_items() const
+{
+	m_DrawItems.clear();
+
+	// Tiles further up the screen are further away
+	float cx = m_Picker.sin;
+	float cy = m_Picker.cos;
+	auto add = [&](const VisibleTile& vtile, DrawKind kind) {
+		float depth = (cx * vtile.pos.get(0)) + (cy * vtile.pos.get(1));
+
+		// Flip the float's bits so that they sort as an unsigned integer, then invert them so the furthest sorts first
+		uint32_t bits;
+		memcpy(&bits, &depth, sizeof(bits));
+		bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+		m_DrawItems.push_back({ (~bits & ~3u) | kind, &vtile });
+	};
+
+	const vector<Chunk>& chunks = m_Chunks[m_Direction];
+	for (int c : m_ChunkOrder)
+		for (int k : chunks[c].terrain)
+			add(chunks[c].tiles[k], DRAW_TERRAIN);
+
+	// Objects hidden in the fog aren't drawn
+	for (int c : m_ChunkOrder)
 	{
-		mat_translate(0.f, 0.f, theight);
-		m_Selector.display();
-		mat_translate(0.f, 0.f, -theight);
+		for (int k : chunks[c].objects)
+		{
+			const VisibleTile& vtile = chunks[c].tiles[k];
+			if (!m_Fog || m_Fog->is_visible(m_FogFaction, vtile.coords.get(0), vtile.coords.get(1)))
+				add(vtile, DRAW_OBJECT);
+		}
 	}
+
+	if (!m_DrawItems.empty())
+		radix_sort(m_DrawItems, m_DrawScratch);
 }
 
 void Visibility::display_terrain(const VisibleTile& vtile) const
 {
-	mat_translate(vtile.trans.get(0), vtile.trans.get(1), vtile.trans.get(2));
-
-	if (vtile.tile->terrain)
-	{
-		vtile.tile->terrain->display();
-	}
+	mat_push();
+	mat_translate(vtile.pos.get(0), vtile.pos.get(1), get_ground_height(vtile));
+	vtile.tile->terrain->display();
+	mat_pop();
 }
 
 void Visibility::display() const
@@ -597,26 +1731,35 @@ void Visibility::display() const
 	mat_push();
 	mat_custom_transform(m_Transform);
 
-	// Display the base of the tiles
+	// Display the base of the tiles, or blocks of tiles if zoomed out, choosing the direction once for the whole frame
 	mat_push();
-	auto iter = m_VisibleTiles.begin();
-	while (iter != m_VisibleTiles.end())
-		display_tile(*iter++);
+	switch (m_Direction)
+	{
+	case 0:	display_tiles<1, 1>();		break;
+	case 1:	display_tiles<1, -1>();		break;
+	case 2:	display_tiles<-1, 1>();		break;
+	case 3:	display_tiles<-1, -1>();	break;
+	}
 	mat_pop();
 
-	// Display the object on each tile
-	mat_push();
-	iter = m_VisibleTiles.begin();
-	while (iter != m_VisibleTiles.end())
-		display_object(*iter++);
-	mat_pop();
+	// The highlights lie flat on the ground, so they go under everything that stands on it
+	display_highlights();
 
-	// Display the terrain on each tile
-	mat_push();
-	iter = m_VisibleTiles.begin();
-	while (iter != m_VisibleTiles.end())
-		display_terrain(*iter++);
-	mat_pop();
+	// Display the terrain and objects over the tiles, back to front
+	sort_draw_items();
+	for (const DrawItem& item : m_DrawItems)
+	{
+		const VisibleTile& vtile = *item.tile;
+		switch (item.key & 3u)
+		{
+		case DRAW_TERRAIN:
+			display_terrain(vtile);
+			break;
+		case DRAW_OBJECT:
+			display_object(vtile);
+			break;
+		}
+	}
 
 	// Clean up the transform
 	mat_pop();
@@ -626,13 +1769,164 @@ void Visibility::display() const
 
 
 
-BattleState::BattleState(string map) : m_Grid(map), m_Visibility(m_Bounds, &m_Grid)
+// The largest width or height of the minimap image, in pixels.
+#define MINIMAP_SIZE			128
+
+// The largest width or height of the minimap on the screen, and its distance from the edges of the screen.
+#define MINIMAP_SCREEN_SIZE		160
+#define MINIMAP_MARGIN			16
+
+// Debug builds pick up changes to the map and tile set files while a battle runs. Define HOT_RELOAD to do it in other builds too
+#if !defined(NDEBUG) && !defined(HOT_RELOAD)
+#define HOT_RELOAD
+#endif
+
+BattleState::BattleState(string map) : BattleState(map, read_map(map))
+{
+	finish_loading();
+}
+
+BattleState::BattleState(string id, const Sim::Map& map) : m_Visibility(m_Bounds, &m_Grid), m_Grid(map), m_Threats(&m_Grid), m_Queue(&m_Scripts)
 {
+	// Battles start in Player Phase
+	m_Phase = true;
+
+	// The units are recorded on their tiles, so they are placed before the visible tiles are built
+	for (const Sim::Unit& u : map.units)
+	{
+		CombatStats stats = { u.attack, u.defense, u.accuracy, u.evasion };
+		UnitMovement movement = { u.move, u.climb };
+		UnitStatus status = { u.hp, u.hp, 0 };
+		m_Units.create(&m_Grid, u.faction, { u.x, u.y }, stats, movement, status, nullptr);
+	}
+
+	m_Combat.load(m_Units.get_spans(), m_Grid);
+	m_Combat.compute();
+
 	m_Visibility.reset();
+	update_threats();
+	m_Minimap = make_unique<Minimap>(&m_Grid, MINIMAP_SIZE);
+	m_Map = id;
+}
+
+void BattleState::finish_loading()
+{
+	m_Grid.load_graphics();
+	m_Visibility.load_graphics();
+
+	// The watcher looks up the tile set's atlas page, which is only read on the render thread
+	if (!m_Map.empty())
+		watch(m_Map);
 
 	unfreeze();
 }
 
+BattleState::BattleState(const Snapshot& snapshot) : m_Visibility(m_Bounds, &m_Grid), m_Grid(snapshot), m_Threats(&m_Grid), m_Queue(&m_Scripts)
+{
+	m_Phase = snapshot.get_phase();
+
+	m_Visibility.reset();
+	m_Minimap = make_unique<Minimap>(&m_Grid, MINIMAP_SIZE);
+
+	finish_loading();
+}
+
+BattleLoader::BattleLoader(string map)
+{
+	m_Map = map;
+	m_State = nullptr;
+}
+
+BattleLoader::~BattleLoader()
+{
+	// Only left over if the loader is thrown away before it finishes
+	delete m_State;
+}
+
+void BattleLoader::load()
+{
+	Sim::Map map;
+	if (!map.load("res/maps/" + m_Map + ".txt"))
+	{
+		m_Error = "The map " + m_Map + " couldn't be read.";
+		m_Progress = 1.f;
+		return;
+	}
+	m_Progress = 0.25f;
+
+	// Everything but the graphics is built here: the grid, the visible tiles and the minimap
+	m_State = new BattleState(m_Map, map);
+	m_Progress = 1.f;
+}
+
+State* BattleLoader::finish()
+{
+	if (!m_State)
+		return nullptr;
+
+	BattleState* state = m_State;
+	m_State = nullptr;
+	state->finish_loading();
+	return state;
+}
+
+void BattleState::watch(string map)
+{
+	m_Map = map;
+#ifdef HOT_RELOAD
+	m_Watcher = make_unique<MapWatcher>(map, m_Grid.get_tile_set()->get_id());
+#endif
+}
+
+void BattleState::hot_reload()
+{
+	if (!m_Watcher)
+		return;
+
+	bool map_changed, tiles_changed;
+	m_Watcher->poll(map_changed, tiles_changed);
+
+	// The types are updated in place, but the old sheet is deleted, so everything drawn from it fetches the new one
+	const string& tileset = m_Grid.get_tile_set()->get_id();
+	if (tiles_changed && TileSet::reload_tile_set(tileset))
+	{
+		Object::reload_object_graphics(ResourceCache::get_sheet_path("tiles/" + tileset + ".png"));
+		m_Visibility.load_graphics();
+		m_Visibility.reset();
+		m_Minimap->load_colors();
+	}
+
+	if (map_changed)
+	{
+		int changed = m_Grid.reload(m_Map);
+		if (changed < 0)
+			cout << "The map changed size, so it can't be reloaded while the battle is running.";
+		else if (changed > 0)
+		{
+			// Only the chunks with changed tiles are rebuilt
+			m_Watcher->set_tile_set(m_Grid.get_tile_set()->get_id());
+			m_Grid.load_graphics();
+			m_Visibility.load_graphics();
+			m_Visibility.reset();
+			m_Minimap->load_colors();
+
+			// Heights and blocked tiles change where enemies can reach
+			update_threats();
+		}
+	}
+}
+
+bool BattleState::save(string path)
+{
+	// Don't start a new save until the last one has been written
+	if (m_Saving.valid() && m_Saving.wait_for(chrono::seconds(0)) != future_status::ready)
+		return false;
+
+	// Capture the battle on this thread, then encode and write it on another
+	m_Saving = Snapshot(m_Grid, m_Phase).save_async(path);
+	return true;
+}
+
 void BattleState::__set_bounds()
 {
 	m_Transform.set(0, 0, 2.f / get_width());
@@ -647,14 +1941,113 @@ void BattleState::__display() const
 
 	// Draw the grid
 	m_Visibility.display();
+
+	// Draw the minimap in the top right corner, scaled to fit its box
+	float pixel_size = (float)MINIMAP_SCREEN_SIZE / max(1, max(m_Minimap->get_width(), m_Minimap->get_height()));
+	mat_push();
+	mat_translate((0.5f * get_width()) - MINIMAP_MARGIN - (pixel_size * m_Minimap->get_width()), (0.5f * get_height()) - MINIMAP_MARGIN - (pixel_size * m_Minimap->get_height()), 0.f);
+	m_Minimap->display(pixel_size);
+	mat_pop();
 	
 	mat_pop();
 }
 
 void BattleState::__update(int frames_passed)
 {
+	hot_reload();
+
 	m_Visibility.update(frames_passed);
+
+	// Only the chunks that changed are redrawn, and the image is only uploaded again if a pixel changed
+	if (m_Minimap->update())
+		m_Minimap->upload();
+
+	// Run the scripts first, so that events finishing this frame let the next events start straight away
+	m_Scripts.update(frames_passed);
 	m_Queue.update();
+
+	if (m_Queue.empty())
+	{
+		// Once the events have played out, the units are where they will stay until something else happens
+		if (!m_Events.empty())
+		{
+			m_Events.clear();
+			update_threats();
+		}
+
+		// The enemy has no AI yet, so its phase ends once its events have played out
+		if (!m_Phase)
+			end_phase();
+	}
+}
+
+void BattleState::update_threats()
+{
+	Sim::UnitSpans units = m_Units.get_spans();
+
+	// Units may have moved or died, which also changes which tiles block the others
+	m_Threats.invalidate();
+	for (int k = (int)m_ThreatHandles.size() - 1; k >= 0; --k)
+	{
+		int index = m_Units.index_of(m_ThreatHandles[k].first);
+		if (index >= 0)
+		{
+			m_Threats.move_threat(m_ThreatHandles[k].second, units.positions[index].x, units.positions[index].y);
+		}
+		else
+		{
+			m_Threats.remove_threat(m_ThreatHandles[k].second);
+			m_ThreatHandles[k] = m_ThreatHandles.back();
+			m_ThreatHandles.pop_back();
+		}
+	}
+
+	// Add the enemy units that aren't tracked yet. Every unit attacks the tiles next to it for now
+	for (int k = 0; k < m_Units.size(); ++k)
+	{
+		Entity unit = m_Units.entity_at(k);
+		if (units.factions[k] == 0 || any_of(m_ThreatHandles.begin(), m_ThreatHandles.end(), [&](const pair<Entity, int>& t) { return t.first == unit; }))
+			continue;
+
+		int threat = m_Threats.add_threat(units.positions[k].x, units.positions[k].y, units.movement[k].move, units.movement[k].climb, 1);
+		m_ThreatHandles.push_back({ unit, threat });
+	}
+
+	m_Threats.update();
+
+	Bitboard threatened(m_Grid.width, m_Grid.height);
+	for (int j = 0; j < m_Grid.height; ++j)
+		for (int i = 0; i < m_Grid.width; ++i)
+			if (m_Threats.get_threat(i, j) > 0)
+				threatened.set(i, j, true);
+	m_Visibility.set_highlight(Visibility::HIGHLIGHT_THREAT, threatened);
+}
+
+void BattleState::end_phase()
+{
+	m_Phase = !m_Phase;
+	int faction = m_Phase ? 0 : 1;
+
+	// Every effect of a type is applied in one pass, and only what the player can see becomes an event
+	m_StatusResults.clear();
+	m_StatusEffects.tick(m_Units, faction, m_StatusResults);
+
+	for (const StatusResult& result : m_StatusResults)
+	{
+		m_Events.push_back(make_unique<HealthChangeEvent>(&m_Units, result.unit, result.hp, &m_Visibility));
+		m_Queue.push(m_Events.back().get(), 0);
+
+		// The unit's own events run in order, so it is removed after its health is shown
+		if (result.died)
+		{
+			m_Events.push_back(make_unique<DeathEvent>(&m_Units, result.unit, &m_Grid));
+			m_Queue.push(m_Events.back().get(), 0);
+		}
+	}
+
+	// Buffs and debuffs that wore off changed the stats
+	m_Combat.load(m_Units.get_spans(), m_Grid);
+	m_Combat.compute();
 }
 
 void BattleState::freeze()
@@ -685,6 +2078,18 @@ int BattleState::trigger(const KeyEvent& event_data)
 			return EVENT_STOP;
 		}
 
+		// Controls to zoom the camera
+		if (event_data.control == CONTROL_ZOOM_IN)
+		{
+			m_Visibility.zoom_in();
+			return EVENT_STOP;
+		}
+		if (event_data.control == CONTROL_ZOOM_OUT)
+		{
+			m_Visibility.zoom_out();
+			return EVENT_STOP;
+		}
+
 		if (m_Phase)
 		{
 			if (false) // Ally has been selected
@@ -714,6 +2119,12 @@ int BattleState::trigger(const KeyEvent& event_data)
 					m_Visibility.adjust_selected_tile(0, 1);
 					break;
 
+				// Hand over to the enemy, once everything queued has played out
+				case CONTROL_END_PHASE:
+					if (m_Queue.empty())
+						end_phase();
+					break;
+
 				// Select a character to use
 				case CONTROL_SELECT:
 				{
@@ -740,35 +2151,27 @@ bool Battle::Object::m_IsObjectDataLoaded{ false };
 
 unordered_map<string, unordered_map<string, string>*> Battle::Object::m_ObjectData{};
 
+mutex Battle::Object::m_ObjectDataMutex{};
+
 unordered_map<string, Battle::Object*> Battle::Object::m_Objects{};
 
 Battle::Object::Object(std::string id)
 {
+	m_ID = id;
 	m_Objects.emplace(id, this);
 }
 
 Battle::Object* Battle::Object::get_object(std::string id)
 {
+	// Load the object data, if it hasn't been loaded already.
+	load_object_data();
+	lock_guard<mutex> lock(m_ObjectDataMutex);
+
 	// Check if the object has already been loaded.
 	auto iter = m_Objects.find(id);
 	if (iter != m_Objects.end())
 		return iter->second;
 
-	// Load the object data, if it hasn't been loaded already.
-	if (!m_IsObjectDataLoaded)
-	{
-		LoadFile file("res/data/objects.txt");
-
-		while (file.good())
-		{
-			unordered_map<string, string>* data = new unordered_map<string, string>();
-			string id = file.load_data(*data);
-			m_ObjectData.emplace(id, data);
-		}
-
-		m_IsObjectDataLoaded = true;
-	}
-
 	// Load the object
 	Battle::Object* obj = nullptr;
 
@@ -795,6 +2198,47 @@ Battle::Object* Battle::Object::get_object(std::string id)
 	return obj;
 }
 
+void Battle::Object::load_object_data()
+{
+	lock_guard<mutex> lock(m_ObjectDataMutex);
+	if (m_IsObjectDataLoaded)
+		return;
+
+	LoadFile file("res/data/objects.txt");
+
+	while (file.good())
+	{
+		unordered_map<string, string>* data = new unordered_map<string, string>();
+		string id = file.load_data(*data);
+		m_ObjectData.emplace(id, data);
+	}
+
+	m_IsObjectDataLoaded = true;
+}
+
+void Battle::Object::load_object_graphics()
+{
+	lock_guard<mutex> lock(m_ObjectDataMutex);
+	for (auto& iter : m_Objects)
+		iter.second->load_graphics();
+}
+
+void Battle::Object::reload_object_graphics(const string& sheet)
+{
+	lock_guard<mutex> lock(m_ObjectDataMutex);
+	for (auto& iter : m_Objects)
+		iter.second->reload_graphics(sheet);
+}
+
+void Battle::Object::load_graphics() {}
+
+void Battle::Object::reload_graphics(const string& sheet) {}
+
+const string& Battle::Object::get_id() const
+{
+	return m_ID;
+}
+
 
 BillboardedObject::BillboardedObject(string id, SpriteGraphic* sprite) : Battle::Object(id)
 {
@@ -803,6 +2247,9 @@ BillboardedObject::BillboardedObject(string id, SpriteGraphic* sprite) : Battle:
 
 void BillboardedObject::display() const
 {
+	if (!m_Sprite)
+		return;
+
 	mat_push();
 	mat_translate(0.5f * GRID_TILE_SIZE, 0.5f * GRID_TILE_SIZE, 0.0001f);
 	//mat_scale(1.154700538f, 1.f, 1.f);
@@ -817,11 +2264,46 @@ void BillboardedObject::display() const
 
 StaticObject::StaticObject(string id, string sprite_sheet, string sprite) : BillboardedObject(id, nullptr)
 {
-	SpriteSheet* ssheet = SpriteSheet::generate(sprite_sheet.c_str());
-	Sprite* spr = Sprite::get_sprite(sprite);
+	// Objects can be created on a loader's worker thread, so the sprite is made later, on the render thread
+	m_SpriteSheet = sprite_sheet;
+	m_SpriteName = sprite;
+}
+
+void StaticObject::load_graphics()
+{
+	if (m_Sprite)
+		return;
 
-	Palette* palette = new SinglePalette(vec4f(1.f, 0.f, 0.f, 0.f), vec4f(0.f, 1.f, 0.f, 0.f), vec4f(0.f, 0.f, 1.f, 0.f));
-	m_Sprite = new StaticSpriteGraphic(ssheet, spr, palette);
+	SpriteSheet* ssheet = ResourceCache::get_sprite_sheet(m_SpriteSheet);
+	Sprite* spr = Sprite::get_sprite(m_SpriteName);
+
+	m_Sprite = new StaticSpriteGraphic(ssheet, spr, ResourceCache::get_default_palette());
+}
+
+void StaticObject::reload_graphics(const string& sheet)
+{
+	if (!m_Sprite || ResourceCache::get_sheet_path(m_SpriteSheet) != sheet)
+		return;
+
+	// The sprite was made by load_graphics, so it is deleted as what it was made as
+	delete static_cast<StaticSpriteGraphic*>(m_Sprite);
+	m_Sprite = nullptr;
+	load_graphics();
+}
+
+
+
+
+const Event::Resource Event::CAMERA{ &Event::CAMERA };
+
+int Terrain::get_defense() const
+{
+	return 0;
+}
+
+int Terrain::get_evasion() const
+{
+	return 0;
 }
 
 
@@ -837,12 +2319,93 @@ int Event::update()
 	return EVENT_STOP;
 }
 
+Script Event::run()
+{
+	if (start() == EVENT_STOP)
+		co_return;
+
+	// The first update comes on the frame after the event starts
+	do
+	{
+		co_await wait_frames(1);
+	} while (update() != EVENT_STOP);
+}
+
+bool Event::get_resources(vector<Resource>& /*resources*/) const
+{
+	return false;
+}
+
+
+HealthChangeEvent::HealthChangeEvent(const UnitStore* units, Entity unit, int change, Visibility* visibility)
+{
+	m_Units = units;
+	m_Unit = unit;
+	m_Change = change;
+	m_Visibility = visibility;
+}
+
+Script HealthChangeEvent::run()
+{
+	int index = m_Units->index_of(m_Unit);
+	if (index < 0)
+		co_return;
+
+	UnitPosition pos = m_Units->get_positions()[index];
+	Visibility::HighlightLayer layer = m_Change < 0 ? Visibility::HIGHLIGHT_DAMAGE : Visibility::HIGHLIGHT_HEAL;
+
+	m_Visibility->set_highlight(layer, pos.x, pos.y, true);
+	co_await wait_frames(FRAMES);
+	m_Visibility->set_highlight(layer, pos.x, pos.y, false);
+}
+
+bool HealthChangeEvent::get_resources(vector<Resource>& resources) const
+{
+	resources.push_back(m_Units->get_resource(m_Unit));
+	return true;
+}
+
+
+DeathEvent::DeathEvent(UnitStore* units, Entity unit, Grid* grid)
+{
+	m_Units = units;
+	m_Unit = unit;
+	m_Grid = grid;
+}
+
+int DeathEvent::start()
+{
+	m_Units->destroy(m_Unit, m_Grid);
+	return EVENT_STOP;
+}
+
+bool DeathEvent::get_resources(vector<Resource>& resources) const
+{
+	resources.push_back(m_Units->get_resource(m_Unit));
+	return true;
+}
+
+
+Queue::Queue(Scheduler* scheduler)
+{
+	m_Scheduler = scheduler;
+}
+
+Script Queue::play(EventPriority& entry)
+{
+	co_await entry.event->run();
+	entry.finished = true;
+}
+
 
 void Queue::push(Event* event, int priority)
 {
+	EventPriority entry = { event, priority, {}, false, false };
+	entry.exclusive = !event->get_resources(entry.resources);
+
 	if (m_Queue.empty())
 	{
-		m_Queue.push_back({ event, priority });
+		m_Queue.push_back(entry);
 	}
 	else
 	{
@@ -852,7 +2415,7 @@ void Queue::push(Event* event, int priority)
 			// If priority is before the front, insert before the first item
 			if (priority < m_Queue.front().priority)
 			{
-				m_Queue.push_front({ event, priority });
+				m_Queue.push_front(entry);
 			}
 
 			// Search the list for where to insert it
@@ -862,7 +2425,7 @@ void Queue::push(Event* event, int priority)
 				{
 					if (priority < iter->priority)
 					{
-						m_Queue.insert(iter, { event, priority });
+						m_Queue.insert(iter, entry);
 						break;
 					}
 				}
@@ -875,7 +2438,7 @@ void Queue::push(Event* event, int priority)
 			// If priority is after the back, insert after the last item
 			if (priority > m_Queue.back().priority)
 			{
-				m_Queue.push_back({ event, priority });
+				m_Queue.push_back(entry);
 			}
 
 			// Search the list for where to insert it
@@ -887,7 +2450,7 @@ void Queue::push(Event* event, int priority)
 					--iter;
 					if (priority >= iter->priority)
 					{
-						m_Queue.insert(++iter, { event, priority });
+						m_Queue.insert(++iter, entry);
 						break;
 					}
 				}
@@ -906,15 +2469,77 @@ Event* Queue::pop()
 	return e;
 }
 
-void Queue::update()
+bool Queue::empty() const
 {
-	if (m_Current)
+	return m_Queue.empty() && m_Running.empty();
+}
+
+void Queue::start_events()
+{
+	// Gather what the running events are using
+	bool exclusive = false;
+	unordered_set<Event::Resource> used;
+	for (const EventPriority& e : m_Running)
+	{
+		exclusive |= e.exclusive;
+		used.insert(e.resources.begin(), e.resources.end());
+	}
+
+	// Walk the queue in priority order. Events left waiting also hold their resources, so conflicting events keep their order
+	auto iter = m_Queue.begin();
+	while (iter != m_Queue.end() && !exclusive)
 	{
-		// If the current event has reached its end, pop the next event from the queue
-		if (m_Current->update() == EVENT_STOP)
+		bool conflict = false;
+		for (Event::Resource r : iter->resources)
+		{
+			if (used.count(r))
+			{
+				conflict = true;
+				break;
+			}
+		}
+
+		if (iter->exclusive)
+		{
+			// An exclusive event waits until it is at the front with nothing running, and everything after it waits for it
+			if (iter != m_Queue.begin() || !m_Running.empty())
+				break;
+
+			m_Running.splice(m_Running.end(), m_Queue, iter);
+			m_Scheduler->start(play(m_Running.back()));
+
+			// Events that end as soon as they start don't hold up the rest of the queue
+			if (!m_Running.back().finished)
+				break;
+			m_Running.pop_back();
+			iter = m_Queue.begin();
+			continue;
+		}
+
+		if (conflict)
+		{
+			used.insert(iter->resources.begin(), iter->resources.end());
+			++iter;
+		}
+		else
 		{
-			// Loop while the next event ends after its start function
-			while ((m_Current = pop()) != nullptr && m_Current->start() == EVENT_STOP) {}
+			// Events that end as soon as they start don't need to be kept around
+			auto next = std::next(iter);
+			m_Running.splice(m_Running.end(), m_Queue, iter);
+			m_Scheduler->start(play(m_Running.back()));
+			if (m_Running.back().finished)
+				m_Running.pop_back();
+			else
+				used.insert(m_Running.back().resources.begin(), m_Running.back().resources.end());
+			iter = next;
 		}
 	}
-}
\ No newline at end of file
+}
+
+void Queue::update()
+{
+	// The scheduler has already run this frame's part of each event, so only the ones that have ended are removed
+	m_Running.remove_if([](const EventPriority& e) { return e.finished; });
+
+	start_events();
+}
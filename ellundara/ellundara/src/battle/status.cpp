@@ -0,0 +1,98 @@
+#include <algorithm>
+#include "../../include/battle.h"
+
+using namespace std;
+using namespace Battle;
+
+
+void StatusEffects::EffectArray::remove(int k)
+{
+	units[k] = units.back();
+	amounts[k] = amounts.back();
+	turns[k] = turns.back();
+
+	units.pop_back();
+	amounts.pop_back();
+	turns.pop_back();
+}
+
+int* StatusEffects::get_stat(CombatStats& stats, StatusType type)
+{
+	switch (type)
+	{
+	case StatusType::ATTACK:	return &stats.attack;
+	case StatusType::DEFENSE:	return &stats.defense;
+	case StatusType::ACCURACY:	return &stats.accuracy;
+	case StatusType::EVASION:	return &stats.evasion;
+	default:					return nullptr;
+	}
+}
+
+void StatusEffects::add(UnitStore& units, Entity unit, StatusType type, int amount, int turns)
+{
+	int index = units.index_of(unit);
+	if (index < 0 || turns <= 0)
+		return;
+
+	if (int* stat = get_stat(units.get_stats()[index], type))
+		*stat += amount;
+
+	EffectArray& effects = m_Effects[(int)type];
+	effects.units.push_back(unit);
+	effects.amounts.push_back(amount);
+	effects.turns.push_back(turns);
+}
+
+void StatusEffects::tick(UnitStore& units, int faction, vector<StatusResult>& results)
+{
+	span<UnitStatus> status = units.get_status();
+	span<CombatStats> stats = units.get_stats();
+	span<const int> factions = units.get_factions();
+
+	for (int t = 0; t < (int)StatusType::COUNT; ++t)
+	{
+		StatusType type = (StatusType)t;
+		EffectArray& effects = m_Effects[t];
+		bool health = type == StatusType::POISON || type == StatusType::REGENERATION;
+
+		// Walk backwards, so that removing an effect doesn't skip the one moved into its place
+		for (int k = (int)effects.units.size() - 1; k >= 0; --k)
+		{
+			int index = units.index_of(effects.units[k]);
+			if (index < 0)
+			{
+				effects.remove(k);
+				continue;
+			}
+			if (factions[index] != faction)
+				continue;
+
+			UnitStatus& s = status[index];
+			if (health && s.hp > 0)
+			{
+				int before = s.hp;
+				if (type == StatusType::POISON)
+					s.hp = max(0, s.hp - effects.amounts[k]);
+				else
+					s.hp = min(s.max_hp, s.hp + effects.amounts[k]);
+
+				// Only changes the player can see become results
+				if (s.hp != before)
+					results.push_back({ effects.units[k], type, s.hp - before, s.hp == 0 });
+			}
+
+			if (--effects.turns[k] <= 0)
+			{
+				// Undo the buff or debuff as it wears off
+				if (int* stat = get_stat(stats[index], type))
+					*stat -= effects.amounts[k];
+				effects.remove(k);
+			}
+		}
+	}
+}
+
+int StatusEffects::count(StatusType type) const
+{
+	return (int)m_Effects[(int)type].units.size();
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstdlib>
+#include "../../include/battle.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+// Below this many enemies to recalculate, the threat is calculated without starting any threads.
+#define THREAT_THREAD_BATCH 8
+
+using namespace std;
+using namespace Battle;
+
+
+ThreatMap::ThreatMap(const Grid* grid)
+{
+	m_Grid = grid;
+	m_Counts.assign(grid->width * grid->height, 0);
+
+	m_Batch = 0;
+	m_Busy = 0;
+	m_Stopping = false;
+	m_Scratch.resize(1);
+}
+
+ThreatMap::~ThreatMap()
+{
+	{
+		lock_guard<mutex> lock(m_WorkMutex);
+		m_Stopping = true;
+	}
+	m_WorkReady.notify_all();
+
+	for (thread& w : m_Workers)
+		w.join();
+}
+
+void ThreatMap::compute(Threat& threat, Scratch& scratch) const
+{
+	Bitboard& reach = threat.next;
+	if (reach.get_width() != m_Grid->width || reach.get_height() != m_Grid->height)
+		reach = Bitboard(m_Grid->width, m_Grid->height);
+	else
+		reach.clear();
+
+	// An enemy off the grid threatens nothing
+	if (threat.x < 0 || threat.x >= m_Grid->width || threat.y < 0 || threat.y >= m_Grid->height)
+		return;
+	const Bitboard& passable = m_Grid->get_passable();
+	const Bitboard& occupied = m_Grid->get_occupied();
+
+	// Flood out over the box of tiles the enemy could possibly reach
+	int x0 = max(0, threat.x - threat.move);
+	int y0 = max(0, threat.y - threat.move);
+	int w = min(m_Grid->width - 1, threat.x + threat.move) - x0 + 1;
+	int h = min(m_Grid->height - 1, threat.y + threat.move) - y0 + 1;
+
+	vector<int>& distance = scratch.distance;
+	vector<int>& frontier = scratch.frontier;
+	distance.assign(w * h, -1);
+	frontier.clear();
+
+	distance[GRID_COORDINATE(threat.x - x0, threat.y - y0, w)] = 0;
+	frontier.push_back(GRID_COORDINATE(threat.x - x0, threat.y - y0, w));
+
+	const int dx[4] = { 1, -1, 0, 0 };
+	const int dy[4] = { 0, 0, 1, -1 };
+
+	for (size_t k = 0; k < frontier.size(); ++k)
+	{
+		int c = frontier[k];
+		int cx = x0 + (c % w);
+		int cy = y0 + (c / w);
+		reach.set(cx, cy, true);
+
+		if (distance[c] >= threat.move)
+			continue;
+
+		int ch = m_Grid->get_tile(cx, cy)->height;
+		for (int n = 0; n < 4; ++n)
+		{
+			int nx = cx + dx[n];
+			int ny = cy + dy[n];
+			if (nx < x0 || nx >= x0 + w || ny < y0 || ny >= y0 + h)
+				continue;
+			if (!passable.get(nx, ny) || occupied.get(nx, ny))
+				continue;
+			if (abs(m_Grid->get_tile(nx, ny)->height - ch) > threat.climb)
+				continue;
+
+			int nc = GRID_COORDINATE(nx - x0, ny - y0, w);
+			if (distance[nc] < 0)
+			{
+				distance[nc] = distance[c] + 1;
+				frontier.push_back(nc);
+			}
+		}
+	}
+
+	// Anywhere within range of a reachable tile can be attacked
+	reach.grow(threat.range, scratch.grow);
+}
+
+void ThreatMap::apply(const Bitboard& area, int delta)
+{
+	int width = m_Grid->width;
+	area.for_each([this, width, delta](int x, int y) {
+		m_Counts[GRID_COORDINATE(x, y, width)] += delta;
+	});
+}
+
+int ThreatMap::add_threat(int x, int y, int move, int climb, int range)
+{
+	// Reuse the handle of a removed enemy, if there is one
+	int handle = 0;
+	while (handle < (int)m_Threats.size() && m_Threats[handle].active)
+		++handle;
+	if (handle == (int)m_Threats.size())
+		m_Threats.push_back(Threat());
+
+	Threat& threat = m_Threats[handle];
+	threat.active = true;
+	threat.dirty = true;
+	threat.x = x;
+	threat.y = y;
+	threat.move = move;
+	threat.climb = climb;
+	threat.range = range;
+	threat.area = Bitboard(m_Grid->width, m_Grid->height);
+	return handle;
+}
+
+void ThreatMap::move_threat(int threat, int x, int y)
+{
+	Threat& t = m_Threats[threat];
+	if (t.x != x || t.y != y)
+	{
+		t.x = x;
+		t.y = y;
+		t.dirty = true;
+	}
+}
+
+void ThreatMap::remove_threat(int threat)
+{
+	Threat& t = m_Threats[threat];
+	apply(t.area, -1);
+	t.area.clear();
+	t.active = false;
+	t.dirty = false;
+}
+
+void ThreatMap::invalidate()
+{
+	for (Threat& t : m_Threats)
+		if (t.active)
+			t.dirty = true;
+}
+
+void ThreatMap::run_batch(Scratch& scratch)
+{
+	int k;
+	while ((k = m_Next++) < (int)m_Dirty.size())
+		compute(m_Threats[m_Dirty[k]], scratch);
+}
+
+void ThreatMap::work(int worker)
+{
+	unsigned int batch = 0;
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(m_WorkMutex);
+			m_WorkReady.wait(lock, [&]() { return m_Stopping || m_Batch != batch; });
+			if (m_Stopping)
+				return;
+			batch = m_Batch;
+		}
+
+		run_batch(m_Scratch[worker]);
+
+		lock_guard<mutex> lock(m_WorkMutex);
+		if (--m_Busy == 0)
+			m_WorkDone.notify_one();
+	}
+}
+
+void ThreatMap::update()
+{
+	m_Dirty.clear();
+	for (int k = 0; k < (int)m_Threats.size(); ++k)
+		if (m_Threats[k].dirty)
+			m_Dirty.push_back(k);
+
+	if (m_Dirty.empty())
+		return;
+
+	// Each enemy's threat only reads the grid and writes its own tiles, so they can all be calculated at once
+	m_Next = 0;
+	if ((int)m_Dirty.size() < THREAT_THREAD_BATCH || thread::hardware_concurrency() <= 1)
+	{
+		run_batch(m_Scratch.back());
+	}
+	else
+	{
+		// Start the workers the first time they are needed, and keep them for later updates
+		if (m_Workers.empty())
+		{
+			int count = (int)thread::hardware_concurrency() - 1;
+			m_Scratch.resize(count + 1);
+			for (int t = 0; t < count; ++t)
+				m_Workers.emplace_back(&ThreatMap::work, this, t);
+		}
+
+		{
+			lock_guard<mutex> lock(m_WorkMutex);
+			m_Busy = (int)m_Workers.size();
+			++m_Batch;
+		}
+		m_WorkReady.notify_all();
+
+		run_batch(m_Scratch.back());
+
+		unique_lock<mutex> lock(m_WorkMutex);
+		m_WorkDone.wait(lock, [&]() { return m_Busy == 0; });
+	}
+
+	// Swap out the old threat for the new one
+	for (int k : m_Dirty)
+	{
+		Threat& t = m_Threats[k];
+		apply(t.area, -1);
+		apply(t.next, 1);
+		swap(t.area, t.next);
+		t.dirty = false;
+	}
+}
+
+int ThreatMap::get_threat(int x, int y) const
+{
+	if (x < 0 || x >= m_Grid->width || y < 0 || y >= m_Grid->height)
+		return 0;
+	return m_Counts[GRID_COORDINATE(x, y, m_Grid->width)];
+}
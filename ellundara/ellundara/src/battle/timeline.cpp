@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <climits>
+#include <queue>
+#include "../../include/battle.h"
+
+using namespace std;
+using namespace Battle;
+
+
+Timeline::Timeline()
+{
+	m_Time = 0;
+	m_NextOrder = 0;
+}
+
+bool Timeline::before(int a, int b) const
+{
+	const Entry& ea = m_Entries[a];
+	const Entry& eb = m_Entries[b];
+	if (ea.ready != eb.ready)
+		return ea.ready < eb.ready;
+	return ea.order < eb.order;
+}
+
+void Timeline::sift_up(int pos)
+{
+	int handle = m_Heap[pos];
+	while (pos > 0)
+	{
+		int parent = (pos - 1) / 2;
+		if (!before(handle, m_Heap[parent]))
+			break;
+
+		m_Heap[pos] = m_Heap[parent];
+		m_Entries[m_Heap[pos]].heap = pos;
+		pos = parent;
+	}
+
+	m_Heap[pos] = handle;
+	m_Entries[handle].heap = pos;
+}
+
+void Timeline::sift_down(int pos)
+{
+	int handle = m_Heap[pos];
+	int size = (int)m_Heap.size();
+	while (true)
+	{
+		int child = (2 * pos) + 1;
+		if (child >= size)
+			break;
+		if (child + 1 < size && before(m_Heap[child + 1], m_Heap[child]))
+			++child;
+		if (!before(m_Heap[child], handle))
+			break;
+
+		m_Heap[pos] = m_Heap[child];
+		m_Entries[m_Heap[pos]].heap = pos;
+		pos = child;
+	}
+
+	m_Heap[pos] = handle;
+	m_Entries[handle].heap = pos;
+}
+
+long long Timeline::ready_time(const Entry& entry)
+{
+	if (entry.charge >= CHARGE_TO_ACT)
+		return entry.updated;
+	if (entry.speed <= 0)
+		return LLONG_MAX;
+
+	// Round up, since the actor can't act until it has all of the charge
+	return entry.updated + ((CHARGE_TO_ACT - entry.charge + entry.speed - 1) / entry.speed);
+}
+
+int Timeline::add_actor(int speed, int charge)
+{
+	// Reuse the handle of a removed entry, if there is one
+	int handle;
+	if (m_Free.empty())
+	{
+		handle = (int)m_Entries.size();
+		m_Entries.push_back(Entry());
+	}
+	else
+	{
+		handle = m_Free.back();
+		m_Free.pop_back();
+	}
+
+	Entry& entry = m_Entries[handle];
+	entry.active = true;
+	entry.effect = false;
+	entry.speed = max(speed, 0);
+	entry.charge = charge;
+	entry.updated = m_Time;
+	entry.ready = ready_time(entry);
+	entry.order = m_NextOrder++;
+
+	m_Heap.push_back(handle);
+	sift_up((int)m_Heap.size() - 1);
+	return handle;
+}
+
+int Timeline::add_effect(int delay)
+{
+	int handle = add_actor(0);
+
+	Entry& entry = m_Entries[handle];
+	entry.effect = true;
+	entry.ready = m_Time + max(0, delay);
+	sift_up(entry.heap);
+	return handle;
+}
+
+void Timeline::remove(int handle)
+{
+	Entry& entry = m_Entries[handle];
+	if (!entry.active)
+		return;
+	entry.active = false;
+	m_Free.push_back(handle);
+
+	// Fill the hole with the last entry in the heap, then put that entry where it belongs
+	int pos = entry.heap;
+	int last = m_Heap.back();
+	m_Heap.pop_back();
+	if (last != handle)
+	{
+		m_Heap[pos] = last;
+		m_Entries[last].heap = pos;
+		sift_up(pos);
+		sift_down(m_Entries[last].heap);
+	}
+}
+
+void Timeline::set_speed(int handle, int speed)
+{
+	Entry& entry = m_Entries[handle];
+	speed = max(speed, 0);
+	if (!entry.active || entry.effect || entry.speed == speed)
+		return;
+
+	// Bank the charge gained at the old speed, then work out the new ready time
+	entry.charge += (m_Time - entry.updated) * entry.speed;
+	entry.updated = m_Time;
+	entry.speed = speed;
+
+	long long ready = ready_time(entry);
+	bool earlier = ready < entry.ready;
+	entry.ready = ready;
+
+	if (earlier)	sift_up(entry.heap);
+	else			sift_down(entry.heap);
+}
+
+int Timeline::peek() const
+{
+	if (m_Heap.empty() || m_Entries[m_Heap[0]].ready == LLONG_MAX)
+		return -1;
+	return m_Heap[0];
+}
+
+int Timeline::advance()
+{
+	int handle = peek();
+	if (handle < 0)
+		return -1;
+
+	Entry& entry = m_Entries[handle];
+	m_Time = entry.ready;
+
+	if (!entry.effect)
+	{
+		// Keep any overflow of charge, so that fast actors don't lose time
+		entry.charge += ((m_Time - entry.updated) * entry.speed) - CHARGE_TO_ACT;
+		entry.updated = m_Time;
+		entry.ready = ready_time(entry);
+		entry.order = m_NextOrder++;
+		sift_down(0);
+	}
+	else
+	{
+		remove(handle);
+	}
+
+	return handle;
+}
+
+void Timeline::predict(int n, vector<int>& handles) const
+{
+	handles.clear();
+
+	// A future turn of an entry: when it is ready, its order, its handle, its charge after acting, and its position in the heap (or -1 for repeat turns)
+	struct Turn
+	{
+		long long ready;
+		unsigned long long order;
+		int handle;
+		long long charge;
+		int heap;
+
+		bool operator>(const Turn& other) const
+		{
+			if (ready != other.ready)
+				return ready > other.ready;
+			return order > other.order;
+		}
+	};
+
+	// Only the top of the heap and the children of turns already taken can be next, so the search stays small
+	priority_queue<Turn, vector<Turn>, greater<Turn>> frontier;
+	unsigned long long order = m_NextOrder;
+
+	auto push_heap_node = [&](int pos) {
+		if (pos < (int)m_Heap.size())
+		{
+			const Entry& e = m_Entries[m_Heap[pos]];
+			frontier.push({ e.ready, e.order, m_Heap[pos], e.charge + ((e.ready - e.updated) * e.speed), pos });
+		}
+	};
+	push_heap_node(0);
+
+	while ((int)handles.size() < n && !frontier.empty())
+	{
+		Turn turn = frontier.top();
+		frontier.pop();
+		if (turn.ready == LLONG_MAX)
+			break;
+
+		handles.push_back(turn.handle);
+
+		if (turn.heap >= 0)
+		{
+			push_heap_node((2 * turn.heap) + 1);
+			push_heap_node((2 * turn.heap) + 2);
+		}
+
+		// Actors come back around after they act
+		const Entry& e = m_Entries[turn.handle];
+		if (!e.effect)
+		{
+			Entry next = e;
+			next.charge = turn.charge - CHARGE_TO_ACT;
+			next.updated = turn.ready;
+			long long ready = ready_time(next);
+			frontier.push({ ready, order++, turn.handle, next.charge + ((ready - turn.ready) * e.speed), -1 });
+		}
+	}
+}
+
+long long Timeline::get_time() const
+{
+	return m_Time;
+}
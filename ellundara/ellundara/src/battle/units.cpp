@@ -0,0 +1,189 @@
+#include "../../include/battle.h"
+
+using namespace std;
+using namespace Battle;
+
+
+Entity UnitStore::create(Grid* grid, int faction, UnitPosition pos, const CombatStats& stats, const UnitMovement& movement, const UnitStatus& status, SpriteGraphic* sprite)
+{
+	const Tile* tile = grid->get_tile(pos.x, pos.y);
+	if (!tile || !tile->unit.is_null())
+		return Entity();
+
+	// Reuse a free handle slot, if there is one
+	uint32_t slot;
+	if (m_Free.empty())
+	{
+		slot = (uint32_t)m_Indices.size();
+		m_Indices.push_back(0);
+		m_Generations.push_back(0);
+	}
+	else
+	{
+		slot = m_Free.back();
+		m_Free.pop_back();
+	}
+
+	m_Indices[slot] = (uint32_t)m_Positions.size();
+	m_Owners.push_back(slot);
+
+	m_Positions.push_back(pos);
+	m_Stats.push_back(stats);
+	m_Movement.push_back(movement);
+	m_Status.push_back(status);
+	m_Factions.push_back(faction);
+	m_Sprites.push_back(sprite);
+
+	Entity entity = { slot, m_Generations[slot] };
+	grid->set_tile_unit(pos.x, pos.y, entity);
+	return entity;
+}
+
+void UnitStore::destroy(Entity entity, Grid* grid)
+{
+	int index = index_of(entity);
+	if (index < 0)
+		return;
+
+	const UnitPosition& pos = m_Positions[index];
+	const Tile* tile = grid->get_tile(pos.x, pos.y);
+	if (tile && tile->unit == entity)
+		grid->set_tile_unit(pos.x, pos.y, Entity());
+
+	// Move the last unit into the hole, so the arrays stay packed
+	int last = size() - 1;
+	if (index != last)
+	{
+		m_Positions[index] = m_Positions[last];
+		m_Stats[index] = m_Stats[last];
+		m_Movement[index] = m_Movement[last];
+		m_Status[index] = m_Status[last];
+		m_Factions[index] = m_Factions[last];
+		m_Sprites[index] = m_Sprites[last];
+		m_Owners[index] = m_Owners[last];
+		m_Indices[m_Owners[index]] = index;
+	}
+
+	m_Positions.pop_back();
+	m_Stats.pop_back();
+	m_Movement.pop_back();
+	m_Status.pop_back();
+	m_Factions.pop_back();
+	m_Sprites.pop_back();
+	m_Owners.pop_back();
+
+	++m_Generations[entity.index];
+	m_Free.push_back(entity.index);
+}
+
+bool UnitStore::alive(Entity entity) const
+{
+	return index_of(entity) >= 0;
+}
+
+int UnitStore::index_of(Entity entity) const
+{
+	if (entity.index >= m_Generations.size() || m_Generations[entity.index] != entity.generation)
+		return -1;
+	return (int)m_Indices[entity.index];
+}
+
+const void* UnitStore::get_resource(Entity entity) const
+{
+	return &m_Generations[entity.index];
+}
+
+Entity UnitStore::entity_at(int index) const
+{
+	uint32_t slot = m_Owners[index];
+	return { slot, m_Generations[slot] };
+}
+
+bool UnitStore::move(Entity entity, Grid* grid, int x, int y)
+{
+	int index = index_of(entity);
+	const Tile* to = grid->get_tile(x, y);
+	if (index < 0 || !to || !(to->unit.is_null() || to->unit == entity))
+		return false;
+
+	UnitPosition& pos = m_Positions[index];
+	const Tile* from = grid->get_tile(pos.x, pos.y);
+	if (from && from->unit == entity)
+		grid->set_tile_unit(pos.x, pos.y, Entity());
+
+	grid->set_tile_unit(x, y, entity);
+
+	pos.x = x;
+	pos.y = y;
+	return true;
+}
+
+int UnitStore::size() const
+{
+	return (int)m_Positions.size();
+}
+
+span<UnitPosition> UnitStore::get_positions()
+{
+	return m_Positions;
+}
+
+span<CombatStats> UnitStore::get_stats()
+{
+	return m_Stats;
+}
+
+span<UnitMovement> UnitStore::get_movement()
+{
+	return m_Movement;
+}
+
+span<UnitStatus> UnitStore::get_status()
+{
+	return m_Status;
+}
+
+span<int> UnitStore::get_factions()
+{
+	return m_Factions;
+}
+
+span<SpriteGraphic*> UnitStore::get_sprites()
+{
+	return m_Sprites;
+}
+
+span<const UnitPosition> UnitStore::get_positions() const
+{
+	return m_Positions;
+}
+
+span<const CombatStats> UnitStore::get_stats() const
+{
+	return m_Stats;
+}
+
+span<const UnitMovement> UnitStore::get_movement() const
+{
+	return m_Movement;
+}
+
+span<const UnitStatus> UnitStore::get_status() const
+{
+	return m_Status;
+}
+
+span<const int> UnitStore::get_factions() const
+{
+	return m_Factions;
+}
+
+span<SpriteGraphic* const> UnitStore::get_sprites() const
+{
+	return m_Sprites;
+}
+
+Sim::UnitSpans UnitStore::get_spans() const
+{
+	return { m_Positions, m_Stats, m_Movement, m_Status, m_Factions };
+}
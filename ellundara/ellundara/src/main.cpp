@@ -1,3 +1,5 @@
+#include <future>
+#include <iostream>
 #include "../include/controls.h"
 #include "../include/state.h"
 #include "../include/battle.h"
@@ -22,8 +24,59 @@ void set_state(State* state)
 }
 
 
+float StateLoader::get_progress() const
+{
+	return m_Progress;
+}
+
+const std::string& StateLoader::get_error() const
+{
+	return m_Error;
+}
+
+
+StateLoader* g_Loader = nullptr;
+std::future<void> g_Loading;
+
+bool preload_state(StateLoader* loader)
+{
+	if (g_Loader)
+		return false;
+
+	g_Loader = loader;
+	g_Loading = std::async(std::launch::async, [loader]() { loader->load(); });
+	return true;
+}
+
+float get_preload_progress()
+{
+	return g_Loader ? g_Loader->get_progress() : -1.f;
+}
+
+/// <summary>Swaps in the preloaded state, if it has finished loading.</summary>
+void update_preload()
+{
+	if (g_Loader && g_Loading.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		g_Loading.get();
+
+		State* state = g_Loader->finish();
+		if (!state)
+			std::cout << g_Loader->get_error() << std::endl;
+		delete g_Loader;
+		g_Loader = nullptr;
+
+		// Keep the current state if the next one failed to load
+		if (state)
+			set_state(state);
+	}
+}
+
+
 void display()
 {
+	update_preload();
+
 	if (g_State)
 		g_State->display();
 }
@@ -45,8 +98,13 @@ int main()
 	register_keyboard_control(CONTROL_ROTATE_LEFT, CONTROL_ROTATE_LEFT_DEFAULT);
 	register_keyboard_control(CONTROL_ROTATE_RIGHT, CONTROL_ROTATE_RIGHT_DEFAULT);
 
-	// Initialize the global state.
-	set_state(new BattleState("debug"));
+	register_keyboard_control(CONTROL_ZOOM_IN, CONTROL_ZOOM_IN_DEFAULT);
+	register_keyboard_control(CONTROL_ZOOM_OUT, CONTROL_ZOOM_OUT_DEFAULT);
+
+	register_keyboard_control(CONTROL_END_PHASE, CONTROL_END_PHASE_DEFAULT);
+
+	// Load the global state; nothing is displayed until it is ready.
+	preload_state(new BattleLoader("debug"));
 
 	// Run the main loop, using the above function to display.
 	onion_main(&display);
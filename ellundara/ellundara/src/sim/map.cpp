@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "../../include/sim.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+using namespace std;
+using namespace Sim;
+
+
+Map::Map()
+{
+	width = 0;
+	height = 0;
+}
+
+bool Map::load(string path)
+{
+	ifstream file(path);
+	if (!file.good())
+		return false;
+
+	width = 0;
+	height = 0;
+	m_Tiles.clear();
+	m_Types.clear();
+	tileset.clear();
+	regions.clear();
+	objects.clear();
+	units.clear();
+
+	string line;
+	while (getline(file, line))
+	{
+		// Pad out the equals signs, so that "x=1" and "x = 1" read the same
+		string padded;
+		for (char c : line)
+		{
+			if (c == '=')	padded += " = ";
+			else			padded += c;
+		}
+
+		istringstream in(padded);
+		string category, id;
+		if (!(in >> category >> id))
+			continue;
+
+		if (category == "tileset")
+		{
+			tileset = id;
+			continue;
+		}
+
+		// Read the key = value pairs
+		unordered_map<string, int> data;
+		string key, eq;
+		int value;
+		while (in >> key >> eq >> value)
+			data[key] = value;
+
+		// Construct tiles
+		if (category == "tile")
+		{
+			int x = data["x"];
+			int y = data["y"];
+			int dx = data["dx"];
+			int dy = data["dy"];
+			if (x < 0 || y < 0 || dx <= 0 || dy <= 0)
+				continue;
+
+			if (x + dx > width || y + dy > height)
+			{
+				int new_width = max(x + dx, width);
+				int new_height = max(y + dy, height);
+
+				vector<Tile> new_tiles(new_width * new_height, { -1, 0, false, -1 });
+				for (int i = 0; i < width; ++i)
+				{
+					for (int j = 0; j < height; ++j)
+					{
+						new_tiles[GRID_COORDINATE(i, j, new_width)] = m_Tiles[GRID_COORDINATE(i, j, width)];
+					}
+				}
+
+				m_Tiles.swap(new_tiles);
+				width = new_width;
+				height = new_height;
+			}
+
+			// Find the index of the type, adding it if it's new
+			int type = (int)(find(m_Types.begin(), m_Types.end(), id) - m_Types.begin());
+			if (type == (int)m_Types.size())
+				m_Types.push_back(id);
+
+			int h = data["height"];
+			regions.push_back({ type, x, y, dx, dy, h });
+			for (int i = x; i < x + dx; ++i)
+			{
+				for (int j = y; j < y + dy; ++j)
+				{
+					Tile& tile = m_Tiles[GRID_COORDINATE(i, j, width)];
+					tile.type = type;
+					tile.height = h;
+				}
+			}
+		}
+
+		// Objects are placed once the size of the map is known
+		else if (category == "obj")
+		{
+			objects.push_back({ id, data["x"], data["y"] });
+		}
+
+		// Units are placed once the size of the map is known
+		else if (category == "unit")
+		{
+			units.push_back({ data["x"], data["y"], data["faction"], data["hp"], data["attack"], data["defense"],
+				data["move"], data["climb"], data["accuracy"], data["evasion"] });
+		}
+	}
+
+	// Objects block the tile that they're on
+	objects.erase(remove_if(objects.begin(), objects.end(), [this](const Placement& obj) { return !get_tile(obj.x, obj.y); }), objects.end());
+	for (const Placement& obj : objects)
+		m_Tiles[GRID_COORDINATE(obj.x, obj.y, width)].blocked = true;
+
+	// Units can't stand on an object
+	units.erase(remove_if(units.begin(), units.end(), [this](const Unit& unit) {
+		const Tile* tile = get_tile(unit.x, unit.y);
+		return !tile || tile->blocked;
+	}), units.end());
+
+	return true;
+}
+
+const Tile* Map::get_tile(int x, int y) const
+{
+	if (x >= 0 && x < width && y >= 0 && y < height)
+		return m_Tiles.data() + GRID_COORDINATE(x, y, width);
+	return nullptr;
+}
+
+const string& Map::get_type_name(int type) const
+{
+	return m_Types[type];
+}
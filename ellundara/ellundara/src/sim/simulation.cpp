@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <cstdlib>
+#include "../../include/sim.h"
+
+#define GRID_COORDINATE(x, y, width) ((x) + ((width) * (y)))
+
+using namespace std;
+using namespace Sim;
+
+
+int Sim::get_hit_chance(int accuracy, int evasion, int height)
+{
+	return clamp(accuracy - evasion + (height * HEIGHT_ACCURACY), 0, 100);
+}
+
+int Sim::get_damage(int attack, int defense, int height)
+{
+	return max(1, attack - defense + (max(0, height) * HEIGHT_DAMAGE));
+}
+
+
+Simulation::Simulation(const Map& map, unsigned int seed) : m_Random(seed)
+{
+	m_Width = map.width;
+	m_Height = map.height;
+
+	m_Tiles.reserve(m_Width * m_Height);
+	for (int j = 0; j < m_Height; ++j)
+		for (int i = 0; i < m_Width; ++i)
+			m_Tiles.push_back(*map.get_tile(i, j));
+
+	m_Distance.resize(m_Tiles.size());
+	m_Frontier.reserve(m_Tiles.size());
+
+	m_Phase = 0;
+	m_Turn = 0;
+}
+
+Tile* Simulation::get_tile(int x, int y)
+{
+	if (x >= 0 && x < m_Width && y >= 0 && y < m_Height)
+		return m_Tiles.data() + GRID_COORDINATE(x, y, m_Width);
+	return nullptr;
+}
+
+int Simulation::add_unit(const Unit& unit)
+{
+	Tile* tile = get_tile(unit.x, unit.y);
+	if (!tile || tile->type < 0 || tile->blocked || tile->unit >= 0)
+		return -1;
+
+	tile->unit = (int)m_Units.size();
+	m_Units.push_back(unit);
+	m_Queue.push_back(tile->unit);
+	return tile->unit;
+}
+
+int Simulation::add_units(const UnitSpans& units)
+{
+	int added = 0;
+	for (size_t k = 0; k < units.positions.size(); ++k)
+	{
+		if (units.status[k].hp <= 0)
+			continue;
+
+		const CombatStats& stats = units.stats[k];
+		Unit unit = { units.positions[k].x, units.positions[k].y, units.factions[k], units.status[k].hp,
+			stats.attack, stats.defense, units.movement[k].move, units.movement[k].climb, stats.accuracy, stats.evasion };
+		if (add_unit(unit) >= 0)
+			++added;
+	}
+	return added;
+}
+
+int Simulation::enemy_distance(int x, int y, int faction) const
+{
+	int best = m_Width + m_Height;
+	for (const Unit& u : m_Units)
+	{
+		if (u.hp > 0 && u.faction != faction)
+		{
+			int d = abs(u.x - x) + abs(u.y - y);
+			if (d < best)
+				best = d;
+		}
+	}
+	return best;
+}
+
+void Simulation::move_unit(int index)
+{
+	Unit& unit = m_Units[index];
+
+	// Flood out from the unit's tile to find everywhere it can reach
+	fill(m_Distance.begin(), m_Distance.end(), -1);
+	m_Frontier.clear();
+
+	int start = GRID_COORDINATE(unit.x, unit.y, m_Width);
+	m_Distance[start] = 0;
+	m_Frontier.push_back(start);
+
+	const int dx[4] = { 1, -1, 0, 0 };
+	const int dy[4] = { 0, 0, 1, -1 };
+
+	int best = start;
+	int best_dist = enemy_distance(unit.x, unit.y, unit.faction);
+	int ties = 1;
+
+	for (size_t k = 0; k < m_Frontier.size(); ++k)
+	{
+		int c = m_Frontier[k];
+		int cx = c % m_Width;
+		int cy = c / m_Width;
+
+		// Pick the reachable tile closest to an enemy, breaking ties at random
+		if (c != start)
+		{
+			int d = enemy_distance(cx, cy, unit.faction);
+			if (d < best_dist)
+			{
+				best = c;
+				best_dist = d;
+				ties = 1;
+			}
+			else if (d == best_dist && uniform_int_distribution<int>(0, ties++)(m_Random) == 0)
+			{
+				best = c;
+			}
+		}
+
+		if (m_Distance[c] >= unit.move)
+			continue;
+
+		for (int n = 0; n < 4; ++n)
+		{
+			Tile* next = get_tile(cx + dx[n], cy + dy[n]);
+			if (!next || next->type < 0 || next->blocked || next->unit >= 0)
+				continue;
+			if (abs(next->height - m_Tiles[c].height) > unit.climb)
+				continue;
+
+			int nc = GRID_COORDINATE(cx + dx[n], cy + dy[n], m_Width);
+			if (m_Distance[nc] < 0)
+			{
+				m_Distance[nc] = m_Distance[c] + 1;
+				m_Frontier.push_back(nc);
+			}
+		}
+	}
+
+	if (best != start)
+	{
+		m_Tiles[start].unit = -1;
+		m_Tiles[best].unit = index;
+		unit.x = best % m_Width;
+		unit.y = best / m_Width;
+	}
+}
+
+void Simulation::attack(int index)
+{
+	Unit& unit = m_Units[index];
+	const Tile* from = get_tile(unit.x, unit.y);
+
+	const int dx[4] = { 1, -1, 0, 0 };
+	const int dy[4] = { 0, 0, 1, -1 };
+
+	// Attack the weakest adjacent enemy
+	Unit* target = nullptr;
+	const Tile* to = nullptr;
+	for (int n = 0; n < 4; ++n)
+	{
+		const Tile* tile = get_tile(unit.x + dx[n], unit.y + dy[n]);
+		if (tile && tile->unit >= 0)
+		{
+			Unit& other = m_Units[tile->unit];
+			if (other.faction != unit.faction && (!target || other.hp < target->hp))
+			{
+				target = &other;
+				to = tile;
+			}
+		}
+	}
+
+	if (!target)
+		return;
+
+	// Attacking from higher ground is more accurate and does extra damage
+	int height = from->height - to->height;
+	if (uniform_int_distribution<int>(0, 99)(m_Random) >= get_hit_chance(unit.accuracy, target->evasion, height))
+		return;
+
+	int damage = get_damage(unit.attack, target->defense, height);
+	target->hp = max(0, target->hp - damage);
+
+	if (target->hp == 0)
+		m_Tiles[GRID_COORDINATE(target->x, target->y, m_Width)].unit = -1;
+}
+
+void Simulation::step()
+{
+	for (int index : m_Queue)
+	{
+		Unit& unit = m_Units[index];
+		if (unit.hp <= 0 || unit.faction != m_Phase)
+			continue;
+
+		move_unit(index);
+		attack(index);
+	}
+
+	// Move on to the next faction with living units
+	int factions = 0;
+	for (const Unit& u : m_Units)
+		factions = max(factions, u.faction + 1);
+
+	for (int k = 1; k <= factions; ++k)
+	{
+		int next = (m_Phase + k) % factions;
+		if (any_of(m_Units.begin(), m_Units.end(), [next](const Unit& u) { return u.hp > 0 && u.faction == next; }))
+		{
+			m_Phase = next;
+			break;
+		}
+	}
+
+	++m_Turn;
+}
+
+int Simulation::run(int max_turns)
+{
+	int winner;
+	while ((winner = get_winner()) < 0 && m_Turn < max_turns)
+		step();
+	return winner;
+}
+
+int Simulation::get_winner() const
+{
+	int winner = -1;
+	for (const Unit& u : m_Units)
+	{
+		if (u.hp > 0)
+		{
+			if (winner < 0)
+				winner = u.faction;
+			else if (winner != u.faction)
+				return -1;
+		}
+	}
+	return winner;
+}
+
+int Simulation::get_turn() const
+{
+	return m_Turn;
+}
+
+const vector<Unit>& Simulation::get_units() const
+{
+	return m_Units;
+}